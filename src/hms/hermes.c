@@ -7,226 +7,2268 @@
  *
  **/
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#define HMS_HAVE_EPOLL
+#endif
+
 #include <hermes.h>
+#include <errno.h>
+#include <stddef.h>
+#include <poll.h>
+#ifdef HMS_HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#define HMS_LOOP_EVENTS 64
+/* verb table slots: a power of two, at least twice HERMES_MAX_VERBS */
+#define HMS_VERB_SLOTS (2 * HERMES_MAX_VERBS)
+/* ms to wait after accept runs out of descriptors or memory */
+#define HMS_ACCEPT_BACKOFF 10
+/* io_uring loops: queue size, receive buffers and accepts kept queued */
+#define HMS_URING_ENTRIES  256
+#define HMS_URING_BUFS     128
+#define HMS_URING_BUF_SIZE 16384
+#define HMS_URING_ACCEPTS  8
+/* ring completions for a socket that can take more: the endpoint, tagged */
+#define HMS_URING_OUT(endpoint) ((void *) ((char *) (endpoint) + 1))
+#define HMS_URING_IS_OUT(data)  (((uintptr_t) (data)) & 1)
 
 /* Function prototypes */
 /* ---------------------------------------------------- */
 /* Manager code */
 static void  _hms_listen(hms *manager);
+static void  _hms_init_abort( hms *manager );
+static int  _hms_open_listener( hms *manager, int reuseport );
+static hms_endpoint* _hms_endpoint_accepted( hms *manager, int fd );
+static void  _hms_endpoint_setup( hms_endpoint *endpoint, int fd, hms_ops ops );
+static void _hms_listen_sample( hms *manager, int fd );
+static int  _hms_listen_drops( long *overflows, long *drops );
 static void _hms_handle_endpoint( hms_endpoint *endpoint );
+static int  _hms_endpoint_dispatch( hms_endpoint *endpoint, hms_msg *msg );
+
+/* Verb routing */
+static unsigned _hms_verb_hash( const char *verb, int len );
+static hms_verb* _hms_verb_find( hms_verb_table *table, const char *verb, int len );
+static int      _hms_verb_add( hms_verb_table *table, const char *verb, hms_ops *ops );
+static void     _hms_builtin_verbs_init( void );
+
+/* Event loops */
+static int   _hms_loops_start( hms *manager );
+static void  _hms_loops_stop( hms *manager );
+static void  _hms_loops_free( hms *manager, int force );
+static int   _hms_loop_add( hms_loop *loop, hms_endpoint *endpoint );
+static void* _hms_loop_run( void *arg );
+static void  _hms_loop_accept( hms_loop *loop );
+static int   _hms_shard_cpu( int shard );
+static void  _hms_loop_ready( hms_endpoint *endpoint );
+static int   _hms_loop_submit( hms_endpoint *endpoint, hms_msg *msg );
+static void  _hms_loop_work( hms_endpoint *endpoint );
+static void  _hms_loop_close( hms_endpoint *endpoint );
+static void  _hms_loop_destroy( hms_endpoint *endpoint );
+static int   _hms_loop_queue( hms_endpoint *endpoint, struct iovec *iov, int iovcnt );
+static int   _hms_loop_append( hms_endpoint *endpoint, struct iovec *iov, int iovcnt, int *post );
+static int   _hms_loop_append_locked( hms_endpoint *endpoint, struct iovec *iov, int iovcnt, int *post );
+static int   _hms_out_admit( hms_endpoint *endpoint, int len );
+static void  _hms_loop_post( hms_endpoint *endpoint );
+static void  _hms_loop_sendq( hms_loop *loop );
+static void  _hms_loop_flush( hms_endpoint *endpoint );
+static int   _hms_loop_wait_writable( hms_endpoint *endpoint );
+static void  _hms_loop_writable( hms_loop *loop );
+static int   _hms_request_submit( hms_endpoint *endpoint, hms_msg *msg );
+static void  _hms_request_work( hms_request *req );
+static int   _hms_request_append( hms_request *req, struct iovec *iov, int iovcnt );
+static void  _hms_request_done( hms_request *req, int status );
+
+/* Connection slab */
+static hms_conn_slab* _hms_conns_create( int size );
+static void     _hms_conns_destroy( hms_conn_slab *slab );
+static hms_endpoint* _hms_conn_alloc( hms_conn_slab *slab );
+static void     _hms_conn_retire( hms_endpoint *endpoint );
+static void     _hms_conn_free( hms_conn_slab *slab, hms_endpoint *endpoint );
+static int      _hms_conn_queue( hms *manager, hms_conn conn, struct iovec *iov, int iovcnt );
+static void  _hms_loop_deinit( hms_loop *loop );
+static void  _hms_loop_fail( hms_loop *loop );
+static void* _hms_uring_run( void *arg );
+static int   _hms_uring_arm( hms_endpoint *endpoint );
+static void  _hms_uring_wake( hms_loop *loop );
+static void  _hms_uring_accepted( hms_loop *loop, int fd );
+static void  _hms_uring_received( hms_endpoint *endpoint, hms_uring_event *event );
+
+/* Endpoint bodies */
+static int _hms_endpoint_recv_header( hms_endpoint *endpoint, hms_msg **msg );
+static int _hms_endpoint_recv_body( hms_endpoint *endpoint, hms_msg *msg );
+static int _hms_endpoint_stream_body( hms_endpoint *endpoint, hms_ops *ops, hms_msg *msg );
+static int _hms_endpoint_sink_body( hms_endpoint *endpoint, hms_ops *ops, hms_msg *msg,
+				    int out_fd, off_t offset );
+static int _hms_endpoint_deliver_body( hms_endpoint *endpoint, hms_ops *ops, hms_msg *msg );
+static int _hms_endpoint_deliver_buffered( hms_endpoint *endpoint, hms_ops *ops, hms_msg *msg );
 
 /* Endpoint code */
+static int _hms_endpoint_fast_reply( hms_endpoint *endpoint );
+static int _hms_loop_fast_reply( hms_endpoint *endpoint );
+
+/* Admission control */
+static int  _hms_send_busy( hms *manager, int fd );
+static void _hms_shed_endpoint( hms *manager, hms_endpoint *endpoint );
+static int  _hms_shed_msg( hms *manager, hms_endpoint *endpoint, hms_msg *msg );
+
+/* Socket helpers */
+static int __pwrite_all( int fd, char *p, int len, off_t offset );
+static int __sendv_all( int fd, struct iovec *iov, int iovcnt, int timeout );
+static int __msg_iov( char **wbuf, int *wbuf_cap, hms_msg *msg, struct iovec *iov );
+static int __buf_append( char **buf, int *len, int *cap, struct iovec *iov, int iovcnt );
+static int _hms_endpoint_sendv( hms_endpoint *endpoint, struct iovec *iov, int iovcnt );
 
 /* Default client code */
 static int _hms_default_validate(hms_endpoint *endpoint, hms_msg *msg);
 static int _hms_default_accepts( struct hms_endpoint *endpoint, hms_msg *msg );
 static int _hms_default_handle(hms_endpoint *endpoint, hms_msg *msg);
+static int _hms_default_ping( hms_endpoint *endpoint, hms_msg *msg );
+static int _hms_default_info( hms_endpoint *endpoint, hms_msg *msg );
+static int _hms_default_bye( hms_endpoint *endpoint, hms_msg *msg );
+static int _hms_send_info( hms_endpoint *endpoint );
+static int _hms_info_reply( char *reply, int cap );
+
+/* verbs the default handler answers, routed like registered ones */
+static hms_verb_table _hms_builtin_verbs;
+static pthread_once_t _hms_builtin_once = PTHREAD_ONCE_INIT;
+
+/* Fixed replies of the default handler */
+static char _hms_pong_bytes[] = "PONG\n.\n";
+static char _hms_error_bytes[] = "ERROR\n.\n";
+static char _hms_busy_bytes[] = "BUSY\n.\n";
+static hms_reply_template _hms_pong_reply = { _hms_pong_bytes, sizeof(_hms_pong_bytes) - 1 };
+static hms_reply_template _hms_error_reply = { _hms_error_bytes, sizeof(_hms_error_bytes) - 1 };
+static hms_reply_template _hms_busy_reply = { _hms_busy_bytes, sizeof(_hms_busy_bytes) - 1 };
+
+/* the loop running on this thread, if any */
+static __thread hms_loop *_hms_loop_self = NULL;
+/* the request this worker is handling, with pipeline_depth > 1 */
+static __thread hms_request *_hms_request = NULL;
 
 /* Hermes implementation */
 /* ---------------------------------------------------- */
 
-hms* hermes_init( int num_threads , int server_port, hms_ops ops ) {
+void hms_config_init( hms_config *config ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) config);
+
+  memset( config, 0, sizeof(hms_config) );
+  config->num_threads = 1;
+  config->server_port = 0;
+  config->rbuf_size = HERMES_RBUF_SIZE;
+  config->max_hdr_size = HERMES_MAX_HDR_SIZE;
+  config->max_body_size = HERMES_MAX_BODY_SIZE;
+  config->fast_replies = HMS_FALSE;
+  config->event_loops = 0;
+  config->shards = 0;
+  config->backlog = HERMES_BACKLOG;
+  config->io_uring = HMS_FALSE;
+  config->tcp_nodelay = HMS_TRUE;
+  config->sndbuf = 0;
+  config->rcvbuf = 0;
+  config->max_pending_conns = HERMES_MAX_PENDING_CONNS;
+  config->max_pending_msgs = HERMES_MAX_PENDING_MSGS;
+  config->busy_reply = HMS_TRUE;
+  config->staged_replies = HMS_FALSE;
+  config->pipeline_depth = 1;
+  config->max_conns = HERMES_MAX_CONNS;
+  config->max_outbound = HERMES_MAX_OUTBOUND;
+  config->slow_consumer = HMS_SLOW_CLOSE;
+  config->send_timeout = HERMES_SEND_TIMEOUT;
+
+} /* end hms_config_init() */
+
+hms* hermes_init( int num_threads , int server_port, hms_ops ops ) {
+
+  hms_config config;
+  hms_config_init( &config );
+  config.num_threads = num_threads;
+  config.server_port = server_port;
+
+  return hermes_init_with_config( &config, ops );
+
+} /* end hermes_init */
+
+hms* hermes_init_with_config( hms_config *config, hms_ops ops ) {
+
+  hms *manager = NULL;
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) config);
+
+  /* malloc space */
+  manager = (hms *) malloc( sizeof(hms) );
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) manager);
+
+  /* ignore broken pipe */
+  signal( SIGPIPE, SIG_IGN );
+
+  /* initialize mutexes */
+  pthread_mutex_init( &(manager->manager_lock), NULL);
+
+  /* set defaults */
+  manager->config = *config;
+  /* a queue that holds nothing would turn everything away */
+  if( manager->config.max_pending_conns < 1 ) { manager->config.max_pending_conns = 1; }
+  if( manager->config.max_pending_msgs < 1 ) { manager->config.max_pending_msgs = 1; }
+  /* replies of parallel requests are put in order before they are written */
+  if( manager->config.pipeline_depth < 1 ) { manager->config.pipeline_depth = 1; }
+  if( manager->config.pipeline_depth > 1 ) { manager->config.staged_replies = HMS_TRUE; }
+  manager->num_threads = config->num_threads;
+  manager->shutdown = HMS_FALSE;
+  manager->server_port = config->server_port;
+  manager->server_socket = -1;
+  memset( &manager->listen_stats, 0, sizeof(manager->listen_stats) );
+  memset( &manager->shed_stats, 0, sizeof(manager->shed_stats) );
+  manager->listen_overflows = manager->listen_drops = 0;
+  _hms_listen_drops( &manager->listen_overflows, &manager->listen_drops );
+
+  memset( &manager->verbs, 0, sizeof(manager->verbs) );
+  pthread_once( &_hms_builtin_once, _hms_builtin_verbs_init );
+
+  manager->dops.hms_validate = _hms_default_validate;
+  manager->dops.hms_handle = _hms_default_handle;
+  manager->ops = ops;
+
+  /* create the thread pool: a worker per connection, or workers for
+     the messages the event loops complete */
+  manager->loops = NULL;
+  manager->num_loops = 0;
+  manager->next_loop = 0;
+  manager->sharded = HMS_FALSE;
+  manager->conns = NULL;
+  if( manager->server_port > 0 || config->event_loops > 0 ) {
+    if( manager->config.max_conns < 1 ) { manager->config.max_conns = 1; }
+    manager->conns = _hms_conns_create( manager->config.max_conns );
+    hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) manager->conns );
+  }
+#ifdef HMS_HAVE_EPOLL
+  if( config->shards > 0 && manager->server_port > 0 ) {
+    /* every shard has its own pool and accepts on its own */
+    manager->pool = NULL;
+    manager->sharded = HMS_TRUE;
+    if( _hms_loops_start( manager ) != 0 ) { _hms_init_abort( manager ); return NULL; }
+  } else if( config->event_loops > 0 ) {
+    tpool_init(&manager->pool, (manager->num_threads + 1), manager->config.max_pending_msgs, HMS_TRUE );
+    if( _hms_loops_start( manager ) != 0 ) { _hms_init_abort( manager ); return NULL; }
+  } else
+#endif
+  tpool_init(&manager->pool, (manager->num_threads + 2), manager->config.max_pending_conns, HMS_TRUE );
+  //fprintf(stdout, "created thread pool\n"); fflush(stdout);
+  
+  /* starts a thread to listen */
+  if( manager->server_port > 0 && !manager->sharded ) {
+    hms_assert_not_equals(__FILE__, __LINE__,  -1, tpool_add_work(manager->pool, (void *) _hms_listen, (void *) manager) );    
+  }
+
+  return manager;
+
+} /* end hermes_init_with_config() */
+
+/* Undoes a hermes_init_with_config() whose loops did not all start:
+   the ones that did are stopped and freed with the pools */
+static void _hms_init_abort( hms *manager ) {
+
+  hermes_shutdown( manager, HMS_TRUE );
+  if( manager->conns ) { _hms_conns_destroy( manager->conns ); manager->conns = NULL; }
+  pthread_mutex_destroy( &manager->manager_lock );
+  free( manager );
+
+} /* end _hms_init_abort() */
+
+
+
+int  hermes_shutdown( hms *manager, int force ) {
+
+  pthread_mutex_lock( &manager->manager_lock );
+  manager->shutdown = HMS_TRUE;
+
+  /* wakes the listener from its poll */
+  if( manager->server_socket >= 0 ) { shutdown( manager->server_socket, SHUT_RDWR ); }
+
+  /* the event loops hand work to the pool, stop them first */
+  _hms_loops_stop( manager );
+
+  /* blocks until all threads end */
+  if( manager->pool ) { tpool_destroy( manager->pool, force ); }
+  _hms_loops_free( manager, force );
+  if( manager->conns ) { _hms_conns_destroy( manager->conns ); manager->conns = NULL; }
+
+  /* clean up memory */
+  if( manager->server_socket >= 0 ) { close(manager->server_socket); }
+  pthread_mutex_unlock( &manager->manager_lock );
+
+  return 0;
+
+} /* end hermes_shutdown() */
+
+void hermes_get_listen_stats( hms *manager, hms_listen_stats *stats ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) manager);
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) stats);
+
+  long overflows = 0, drops = 0;
+
+  stats->accepted = __atomic_load_n( &manager->listen_stats.accepted, __ATOMIC_RELAXED );
+  stats->wakeups = __atomic_load_n( &manager->listen_stats.wakeups, __ATOMIC_RELAXED );
+  stats->queue_full = __atomic_load_n( &manager->listen_stats.queue_full, __ATOMIC_RELAXED );
+  stats->queue_peak = __atomic_load_n( &manager->listen_stats.queue_peak, __ATOMIC_RELAXED );
+  stats->overflows = stats->drops = 0;
+  if( _hms_listen_drops( &overflows, &drops ) == 0 ) {
+    stats->overflows = overflows - manager->listen_overflows;
+    stats->drops = drops - manager->listen_drops;
+  }
+
+} /* end hermes_get_listen_stats() */
+
+void hermes_get_shed_stats( hms *manager, hms_shed_stats *stats ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) manager);
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) stats);
+
+  stats->connections = __atomic_load_n( &manager->shed_stats.connections, __ATOMIC_RELAXED );
+  stats->requests = __atomic_load_n( &manager->shed_stats.requests, __ATOMIC_RELAXED );
+  stats->slow = __atomic_load_n( &manager->shed_stats.slow, __ATOMIC_RELAXED );
+
+} /* end hermes_get_shed_stats() */
+
+/* Without event loops the handler queue holds connections, not messages */
+void hermes_get_stage_stats( hms *manager, hms_stage_stats *stats ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) manager);
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) stats);
+
+  int i;
+
+  memset( stats, 0, sizeof(hms_stage_stats) );
+  stats->io_threads = manager->num_loops;
+  if( manager->pool ) {
+    stats->handler_threads = manager->num_threads;
+    stats->handler_queued = tpool_queue_size( manager->pool );
+  }
+
+  for( i=0; i < manager->num_loops; i++ ) {
+    hms_loop *loop = &manager->loops[i];
+    if( loop->pool != manager->pool ) {
+      stats->handler_threads += manager->num_threads;
+      stats->handler_queued += tpool_queue_size( loop->pool );
+    }
+    stats->send_queued += __atomic_load_n( &loop->send_conns, __ATOMIC_RELAXED );
+    stats->send_bytes += __atomic_load_n( &loop->send_bytes, __ATOMIC_RELAXED );
+  }
+
+} /* end hermes_get_stage_stats() */
+
+/* Occupancy of the connection slab; all zero for a manager that
+   does not serve */
+void hermes_get_conn_stats( hms *manager, hms_conn_stats *stats ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) manager);
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) stats);
+
+  memset( stats, 0, sizeof(hms_conn_stats) );
+  if( manager->conns == NULL ) { return; }
+
+  stats->capacity = manager->conns->size;
+  stats->used = __atomic_load_n( &manager->conns->used, __ATOMIC_RELAXED );
+  stats->peak = __atomic_load_n( &manager->conns->peak, __ATOMIC_RELAXED );
+  stats->refused = __atomic_load_n( &manager->conns->refused, __ATOMIC_RELAXED );
+
+} /* end hermes_get_conn_stats() */
+
+/**
+ * Routes every message whose verb matches "verb" (ignoring case) to
+ * "ops": hms_handle is required, hms_validate, hms_body and hms_sink
+ * are optional, hms_accepts is not used. A verb is registered once and
+ * stays; it may be added while connections are served.
+ **/
+int hermes_register_verb( hms *manager, const char *verb, hms_ops ops ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) manager);
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) verb);
+
+  if( !ops.hms_handle ) { return -1; }
+
+  pthread_mutex_lock( &manager->manager_lock );
+  int ret = _hms_verb_add( &manager->verbs, verb, &ops );
+  pthread_mutex_unlock( &manager->manager_lock );
+
+  return ret;
+
+} /* end hermes_register_verb() */
+
+/**
+ * Queues a message for a connection from any thread, without waiting
+ * for its socket: the connection's loop writes it after everything
+ * queued before. Needs staged replies. Returns -1 if the connection is
+ * gone (or closing), or its outbound queue is full.
+ **/
+int hermes_send_msg( hms *manager, hms_conn conn, hms_msg *msg ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) manager);
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) msg);
+
+  struct iovec iov[2];
+  char *wbuf = NULL; int wbuf_cap = 0;
+
+  int iovcnt = __msg_iov( &wbuf, &wbuf_cap, msg, iov );
+  int ret = ( iovcnt == -1 ) ? -1 : _hms_conn_queue( manager, conn, iov, iovcnt );
+  if( wbuf ) { free( wbuf ); }
+
+  return ret;
+
+} /* end hermes_send_msg() */
+
+int hermes_send_template( hms *manager, hms_conn conn, hms_reply_template *tmpl ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) manager);
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) tmpl);
+
+  struct iovec iov;
+  iov.iov_base = tmpl->data; iov.iov_len = tmpl->len;
+
+  return _hms_conn_queue( manager, conn, &iov, 1 );
+
+} /* end hermes_send_template() */
+
+/**
+ *
+ * Runs in a separate thread and spawns new threads to 
+ * handle connections 
+ *
+ **/
+
+static void _hms_listen(hms *manager ) {
+
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) manager );
+
+  int sockfd;
+  int new_fd;
+  unsigned sleep_time = 0;
+  struct pollfd pfd;
+
+ retry_listen:
+
+  /* exponential backoff */
+  if(sleep_time) sleep(sleep_time);
+
+  if(sleep_time == 0) { sleep_time = 2; }
+  else if(sleep_time == 2) { sleep_time = 2*sleep_time; }
+
+  /* open, bind and listen on the socket; non-blocking so a wakeup can
+     drain it */
+  if( (sockfd = _hms_open_listener( manager, HMS_FALSE )) == -1 ) {
+    goto retry_listen;
+  }
+  if( fcntl( sockfd, F_SETFL, O_NONBLOCK ) == -1 ) {
+    perror("fcntl"); close( sockfd ); goto retry_listen;
+  }
+  manager->server_socket = sockfd;
+
+  /* loops want non-blocking sockets, a worker per connection blocks */
+  int accept_flags = SOCK_CLOEXEC | ( (manager->num_loops > 0) ? SOCK_NONBLOCK : 0 );
+
+  /* hermes_shutdown() shuts the socket down, which ends the poll */
+  //fprintf(stdout, "waiting to accept\n"); fflush(stdout);
+  while( !manager->shutdown ) {
+
+    pfd.fd = sockfd; pfd.events = POLLIN; pfd.revents = 0;
+    if( poll( &pfd, 1, -1 ) == -1 ) {
+      if( errno == EINTR ) continue;
+      perror("poll"); return;
+    }
+    _hms_listen_sample( manager, sockfd );
+
+    /* take every connection that is waiting */
+    while( !manager->shutdown ) {
+
+      new_fd = accept4( sockfd, NULL, NULL, accept_flags );
+      if( new_fd == -1 ) {
+	if( errno == EINTR || errno == ECONNABORTED ) continue;
+	if( errno == EAGAIN || errno == EWOULDBLOCK || manager->shutdown ) break;
+	/* out of descriptors or memory: let some connections finish */
+	perror("accept");
+	poll( NULL, 0, HMS_ACCEPT_BACKOFF );
+	break;
+      }
+      __atomic_add_fetch( &manager->listen_stats.accepted, 1, __ATOMIC_RELAXED );
+      //fprintf(stdout, "accepting new connection\n"); fflush(stdout); 
+
+      /* allocate an endpoint and add to manager */
+      hms_endpoint *endpoint = _hms_endpoint_accepted( manager, new_fd );
+      if( endpoint == NULL ) { continue; }
+
+      /* an event loop watches it until a message is complete */
+      if( manager->num_loops > 0 ) {
+	hms_loop *loop = &manager->loops[ manager->next_loop++ % manager->num_loops ];
+	if( _hms_loop_add( loop, endpoint ) != 0 ) { hms_endpoint_destroy( endpoint ); }
+	continue;
+      }
+
+      /* spawn a thread to handle the new conn, unless too many wait */
+      if( tpool_add_work(manager->pool, (void *) _hms_handle_endpoint, (void *) endpoint) == -1 ) {
+	_hms_shed_endpoint( manager, endpoint );
+      }
+      //fprintf(stdout, "spawned handler thread success\n"); fflush(stdout);
+
+    } /* end while() */
+
+  } /* end while() */
+
+  return;
+
+} /* end _hms_listen() */
+
+/* A socket listening on the server port. With reuseport every shard
+   opens its own and the kernel spreads connections over them */
+static int _hms_open_listener( hms *manager, int reuseport ) {
+
+  int sockfd, yes = 1;
+  struct sockaddr_in my_addr;
+
+  /* open the socket */
+  if( (sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+    perror("socket"); return -1;
+  }
+  /* set socket options */
+  if(setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int) ) == -1) {
+    perror("setsockopt"); close(sockfd); return -1;
+  }
+#ifdef SO_REUSEPORT
+  if(reuseport && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int) ) == -1) {
+    perror("setsockopt"); close(sockfd); return -1;
+  }
+#else
+  if(reuseport) { close(sockfd); return -1; }
+#endif
+  /* accepted sockets inherit these, so they are set once here */
+  if(manager->config.tcp_nodelay &&
+     setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(int) ) == -1) {
+    perror("setsockopt"); close(sockfd); return -1;
+  }
+  if(manager->config.sndbuf > 0 &&
+     setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &manager->config.sndbuf, sizeof(int) ) == -1) {
+    perror("setsockopt"); close(sockfd); return -1;
+  }
+  if(manager->config.rcvbuf > 0 &&
+     setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &manager->config.rcvbuf, sizeof(int) ) == -1) {
+    perror("setsockopt"); close(sockfd); return -1;
+  }
+  my_addr.sin_family = AF_INET;
+  my_addr.sin_port = htons(manager->server_port);
+  my_addr.sin_addr.s_addr = INADDR_ANY;
+  memset(my_addr.sin_zero, '\0', sizeof(my_addr.sin_zero));
+
+  /* bind the socket */
+  if( bind(sockfd, (struct sockaddr *) &my_addr, sizeof(my_addr) ) == -1) {
+    perror("bind"); close(sockfd); return -1;
+  }
+
+  /* listen on the socket */
+  if(listen(sockfd, manager->config.backlog) == -1){
+    perror("listen"); close(sockfd); return -1;
+  }
+
+  return sockfd;
+
+} /* end _hms_open_listener() */
+
+/* An endpoint for a new connection, set up from the manager's config;
+   its socket options came from the listener. NULL if every slot of the
+   slab is in use: the connection is turned away like a shed one */
+static hms_endpoint* _hms_endpoint_accepted( hms *manager, int fd ) {
+
+  hms_endpoint *endpoint = _hms_conn_alloc( manager->conns );
+  if( endpoint == NULL ) {
+    __atomic_add_fetch( &manager->shed_stats.connections, 1, __ATOMIC_RELAXED );
+    _hms_send_busy( manager, fd );
+    close( fd );
+    return NULL;
+  }
+  _hms_endpoint_setup( endpoint, fd, manager->ops );
+  hms_endpoint_set_hdr_size( endpoint, manager->config.rbuf_size, manager->config.max_hdr_size );
+  hms_endpoint_set_body_size( endpoint, manager->config.max_body_size );
+  endpoint->fast_replies = manager->config.fast_replies;
+  endpoint->verbs = &manager->verbs;
+
+  return endpoint;
+
+} /* end _hms_endpoint_accepted() */
+
+/**
+ * Called when a listener wakes up, before it is drained: notes how many
+ * connections were waiting and whether the accept queue was full. A
+ * full queue means SYNs are being dropped.
+ **/
+static void _hms_listen_sample( hms *manager, int fd ) {
+
+  __atomic_add_fetch( &manager->listen_stats.wakeups, 1, __ATOMIC_RELAXED );
+
+#if defined(__linux__) && defined(TCP_INFO)
+  /* on a listener: unacked is the queue length, sacked its limit */
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+  if( getsockopt( fd, IPPROTO_TCP, TCP_INFO, &info, &len ) != 0 ) { return; }
+
+  int queued = info.tcpi_unacked, peak;
+  peak = __atomic_load_n( &manager->listen_stats.queue_peak, __ATOMIC_RELAXED );
+  while( queued > peak &&
+	 !__atomic_compare_exchange_n( &manager->listen_stats.queue_peak, &peak, queued,
+				       HMS_FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) );
+  if( info.tcpi_sacked > 0 && queued >= (int) info.tcpi_sacked ) {
+    __atomic_add_fetch( &manager->listen_stats.queue_full, 1, __ATOMIC_RELAXED );
+  }
+#endif
+
+} /* end _hms_listen_sample() */
+
+/* The host's ListenOverflows and ListenDrops counters; -1 if unknown */
+static int _hms_listen_drops( long *overflows, long *drops ) {
+
+  char names[4096], values[4096];
+  int found = 0;
+  FILE *fp = fopen( "/proc/net/netstat", "r" );
+  if( !fp ) { return -1; }
+
+  /* pairs of lines: "TcpExt: names..." then "TcpExt: values..." */
+  while( fgets( names, sizeof(names), fp ) && fgets( values, sizeof(values), fp ) ) {
+    if( strncmp( names, "TcpExt:", 7 ) != 0 ) { continue; }
+    char *nsave, *vsave;
+    char *name = strtok_r( names, " \n", &nsave );
+    char *value = strtok_r( values, " \n", &vsave );
+    while( name && value ) {
+      if( strcmp( name, "ListenOverflows" ) == 0 ) { *overflows = atol( value ); found++; }
+      else if( strcmp( name, "ListenDrops" ) == 0 ) { *drops = atol( value ); found++; }
+      name = strtok_r( NULL, " \n", &nsave );
+      value = strtok_r( NULL, " \n", &vsave );
+    }
+    break;
+  }
+  fclose( fp );
+
+  return ( found == 2 ) ? 0 : -1;
+
+} /* end _hms_listen_drops() */
+
+static void _hms_handle_endpoint( hms_endpoint *endpoint ) {
+
+  pthread_mutex_lock( &endpoint->meta_lock );
+
+  int handler_status = 0;
+
+  while( HMS_TRUE ) {
+
+    /* PING, INFO and BYE without parsing a message */
+    if( endpoint->fast_replies ) {
+      int fast_status = _hms_endpoint_fast_reply( endpoint );
+      if( fast_status < 0 ) { break; }
+      if( fast_status > 0 ) { continue; }
+    }
+
+    /* read hms message; with a body callback the body stays on the socket */
+    hms_msg *msg = NULL;
+    int parse_status = (endpoint->ops.hms_body || endpoint->ops.hms_sink ||
+			(endpoint->verbs && endpoint->verbs->streams)) ?
+      _hms_endpoint_recv_header( endpoint, &msg ) :
+      hms_endpoint_recv_msg( endpoint, &msg );
+    if(parse_status != 0) { /*fprintf(stderr, "parser failed\n");*/ break;}
+
+    handler_status = _hms_endpoint_dispatch( endpoint, msg );
+
+    /* free memory used by message */
+    hms_msg_destroy( msg ); msg = NULL;
+
+    if(handler_status != 0 ) break;
+    
+  } /* end while() */
+
+  pthread_mutex_unlock( &endpoint->meta_lock);
+
+  /* close the endpoint */
+  hms_endpoint_destroy( endpoint );
+
+  return;
+
+} /* end _hms_handle_endpoint() */
+
+/**
+ * Validate then handle one message; non-zero closes the connection.
+ * A registered verb goes straight to its own ops; any other message is
+ * offered to the endpoint's ops, then to the default handler.
+ **/
+static int _hms_endpoint_dispatch( hms_endpoint *endpoint, hms_msg *msg ) {
+
+  int handler_status = 0;
+  const char *verb = NULL; int verb_len = 0;
+  hms_verb *route = NULL;
+
+  if( endpoint->verbs && hms_msg_peek_verb( msg, &verb, &verb_len ) == 0 ) {
+    route = _hms_verb_find( endpoint->verbs, verb, verb_len );
+  }
+
+  if( route ) {
+    /* skip over the body of an invalid message */
+    if( route->ops.hms_validate && route->ops.hms_validate(endpoint,msg) != 0 ) {
+      return ( _hms_endpoint_recv_body( endpoint, msg ) == 0 ) ? 0 : -1;
+    }
+    handler_status = _hms_endpoint_deliver_body( endpoint, &route->ops, msg );
+    if( handler_status == 0 ) {
+      handler_status = route->ops.hms_handle(endpoint,msg);
+    }
+    return handler_status;
+  }
+
+  if( !endpoint->ops.hms_validate || endpoint->ops.hms_validate(endpoint,msg) == 0 ) {
+    if( endpoint->ops.hms_accepts(endpoint,msg) == 0 ) {
+      handler_status = _hms_endpoint_deliver_body( endpoint, &endpoint->ops, msg );
+      if( handler_status == 0 ) {
+	handler_status = endpoint->ops.hms_handle(endpoint,msg);
+      }
+    }
+    /* call default handler */
+    else if( _hms_endpoint_recv_body( endpoint, msg ) == 0 ) {
+      handler_status = _hms_default_handle( endpoint, msg );
+    }
+    else { handler_status = -1; }
+  }
+  /* skip over the body of an invalid message */
+  else if( _hms_endpoint_recv_body( endpoint, msg ) != 0 ) {
+    handler_status = -1;
+  }
+
+  return handler_status;
+
+} /* end _hms_endpoint_dispatch() */
+
+/* Verb routing */
+/* ----------------------------------------------------- */
+
+/* FNV-1a over the case-folded verb */
+static unsigned _hms_verb_hash( const char *verb, int len ) {
+
+  unsigned hash = 2166136261u;
+  int i;
+  for( i = 0; i < len; i++ ) {
+    unsigned char c = (unsigned char) verb[i];
+    if( c >= 'A' && c <= 'Z' ) { c += 'a' - 'A'; }
+    hash = (hash ^ c) * 16777619u;
+  }
+
+  return hash;
+
+} /* end _hms_verb_hash() */
+
+/**
+ * Open addressing with linear probing, half full at most. Slots are
+ * filled in before they are marked used and never change after, so a
+ * lookup needs no lock and allocates nothing.
+ **/
+static hms_verb* _hms_verb_find( hms_verb_table *table, const char *verb, int len ) {
+
+  if( len <= 0 || len > HERMES_MAX_VERB_LEN ) { return NULL; }
+  if( __atomic_load_n( &table->count, __ATOMIC_ACQUIRE ) == 0 ) { return NULL; }
+
+  unsigned hash = _hms_verb_hash( verb, len );
+  unsigned mask = HMS_VERB_SLOTS - 1, i;
+
+  for( i = hash & mask; __atomic_load_n( &table->slots[i].used, __ATOMIC_ACQUIRE ); i = (i + 1) & mask ) {
+    hms_verb *slot = &table->slots[i];
+    if( slot->hash == hash && slot->len == len && strncasecmp( slot->name, verb, len ) == 0 ) {
+      return slot;
+    }
+  }
+
+  return NULL;
+
+} /* end _hms_verb_find() */
+
+/* Callers serialize adds; -1 if the verb is taken, too long or the table full */
+static int _hms_verb_add( hms_verb_table *table, const char *verb, hms_ops *ops ) {
+
+  int len = strlen( verb );
+  if( len == 0 || len > HERMES_MAX_VERB_LEN || strpbrk( verb, " \t\r\n" ) ) { return -1; }
+  if( table->count >= HERMES_MAX_VERBS || _hms_verb_find( table, verb, len ) ) { return -1; }
+
+  unsigned hash = _hms_verb_hash( verb, len );
+  unsigned mask = HMS_VERB_SLOTS - 1, i;
+  for( i = hash & mask; table->slots[i].used; i = (i + 1) & mask );
+
+  hms_verb *slot = &table->slots[i];
+  memcpy( slot->name, verb, len + 1 );
+  slot->len = len;
+  slot->hash = hash;
+  slot->ops = *ops;
+  if( ops->hms_body || ops->hms_sink ) { table->streams = HMS_TRUE; }
+  __atomic_store_n( &slot->used, HMS_TRUE, __ATOMIC_RELEASE );
+  __atomic_store_n( &table->count, table->count + 1, __ATOMIC_RELEASE );
+
+  return 0;
+
+} /* end _hms_verb_add() */
+
+static void _hms_builtin_verbs_init( void ) {
+
+  hms_ops ops;
+  memset( &ops, 0, sizeof(ops) );
+
+  ops.hms_handle = _hms_default_ping; _hms_verb_add( &_hms_builtin_verbs, "PING", &ops );
+  ops.hms_handle = _hms_default_info; _hms_verb_add( &_hms_builtin_verbs, "INFO", &ops );
+  ops.hms_handle = _hms_default_bye;  _hms_verb_add( &_hms_builtin_verbs, "BYE", &ops );
+
+} /* end _hms_builtin_verbs_init() */
+
+/* Event loops */
+/* ----------------------------------------------------- */
+
+/**
+ * Each loop owns an epoll set of non-blocking sockets, armed one-shot:
+ * a ready socket is read and parsed by the loop, and only a complete
+ * message is handed to a pool worker. The worker handles it and any
+ * messages already buffered behind it, then re-arms the socket. So at
+ * most one thread touches an endpoint at a time, and idle connections
+ * cost no thread and no receive buffer.
+ *
+ * A shard is a loop with its own SO_REUSEPORT listener and pool, all
+ * pinned to one CPU: its connections are accepted, parsed, handled and
+ * answered there.
+ *
+ * With config.io_uring a loop drives a ring instead, if the kernel has
+ * one: accepts and receives are queued, and each wait submits all of
+ * them and reaps every completion in one system call. Receives land in
+ * buffers the ring provides, so an idle connection still holds no
+ * buffer. Workers never touch the ring; they queue an endpoint for its
+ * next receive and wake the loop through the eventfd.
+ *
+ * With config.staged_replies the loops are the I/O stage and the pool
+ * the handler stage of a pipeline: workers only parse what the loop
+ * already buffered, and replies are appended to the endpoint and handed
+ * back to the loop's send queue, so a slow reader holds up its loop's
+ * write and not a worker.
+ **/
+static int _hms_loops_start( hms *manager ) {
+
+#ifdef HMS_HAVE_EPOLL
+  int i, num_loops;
+  struct epoll_event ev;
+
+  num_loops = ( manager->sharded ) ? manager->config.shards : manager->config.event_loops;
+  manager->loops = calloc( num_loops, sizeof(hms_loop) );
+  if( manager->loops == NULL ) { return -1; }
+
+  for( i=0; i < num_loops; i++ ) {
+    hms_loop *loop = &manager->loops[i];
+    loop->manager = manager;
+    loop->listen_fd = -1;
+    loop->cpu = -1;
+    loop->pool = manager->pool;
+    pthread_mutex_init( &loop->lock, NULL );
+    HMS_INIT_LIST_HEAD( &loop->endpoints );
+
+    loop->epoll_fd = loop->wake_fd = -1;
+    loop->ring = NULL;
+    loop->arm = NULL;
+    loop->staged = manager->config.staged_replies;
+    loop->out_fd = -1;
+    loop->sendq = NULL;
+    loop->send_conns = loop->send_bytes = 0;
+    if( manager->config.io_uring ) {
+      loop->ring = hms_uring_create( HMS_URING_ENTRIES, HMS_URING_BUFS, HMS_URING_BUF_SIZE );
+    }
+
+    if( loop->ring ) {
+      /* the ring waits on the wake fd with a read, which marks it too */
+      loop->wake_fd = eventfd( 0, EFD_CLOEXEC );
+      if( loop->wake_fd == -1 ||
+	  hms_uring_read( loop->ring, loop->wake_fd, &loop->wake_count, sizeof(loop->wake_count), NULL ) != 0 ) {
+	_hms_loop_fail( loop );
+	return -1;
+      }
+    } else {
+      loop->epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+      if( loop->epoll_fd == -1 ) { _hms_loop_fail( loop ); return -1; }
+      loop->wake_fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+      if( loop->wake_fd == -1 ) { _hms_loop_fail( loop ); return -1; }
+
+      /* the wake fd is the only one without an endpoint */
+      memset( &ev, 0, sizeof(ev) );
+      ev.events = EPOLLIN; ev.data.ptr = NULL;
+      if( epoll_ctl( loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev ) == -1 ) {
+	_hms_loop_fail( loop );
+	return -1;
+      }
+
+      /* sockets waiting to take more replies have a set of their own,
+	 marked in this one by its descriptor */
+      if( loop->staged ) {
+	loop->out_fd = epoll_create1( EPOLL_CLOEXEC );
+	ev.events = EPOLLIN; ev.data.ptr = &loop->out_fd;
+	if( loop->out_fd == -1 ||
+	    epoll_ctl( loop->epoll_fd, EPOLL_CTL_ADD, loop->out_fd, &ev ) == -1 ) {
+	  _hms_loop_fail( loop );
+	  return -1;
+	}
+      }
+    }
+
+    /* a shard's listener is marked with the loop itself */
+    if( manager->sharded ) {
+      int added = -1, j;
+      loop->listen_fd = _hms_open_listener( manager, HMS_TRUE );
+      if( loop->listen_fd >= 0 && loop->ring ) {
+	/* a few accepts queued at once take a burst in one wait */
+	for( j=0, added=0; j < HMS_URING_ACCEPTS && added == 0; j++ ) {
+	  added = hms_uring_accept( loop->ring, loop->listen_fd, loop );
+	}
+      } else if( loop->listen_fd >= 0 && fcntl( loop->listen_fd, F_SETFL, O_NONBLOCK ) == 0 ) {
+	ev.events = EPOLLIN; ev.data.ptr = loop;
+	added = epoll_ctl( loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_fd, &ev );
+      }
+      if( added != 0 ) { _hms_loop_fail( loop ); return -1; }
+      tpool_init( &loop->pool, manager->num_threads, manager->config.max_pending_msgs, HMS_TRUE );
+      loop->cpu = _hms_shard_cpu( i );
+    }
+
+    if( pthread_create( &loop->thread, NULL, (loop->ring) ? _hms_uring_run : _hms_loop_run, loop ) != 0 ) {
+      if( loop->listen_fd >= 0 ) { tpool_destroy( loop->pool, HMS_FALSE ); }
+      _hms_loop_fail( loop );
+      return -1;
+    }
+
+    /* keep the shard on its CPU; it still runs if pinning fails */
+    if( loop->cpu >= 0 ) {
+      cpu_set_t set;
+      CPU_ZERO( &set ); CPU_SET( loop->cpu, &set );
+      pthread_setaffinity_np( loop->thread, sizeof(set), &set );
+      tpool_pin( loop->pool, loop->cpu );
+    }
+    manager->num_loops++;
+  }
+
+  return 0;
+#else
+  return -1;
+#endif
+
+} /* end _hms_loops_start() */
+
+static void _hms_loops_stop( hms *manager ) {
+
+  int i;
+  uint64_t one = 1;
+
+  for( i=0; i < manager->num_loops; i++ ) {
+    if( write( manager->loops[i].wake_fd, &one, sizeof(one) ) != sizeof(one) ) {
+      perror("write");
+    }
+    pthread_join( manager->loops[i].thread, NULL );
+  }
+
+} /* end _hms_loops_stop() */
+
+/* After the pools are gone every endpoint left is idle or its work was dropped */
+static void _hms_loops_free( hms *manager, int force ) {
+
+  int i;
+
+  /* shard pools */
+  for( i=0; i < manager->num_loops; i++ ) {
+    if( manager->loops[i].pool != manager->pool ) {
+      tpool_destroy( manager->loops[i].pool, force );
+    }
+  }
+
+  for( i=0; i < manager->num_loops; i++ ) {
+    hms_loop *loop = &manager->loops[i];
+    hms_endpoint *endpoint, *next;
+    hms_list_for_each_entry_safe( endpoint, next, &loop->endpoints, lh ) {
+      hms_list_del( &endpoint->lh );
+      hms_endpoint_destroy( endpoint );
+    }
+    _hms_loop_deinit( loop );
+    pthread_mutex_destroy( &loop->lock );
+  }
+  if( manager->loops ) { free( manager->loops ); manager->loops = NULL; }
+  manager->num_loops = 0;
+
+} /* end _hms_loops_free() */
+
+/* Registers a new connection with a loop */
+static int _hms_loop_add( hms_loop *loop, hms_endpoint *endpoint ) {
+
+#ifdef HMS_HAVE_EPOLL
+  struct epoll_event ev;
+
+  /* accepted with SOCK_NONBLOCK by every caller */
+  endpoint->parser = hms_parser_create( endpoint->max_hdr_size );
+  hms_parser_set_max_body( endpoint->parser, endpoint->rbuf.max_body );
+  if( loop->manager->config.pipeline_depth > 1 ) {
+    endpoint->reqs = calloc( loop->manager->config.pipeline_depth, sizeof(hms_request) );
+    if( endpoint->reqs == NULL ) { return -1; }
+    endpoint->req_depth = loop->manager->config.pipeline_depth;
+  }
+
+  endpoint->loop = loop;
+
+  pthread_mutex_lock( &loop->lock );
+  hms_list_add_tail( &endpoint->lh, &loop->endpoints );
+  pthread_mutex_unlock( &loop->lock );
+
+  /* the loop queues the first receive; closing undoes the rest */
+  memset( &ev, 0, sizeof(ev) );
+  ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT; ev.data.ptr = endpoint;
+  if( ( loop->ring ) ? _hms_uring_arm( endpoint ) != 0 :
+      epoll_ctl( loop->epoll_fd, EPOLL_CTL_ADD, endpoint->socket, &ev ) == -1 ) {
+    pthread_mutex_lock( &loop->lock );
+    hms_list_del( &endpoint->lh );
+    pthread_mutex_unlock( &loop->lock );
+    endpoint->loop = NULL;
+    return -1;
+  }
+
+  return 0;
+#else
+  return -1;
+#endif
+
+} /* end _hms_loop_add() */
+
+static void* _hms_loop_run( void *arg ) {
+
+#ifdef HMS_HAVE_EPOLL
+  hms_loop *loop = (hms_loop *) arg;
+  struct epoll_event events[HMS_LOOP_EVENTS];
+  uint64_t count;
+  int i, n;
+
+  _hms_loop_self = loop;
+
+  while( HMS_TRUE ) {
+
+    n = epoll_wait( loop->epoll_fd, events, HMS_LOOP_EVENTS, -1 );
+    if( n == -1 ) {
+      if( errno == EINTR ) continue;
+      perror("epoll_wait"); break;
+    }
+
+    for( i=0; i < n; i++ ) {
+      /* woken up to stop, or to write replies */
+      if( events[i].data.ptr == NULL ) {
+	if( loop->manager->shutdown ) { return NULL; }
+	if( read( loop->wake_fd, &count, sizeof(count) ) == -1 && errno != EAGAIN ) { perror("read"); }
+	_hms_loop_sendq( loop );
+	continue;
+      }
+      if( events[i].data.ptr == loop ) { _hms_loop_accept( loop ); continue; }
+      if( events[i].data.ptr == &loop->out_fd ) { _hms_loop_writable( loop ); continue; }
+      _hms_loop_ready( (hms_endpoint *) events[i].data.ptr );
+    }
+
+  } /* end while() */
+#endif
+
+  return NULL;
+
+} /* end _hms_loop_run() */
+
+/* Takes every pending connection of a shard's listener; they stay here */
+static void _hms_loop_accept( hms_loop *loop ) {
+
+#ifdef HMS_HAVE_EPOLL
+  int new_fd;
+
+  _hms_listen_sample( loop->manager, loop->listen_fd );
+
+  while( !loop->manager->shutdown ) {
+
+    new_fd = accept4( loop->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+    if( new_fd == -1 ) {
+      if( errno == EINTR || errno == ECONNABORTED ) continue;
+      if( errno != EAGAIN && errno != EWOULDBLOCK ) { perror("accept"); }
+      return;
+    }
+    __atomic_add_fetch( &loop->manager->listen_stats.accepted, 1, __ATOMIC_RELAXED );
+
+    hms_endpoint *endpoint = _hms_endpoint_accepted( loop->manager, new_fd );
+    if( endpoint && _hms_loop_add( loop, endpoint ) != 0 ) { hms_endpoint_destroy( endpoint ); }
+
+  } /* end while() */
+#endif
+
+} /* end _hms_loop_accept() */
+
+/* The n-th CPU this process may run on, wrapping around; -1 if unknown */
+static int _hms_shard_cpu( int shard ) {
+
+#ifdef HMS_HAVE_EPOLL
+  cpu_set_t set;
+  int cpu, seen = 0;
+
+  if( sched_getaffinity( 0, sizeof(set), &set ) != 0 || CPU_COUNT( &set ) == 0 ) { return -1; }
+  shard %= CPU_COUNT( &set );
+  for( cpu=0; cpu < CPU_SETSIZE; cpu++ ) {
+    if( CPU_ISSET( cpu, &set ) && seen++ == shard ) { return cpu; }
+  }
+#endif
+
+  return -1;
+
+} /* end _hms_shard_cpu() */
+
+/* Reads what arrived; a complete message goes to a worker, otherwise the
+   socket is re-armed (or closed) right here */
+static void _hms_loop_ready( hms_endpoint *endpoint ) {
+
+#ifdef HMS_HAVE_EPOLL
+  hms_msg *msg = NULL;
+  struct epoll_event ev;
+
+  while( HMS_TRUE ) {
+
+    /* a ring loop reads for us, and so does any loop for a staged
+       worker: only what is buffered is left to parse */
+    int drain = ( endpoint->loop->ring || ( endpoint->loop->staged && _hms_loop_self != endpoint->loop ) );
+
+    /* bare PING, INFO and BYE at a message boundary never reach the
+       parser; read first, so none is parsed in the middle of a pump.
+       Parallel requests keep them in order with the rest */
+    if( endpoint->fast_replies && !endpoint->reqs ) {
+      if( !drain && endpoint->rbuf.start == endpoint->rbuf.end ) {
+	int n = hms_rbuf_read( endpoint->socket, &endpoint->rbuf );
+	if( n < 0 ) { _hms_loop_close( endpoint ); return; }
+	if( n == 0 ) { break; }
+      }
+      int fast = _hms_loop_fast_reply( endpoint );
+      if( fast < 0 ) { _hms_loop_close( endpoint ); return; }
+      if( fast > 0 ) { continue; }
+    }
+
+    int status = ( drain ) ?
+      hms_parser_drain_rbuf( &endpoint->rbuf, endpoint->parser, &msg ) :
+      hms_parser_pump_rbuf( endpoint->socket, &endpoint->rbuf, endpoint->parser, &msg );
+
+    if( status < 0 ) { _hms_loop_close( endpoint ); return; }
+    if( status == 0 ) { break; }
+
+    /* a message turned away is answered here, then reading goes on */
+    if( _hms_loop_submit( endpoint, msg ) <= 0 ) { return; }
+
+  } /* end while() */
+
+  /* wait for more */
+  hms_rbuf_trim( &endpoint->rbuf );
+  if( endpoint->loop->ring ) {
+    if( _hms_uring_arm( endpoint ) != 0 ) { _hms_loop_close( endpoint ); }
+    return;
+  }
+  memset( &ev, 0, sizeof(ev) );
+  ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT; ev.data.ptr = endpoint;
+  if( epoll_ctl( endpoint->loop->epoll_fd, EPOLL_CTL_MOD, endpoint->socket, &ev ) == -1 ) {
+    _hms_loop_close( endpoint );
+  }
+#endif
+
+} /* end _hms_loop_ready() */
+
+/* Queues a complete message for a worker. 0 once queued, 1 if the
+   workers were backed up and it was turned away (or, with parallel
+   requests, if reading goes on), -1 if the connection was closed (or
+   is left for its loop to free while shutting down) */
+static int _hms_loop_submit( hms_endpoint *endpoint, hms_msg *msg ) {
+
+  hms_loop *loop = endpoint->loop;
+
+  if( endpoint->reqs ) { return _hms_request_submit( endpoint, msg ); }
+
+  endpoint->msg = msg;
+  if( tpool_add_work( loop->pool, (void *) _hms_loop_work, (void *) endpoint ) != -1 ) { return 0; }
+  endpoint->msg = NULL;
+
+  /* the pool refuses all work while shutting down */
+  if( loop->manager->shutdown ) { hms_msg_destroy( msg ); return -1; }
+
+  if( _hms_shed_msg( loop->manager, endpoint, msg ) != 0 ) { _hms_loop_close( endpoint ); return -1; }
+
+  return 1;
+
+} /* end _hms_loop_submit() */
+
+/* Runs in a pool worker with a complete message */
+static void _hms_loop_work( hms_endpoint *endpoint ) {
+
+  hms_msg *msg = endpoint->msg;
+  endpoint->msg = NULL;
+
+  int handler_status = _hms_endpoint_dispatch( endpoint, msg );
+  hms_msg_destroy( msg ); msg = NULL;
+
+  if( handler_status != 0 ) { _hms_loop_close( endpoint ); return; }
+
+  /* next message, if already here, or back to the loop */
+  _hms_loop_ready( endpoint );
+
+} /* end _hms_loop_work() */
+
+/* Closes a connection: right away, or with staged replies once its loop
+   has written what was queued before */
+static void _hms_loop_close( hms_endpoint *endpoint ) {
+
+  int post;
+
+  if( !endpoint->loop->staged ) { _hms_loop_destroy( endpoint ); return; }
+
+  pthread_mutex_lock( &endpoint->meta_lock );
+  endpoint->closing = HMS_TRUE;
+  post = !endpoint->posted;
+  endpoint->posted = HMS_TRUE;
+  pthread_mutex_unlock( &endpoint->meta_lock );
+
+  /* already posted: closed by the loop when that write is done */
+  if( post ) { _hms_loop_post( endpoint ); }
+
+} /* end _hms_loop_close() */
+
+static void _hms_loop_destroy( hms_endpoint *endpoint ) {
+
+  hms_loop *loop = endpoint->loop;
+
+  pthread_mutex_lock( &loop->lock );
+  hms_list_del( &endpoint->lh );
+  pthread_mutex_unlock( &loop->lock );
+
+  /* closing the socket also takes it out of the epoll sets */
+  hms_endpoint_destroy( endpoint );
+
+} /* end _hms_loop_destroy() */
+
+/* Staged replies */
+/* ----------------------------------------------------- */
+
+/**
+ * A handler's reply is appended to the endpoint's out buffer and the
+ * endpoint posted to its loop once, until the loop has written all of
+ * it. The loop swaps out with its own sending buffer and writes that
+ * without holding the lock, so handlers never wait for a socket and
+ * the loop never waits for a handler. A socket that stops taking bytes
+ * is watched for POLLOUT (out_fd, or a ring poll) and picked up again
+ * from there. Replies leave in the order they were queued.
+ **/
+static int _hms_loop_queue( hms_endpoint *endpoint, struct iovec *iov, int iovcnt ) {
+
+  int post = HMS_FALSE;
+  int ret = _hms_loop_append( endpoint, iov, iovcnt, &post );
+
+  if( post ) { _hms_loop_post( endpoint ); }
+
+  return ret;
+
+} /* end _hms_loop_queue() */
+
+/* Appends to the out buffer; *post is set if the caller must post the
+   endpoint. Nothing is taken for a connection that is closing */
+static int _hms_loop_append( hms_endpoint *endpoint, struct iovec *iov, int iovcnt, int *post ) {
+
+  pthread_mutex_lock( &endpoint->meta_lock );
+  int ret = _hms_loop_append_locked( endpoint, iov, iovcnt, post );
+  pthread_mutex_unlock( &endpoint->meta_lock );
+
+  return ret;
+
+} /* end _hms_loop_append() */
+
+/* The same, with meta_lock held */
+static int _hms_loop_append_locked( hms_endpoint *endpoint, struct iovec *iov, int iovcnt, int *post ) {
+
+  int i, len = 0;
+
+  for( i=0; i < iovcnt; i++ ) { len += iov[i].iov_len; }
+  if( len == 0 ) { return 0; }
+
+  if( endpoint->closing || _hms_out_admit( endpoint, len ) != 0 ||
+      __buf_append( &endpoint->out, &endpoint->out_len, &endpoint->out_cap, iov, iovcnt ) != 0 ) {
+    return -1;
+  }
+  *post = !endpoint->posted;
+  endpoint->posted = HMS_TRUE;
+  __atomic_add_fetch( &endpoint->unsent, len, __ATOMIC_RELAXED );
+  __atomic_add_fetch( &endpoint->loop->send_bytes, len, __ATOMIC_RELAXED );
+
+  return 0;
+
+} /* end _hms_loop_append_locked() */
+
+/* With meta_lock held: 0 if len more bytes fit in the outbound queue.
+   Past config.max_outbound the slow-consumer policy applies */
+static int _hms_out_admit( hms_endpoint *endpoint, int len ) {
+
+  hms *manager = endpoint->loop->manager;
+  long unsent = __atomic_load_n( &endpoint->unsent, __ATOMIC_RELAXED );
+
+  if( manager->config.max_outbound <= 0 || unsent + len <= manager->config.max_outbound ) { return 0; }
+
+  /* the loop drops what is queued, the reader sees the connection closed */
+  if( manager->config.slow_consumer == HMS_SLOW_CLOSE ) {
+    if( endpoint->close_asked ) { return -1; }
+    endpoint->close_asked = HMS_TRUE;
+    shutdown( endpoint->socket, SHUT_RDWR );
+  }
+  __atomic_add_fetch( &manager->shed_stats.slow, 1, __ATOMIC_RELAXED );
+
+  return -1;
+
+} /* end _hms_out_admit() */
+
+/* Hands a newly posted endpoint to its loop: written right away on the
+   loop's own thread, otherwise through the send queue */
+static void _hms_loop_post( hms_endpoint *endpoint ) {
+
+  hms_loop *loop = endpoint->loop;
+  uint64_t one = 1;
+  int was_empty;
+
+  __atomic_add_fetch( &loop->send_conns, 1, __ATOMIC_RELAXED );
+
+  if( _hms_loop_self == loop ) { _hms_loop_flush( endpoint ); return; }
+
+  pthread_mutex_lock( &loop->lock );
+  was_empty = ( loop->sendq == NULL );
+  endpoint->send_next = loop->sendq;
+  loop->sendq = endpoint;
+  pthread_mutex_unlock( &loop->lock );
+
+  if( was_empty && write( loop->wake_fd, &one, sizeof(one) ) != sizeof(one) ) {
+    perror("write");
+  }
+
+} /* end _hms_loop_post() */
+
+/* Writes for every endpoint posted since the last wake-up */
+static void _hms_loop_sendq( hms_loop *loop ) {
+
+  hms_endpoint *endpoint, *next;
+
+  pthread_mutex_lock( &loop->lock );
+  endpoint = loop->sendq;
+  loop->sendq = NULL;
+  pthread_mutex_unlock( &loop->lock );
+
+  for( ; endpoint; endpoint = next ) {
+    next = endpoint->send_next;
+    endpoint->send_next = NULL;
+    _hms_loop_flush( endpoint );
+  }
+
+} /* end _hms_loop_sendq() */
+
+/**
+ * Runs on the loop's thread only. Writes until the socket is full or
+ * nothing is queued; then the endpoint is no longer posted, or closed
+ * if that was asked for. A failed write drops the replies and shuts the
+ * socket down, so the endpoint's owner sees it closed on its next read.
+ **/
+static void _hms_loop_flush( hms_endpoint *endpoint ) {
+
+  hms_loop *loop = endpoint->loop;
+  int n, closing = HMS_FALSE;
+
+  while( HMS_TRUE ) {
+
+    if( endpoint->sent == endpoint->sending_len ) {
+      char *buf = endpoint->sending;
+      int cap = endpoint->sending_cap;
+
+      /* take what handlers queued since the last swap */
+      pthread_mutex_lock( &endpoint->meta_lock );
+      if( endpoint->out_len == 0 ) {
+	/* parallel requests still running post it again when done */
+	closing = endpoint->closing && endpoint->req_head == endpoint->req_tail;
+	if( !closing ) { endpoint->posted = HMS_FALSE; }
+	pthread_mutex_unlock( &endpoint->meta_lock );
+	break;
+      }
+      endpoint->sending = endpoint->out; endpoint->sending_cap = endpoint->out_cap;
+      endpoint->sending_len = endpoint->out_len; endpoint->sent = 0;
+      endpoint->out = buf; endpoint->out_cap = cap; endpoint->out_len = 0;
+      pthread_mutex_unlock( &endpoint->meta_lock );
+    }
+
+    n = send( endpoint->socket, endpoint->sending + endpoint->sent,
+	      endpoint->sending_len - endpoint->sent, MSG_DONTWAIT | MSG_NOSIGNAL );
+    if( n == -1 && errno == EINTR ) { continue; }
+    if( n == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK ) &&
+	_hms_loop_wait_writable( endpoint ) == 0 ) {
+      return;
+    }
+    if( n <= 0 ) {
+      shutdown( endpoint->socket, SHUT_RDWR );
+      n = endpoint->sending_len - endpoint->sent;
+    }
+    endpoint->sent += n;
+    __atomic_sub_fetch( &loop->send_bytes, n, __ATOMIC_RELAXED );
+    __atomic_sub_fetch( &endpoint->unsent, n, __ATOMIC_RELAXED );
+
+  } /* end while() */
+
+  endpoint->sent = endpoint->sending_len = 0;
+  __atomic_sub_fetch( &loop->send_conns, 1, __ATOMIC_RELAXED );
+  if( closing ) { _hms_loop_destroy( endpoint ); }
+
+} /* end _hms_loop_flush() */
+
+/* Watches a full socket until it takes more; 0 if watched */
+static int _hms_loop_wait_writable( hms_endpoint *endpoint ) {
+
+#ifdef HMS_HAVE_EPOLL
+  hms_loop *loop = endpoint->loop;
+  struct epoll_event ev;
+
+  if( loop->ring ) {
+    if( hms_uring_poll( loop->ring, endpoint->socket, POLLOUT, HMS_URING_OUT( endpoint ) ) != 0 ) { return -1; }
+    endpoint->out_wait = HMS_TRUE;
+    return 0;
+  }
+
+  memset( &ev, 0, sizeof(ev) );
+  ev.events = EPOLLOUT | EPOLLONESHOT; ev.data.ptr = endpoint;
+  if( epoll_ctl( loop->out_fd, EPOLL_CTL_MOD, endpoint->socket, &ev ) == -1 &&
+      ( errno != ENOENT || epoll_ctl( loop->out_fd, EPOLL_CTL_ADD, endpoint->socket, &ev ) == -1 ) ) {
+    return -1;
+  }
+  endpoint->out_wait = HMS_TRUE;
+  return 0;
+#else
+  return -1;
+#endif
+
+} /* end _hms_loop_wait_writable() */
+
+/* The out set is ready: write for every socket in it that takes more */
+static void _hms_loop_writable( hms_loop *loop ) {
+
+#ifdef HMS_HAVE_EPOLL
+  struct epoll_event events[HMS_LOOP_EVENTS];
+  int i, n;
+
+  n = epoll_wait( loop->out_fd, events, HMS_LOOP_EVENTS, 0 );
+  for( i=0; i < n; i++ ) {
+    hms_endpoint *endpoint = (hms_endpoint *) events[i].data.ptr;
+    endpoint->out_wait = HMS_FALSE;
+    _hms_loop_flush( endpoint );
+  }
+#endif
+
+} /* end _hms_loop_writable() */
+
+/* Parallel requests */
+/* ----------------------------------------------------- */
+
+/**
+ * With pipeline_depth > 1 the reader (the loop, or the worker that
+ * resumed it) does not wait for a request's handler before parsing the
+ * next one: up to req_depth requests of a connection are handed to
+ * workers at once, each with a slot in a ring. A handler's replies go
+ * to its slot; when a request is done, it and every done request after
+ * it are released, in order, to the endpoint's out buffer. A reader
+ * that fills the ring parks, and the request that frees a slot reads
+ * on. The endpoint is freed once the reader is gone, every request is
+ * released and everything is written.
+ *
+ * Returns 1 to go on reading, 0 once parked, -1 if reading stopped.
+ **/
+static int _hms_request_submit( hms_endpoint *endpoint, hms_msg *msg ) {
+
+  hms_loop *loop = endpoint->loop;
+  hms_request *req;
+  int full, stop;
+
+  /* only the reader adds requests, and it parks before the ring fills;
+     the slot was reset when released */
+  req = &endpoint->reqs[ endpoint->req_tail % endpoint->req_depth ];
+  req->endpoint = endpoint;
+  req->msg = msg;
+  pthread_mutex_lock( &endpoint->meta_lock );
+  endpoint->req_tail++;
+  pthread_mutex_unlock( &endpoint->meta_lock );
+
+  if( tpool_add_work( loop->pool, (void *) _hms_request_work, (void *) req ) == -1 ) {
+    req->msg = NULL;
+    if( loop->manager->shutdown ) { hms_msg_destroy( msg ); return -1; }
+
+    /* turned away: a BUSY reply in its place */
+    _hms_request = req;
+    int status = _hms_shed_msg( loop->manager, endpoint, msg );
+    _hms_request = NULL;
+    _hms_request_done( req, status );
+  }
+
+  pthread_mutex_lock( &endpoint->meta_lock );
+  stop = endpoint->close_asked;
+  full = ( endpoint->req_tail - endpoint->req_head >= (unsigned) endpoint->req_depth );
+  if( full && !stop ) { endpoint->parked = HMS_TRUE; }
+  pthread_mutex_unlock( &endpoint->meta_lock );
+
+  if( stop ) { _hms_loop_close( endpoint ); return -1; }
+
+  return ( full ) ? 0 : 1;
+
+} /* end _hms_request_submit() */
+
+/* Runs in a pool worker, side by side with the connection's other requests */
+static void _hms_request_work( hms_request *req ) {
+
+  hms_msg *msg = req->msg;
+  req->msg = NULL;
+
+  _hms_request = req;
+  int handler_status = _hms_endpoint_dispatch( req->endpoint, msg );
+  _hms_request = NULL;
+  hms_msg_destroy( msg ); msg = NULL;
+
+  _hms_request_done( req, handler_status );
+
+} /* end _hms_request_work() */
+
+/* A reply held in the request until those before it are released. It
+   counts against config.max_outbound from here, so a handler past it
+   sees its send fail rather than a reply missing from the stream */
+static int _hms_request_append( hms_request *req, struct iovec *iov, int iovcnt ) {
+
+  hms_endpoint *endpoint = req->endpoint;
+  int i, len = 0, ret;
+
+  for( i=0; i < iovcnt; i++ ) { len += iov[i].iov_len; }
+  if( len == 0 ) { return 0; }
+
+  pthread_mutex_lock( &endpoint->meta_lock );
+  ret = _hms_out_admit( endpoint, len );
+  if( ret == 0 ) { __atomic_add_fetch( &endpoint->unsent, len, __ATOMIC_RELAXED ); }
+  pthread_mutex_unlock( &endpoint->meta_lock );
+  if( ret != 0 ) { return -1; }
+
+  if( __buf_append( &req->out, &req->out_len, &req->out_cap, iov, iovcnt ) != 0 ) {
+    __atomic_sub_fetch( &endpoint->unsent, len, __ATOMIC_RELAXED );
+    return -1;
+  }
+
+  return 0;
+
+} /* end _hms_request_append() */
+
+/* Releases the done requests at the head of the ring. A handler that
+   asked to close stops the reader: the socket is shut for reading */
+static void _hms_request_done( hms_request *req, int status ) {
+
+  hms_endpoint *endpoint = req->endpoint;
+  int len = 0, post = HMS_FALSE, resume = HMS_FALSE, stop = HMS_FALSE, lost = HMS_FALSE;
+
+  pthread_mutex_lock( &endpoint->meta_lock );
+  req->done = HMS_TRUE;
+  if( status != 0 ) { endpoint->close_asked = HMS_TRUE; }
+
+  while( endpoint->req_head != endpoint->req_tail ) {
+    hms_request *head = &endpoint->reqs[ endpoint->req_head % endpoint->req_depth ];
+    if( !head->done ) { break; }
+    /* charged to max_outbound when the handler sent it */
+    if( head->out_len > 0 ) {
+      struct iovec iov;
+      iov.iov_base = head->out; iov.iov_len = head->out_len;
+      if( __buf_append( &endpoint->out, &endpoint->out_len, &endpoint->out_cap, &iov, 1 ) == 0 ) {
+	len += head->out_len;
+      } else {
+	__atomic_sub_fetch( &endpoint->unsent, head->out_len, __ATOMIC_RELAXED );
+	endpoint->close_asked = HMS_TRUE;
+	lost = HMS_TRUE;
+      }
+    }
+    head->out_len = 0;
+    head->done = HMS_FALSE;
+    endpoint->req_head++;
+  }
+
+  if( endpoint->parked && endpoint->req_tail - endpoint->req_head < (unsigned) endpoint->req_depth ) {
+    endpoint->parked = HMS_FALSE;
+    resume = HMS_TRUE;
+    stop = endpoint->close_asked;
+  }
+  if( !endpoint->posted &&
+      ( len > 0 || ( endpoint->closing && endpoint->req_head == endpoint->req_tail ) ) ) {
+    endpoint->posted = post = HMS_TRUE;
+  }
+  /* still locked: once it is not, the last release may free the endpoint */
+  if( status != 0 || lost ) { shutdown( endpoint->socket, SHUT_RD ); }
+  if( len > 0 ) {
+    __atomic_add_fetch( &endpoint->loop->send_bytes, len, __ATOMIC_RELAXED );
+  }
+  pthread_mutex_unlock( &endpoint->meta_lock );
+
+  if( post ) { _hms_loop_post( endpoint ); }
+
+  /* this worker is the reader now */
+  if( resume && stop ) { _hms_loop_close( endpoint ); }
+  else if( resume ) { _hms_loop_ready( endpoint ); }
+
+} /* end _hms_request_done() */
+
+/* Closes whatever a loop has open */
+static void _hms_loop_deinit( hms_loop *loop ) {
+
+  if( loop->listen_fd >= 0 ) { close( loop->listen_fd ); loop->listen_fd = -1; }
+  if( loop->ring ) { hms_uring_destroy( loop->ring ); loop->ring = NULL; }
+  if( loop->epoll_fd >= 0 ) { close( loop->epoll_fd ); loop->epoll_fd = -1; }
+  if( loop->out_fd >= 0 ) { close( loop->out_fd ); loop->out_fd = -1; }
+  if( loop->wake_fd >= 0 ) { close( loop->wake_fd ); loop->wake_fd = -1; }
+
+} /* end _hms_loop_deinit() */
+
+/* A loop that did not start; those before it are left to
+   _hms_loops_stop() and _hms_loops_free() */
+static void _hms_loop_fail( hms_loop *loop ) {
+
+  _hms_loop_deinit( loop );
+  pthread_mutex_destroy( &loop->lock );
+
+} /* end _hms_loop_fail() */
+
+static void* _hms_uring_run( void *arg ) {
+
+  hms_loop *loop = (hms_loop *) arg;
+  hms_uring_event events[HMS_LOOP_EVENTS];
+  int i, n;
+
+  _hms_loop_self = loop;
+
+  while( HMS_TRUE ) {
+
+    /* submits the accepts, receives and buffers queued so far */
+    n = hms_uring_wait( loop->ring, events, HMS_LOOP_EVENTS );
+    if( n == -1 ) {
+      if( errno == EINTR ) continue;
+      perror("io_uring_enter"); break;
+    }
+
+    for( i=0; i < n; i++ ) {
+      if( events[i].data == NULL ) {
+	if( loop->manager->shutdown ) { return NULL; }
+	_hms_uring_wake( loop );
+	continue;
+      }
+      if( events[i].data == loop ) { _hms_uring_accepted( loop, events[i].res ); continue; }
+      if( HMS_URING_IS_OUT( events[i].data ) ) {
+	hms_endpoint *endpoint = (hms_endpoint *) ( (char *) events[i].data - 1 );
+	endpoint->out_wait = HMS_FALSE;
+	_hms_loop_flush( endpoint );
+	continue;
+      }
+      _hms_uring_received( (hms_endpoint *) events[i].data, &events[i] );
+    }
+
+  } /* end while() */
+
+  return NULL;
+
+} /* end _hms_uring_run() */
+
+/* Gets the next receive of an endpoint queued: directly on the loop's
+   own thread, otherwise through the loop */
+static int _hms_uring_arm( hms_endpoint *endpoint ) {
+
+  hms_loop *loop = endpoint->loop;
+  uint64_t one = 1;
+  int was_empty;
+
+  if( _hms_loop_self == loop ) {
+    return hms_uring_recv( loop->ring, endpoint->socket, endpoint );
+  }
+
+  pthread_mutex_lock( &loop->lock );
+  was_empty = ( loop->arm == NULL );
+  endpoint->arm_next = loop->arm;
+  loop->arm = endpoint;
+  pthread_mutex_unlock( &loop->lock );
+
+  /* one wake-up covers everything queued until the loop takes the list */
+  if( was_empty && write( loop->wake_fd, &one, sizeof(one) ) != sizeof(one) ) {
+    perror("write");
+  }
+
+  return 0;
+
+} /* end _hms_uring_arm() */
+
+/* Queues receives for the endpoints handed over and writes for those
+   posted, then waits for the next */
+static void _hms_uring_wake( hms_loop *loop ) {
+
+  hms_endpoint *endpoint, *next;
+
+  pthread_mutex_lock( &loop->lock );
+  endpoint = loop->arm;
+  loop->arm = NULL;
+  pthread_mutex_unlock( &loop->lock );
+
+  for( ; endpoint; endpoint = next ) {
+    next = endpoint->arm_next;
+    endpoint->arm_next = NULL;
+    if( hms_uring_recv( loop->ring, endpoint->socket, endpoint ) != 0 ) { _hms_loop_close( endpoint ); }
+  }
+  _hms_loop_sendq( loop );
+
+  if( hms_uring_read( loop->ring, loop->wake_fd, &loop->wake_count, sizeof(loop->wake_count), NULL ) != 0 ) {
+    perror("io_uring wake");
+  }
+
+} /* end _hms_uring_wake() */
+
+/* A connection taken by one of the shard's queued accepts */
+static void _hms_uring_accepted( hms_loop *loop, int fd ) {
+
+  if( loop->manager->shutdown ) {
+    if( fd >= 0 ) { close( fd ); }
+    return;
+  }
+
+  if( fd >= 0 ) {
+    __atomic_add_fetch( &loop->manager->listen_stats.accepted, 1, __ATOMIC_RELAXED );
+    hms_endpoint *endpoint = _hms_endpoint_accepted( loop->manager, fd );
+    if( endpoint && _hms_loop_add( loop, endpoint ) != 0 ) { hms_endpoint_destroy( endpoint ); }
+  } else if( fd != -EINTR && fd != -ECONNABORTED ) {
+    errno = -fd; perror("accept");
+  }
+
+  /* keep the accept queued */
+  if( hms_uring_accept( loop->ring, loop->listen_fd, loop ) != 0 ) { perror("io_uring accept"); }
+
+} /* end _hms_uring_accepted() */
+
+/**
+ * Bytes a receive put into a provided buffer go straight to the parser.
+ * With a complete message whatever follows it is kept in the receive
+ * buffer for the worker, and the buffer goes back to the ring.
+ **/
+static void _hms_uring_received( hms_endpoint *endpoint, hms_uring_event *event ) {
+
+  hms_loop *loop = endpoint->loop;
+  hms_msg *msg = NULL;
+  int status = HMS_PARSE_ERROR, consumed = 0, buffered = HMS_FALSE;
+
+  /* out of buffers: they come back with this batch, try again */
+  if( event->res == -ENOBUFS ) {
+    if( hms_uring_recv( loop->ring, endpoint->socket, endpoint ) != 0 ) { _hms_loop_close( endpoint ); }
+    return;
+  }
+
+  if( event->res > 0 && event->buf && endpoint->fast_replies && !endpoint->reqs ) {
+    /* fast replies look at the bytes before the parser does */
+    buffered = ( hms_rbuf_append( &endpoint->rbuf, event->buf, event->res ) == 0 );
+  } else if( event->res > 0 && event->buf ) {
+    status = hms_parser_feed( endpoint->parser, event->buf, event->res, &consumed, &msg );
+    if( status == HMS_PARSE_DONE && consumed < event->res &&
+	hms_rbuf_append( &endpoint->rbuf, event->buf + consumed, event->res - consumed ) != 0 ) {
+      hms_msg_destroy( msg ); msg = NULL;
+      status = HMS_PARSE_ERROR;
+    }
+  }
+  if( event->buf ) { hms_uring_put_buffer( loop->ring, event->bid ); }
+
+  if( buffered ) {
+    _hms_loop_ready( endpoint );
+  } else if( status == HMS_PARSE_DONE ) {
+    /* turned away: on to what is buffered behind it */
+    if( _hms_loop_submit( endpoint, msg ) > 0 ) { _hms_loop_ready( endpoint ); }
+  } else if( status == HMS_PARSE_MORE ) {
+    if( hms_uring_recv( loop->ring, endpoint->socket, endpoint ) != 0 ) { _hms_loop_close( endpoint ); }
+  } else {
+    /* closed, failed or unparsable */
+    _hms_loop_close( endpoint );
+  }
+
+} /* end _hms_uring_received() */
+
+/* 1 if the next message was answered here, 0 if it needs the parser,
+   -1 to close the connection */
+static int _hms_endpoint_fast_reply( hms_endpoint *endpoint ) {
+
+  switch( hms_msg_parse_fast_rbuf( endpoint->socket, &endpoint->rbuf ) ) {
+  case HMS_FAST_NONE: return 0;
+  case HMS_FAST_PING: return ( hms_endpoint_send_template( endpoint, &_hms_pong_reply ) == 0 ) ? 1 : -1;
+  case HMS_FAST_INFO: return ( _hms_send_info( endpoint ) == 0 ) ? 1 : -1;
+  default: return -1; /* BYE or a closed connection */
+  }
+
+} /* end _hms_endpoint_fast_reply() */
+
+/* The same for a connection of an event loop, from what is buffered:
+   1 if a bare PING or INFO was answered, 0 if the parser is next, -1
+   to close the connection (BYE) */
+static int _hms_loop_fast_reply( hms_endpoint *endpoint ) {
+
+  char info[64];
+  struct iovec iov;
+  int used, n;
+
+  switch( hms_parser_fast_rbuf( &endpoint->rbuf, endpoint->parser, &used ) ) {
+  case HMS_FAST_NONE: return 0;
+  case HMS_FAST_PING: iov.iov_base = _hms_pong_reply.data; iov.iov_len = _hms_pong_reply.len; break;
+  case HMS_FAST_INFO: iov.iov_base = info; iov.iov_len = _hms_info_reply( info, sizeof(info) ); break;
+  default: return -1; /* BYE */
+  }
+
+  /* the loop itself never waits for a socket: a reply that cannot go
+     out at once is left to the parser and a worker */
+  if( !endpoint->loop->staged && _hms_loop_self == endpoint->loop ) {
+    n = send( endpoint->socket, iov.iov_base, iov.iov_len, MSG_DONTWAIT | MSG_NOSIGNAL );
+    if( n == -1 ) { return ( errno == EAGAIN || errno == EWOULDBLOCK ) ? 0 : -1; }
+    iov.iov_base = (char *) iov.iov_base + n; iov.iov_len -= n;
+    if( iov.iov_len > 0 &&
+	__sendv_all( endpoint->socket, &iov, 1, endpoint->loop->manager->config.send_timeout ) == -1 ) {
+      return -1;
+    }
+  } else if( _hms_endpoint_sendv( endpoint, &iov, 1 ) != 0 ) {
+    return -1;
+  }
+  hms_rbuf_skip( &endpoint->rbuf, used );
+
+  return 1;
+
+} /* end _hms_loop_fast_reply() */
+
+/* Connection slab */
+/* ----------------------------------------------------- */
+
+/**
+ * The endpoints of a server's connections are allocated once, at init:
+ * a slab of config.max_conns cache-line aligned slots, each holding an
+ * endpoint whose meta_lock is initialized here and kept across the
+ * connections that use it. Accepting takes a slot off a lock-free stack
+ * and closing pushes it back, so a burst of accepts costs no malloc,
+ * mutex setup or fragmentation; with every slot in use new connections
+ * are turned away. A handle is the slot number plus one in the low 32
+ * bits and the slot's generation in the high ones; freeing a slot bumps
+ * its generation under meta_lock, so a handle kept past its connection
+ * (or a reused slot) finds nothing. Senders check the generation and
+ * queue under the same lock, which keeps the endpoint from being freed
+ * under them.
+ **/
+static hms_conn_slab* _hms_conns_create( int size ) {
+
+  int i;
+  void *slots = NULL;
+  hms_conn_slab *slab = calloc( 1, sizeof(hms_conn_slab) );
+  if( slab == NULL ) { return NULL; }
+
+  if( posix_memalign( &slots, HERMES_CACHE_LINE, (size_t) size * sizeof(hms_conn_slot) ) != 0 ) {
+    free( slab ); return NULL;
+  }
+  memset( slots, 0, (size_t) size * sizeof(hms_conn_slot) );
+  slab->slots = slots;
+  slab->size = size;
+  for( i=0; i < size; i++ ) {
+    slab->slots[i].gen = 1;
+    slab->slots[i].next_free = ( i + 1 < size ) ? i + 2 : 0;
+    slab->slots[i].endpoint.socket = -1;
+    slab->slots[i].endpoint.slab = slab;
+    pthread_mutex_init( &slab->slots[i].endpoint.meta_lock, NULL );
+  }
+  slab->free_head = 1;
+
+  return slab;
+
+} /* end _hms_conns_create() */
+
+static void _hms_conns_destroy( hms_conn_slab *slab ) {
+
+  int i;
+
+  for( i=0; i < slab->size; i++ ) {
+    pthread_mutex_destroy( &slab->slots[i].endpoint.meta_lock );
+  }
+  free( slab->slots );
+  free( slab );
+
+} /* end _hms_conns_destroy() */
+
+/* The endpoint of a free slot, its handle set; NULL if none is free.
+   The tag in free_head changes with every pop and push, so a slot
+   popped and pushed back meanwhile fails the compare */
+static hms_endpoint* _hms_conn_alloc( hms_conn_slab *slab ) {
+
+  uint64_t head = __atomic_load_n( &slab->free_head, __ATOMIC_ACQUIRE ), next;
+  unsigned idx;
+  int used, peak;
+
+  do {
+    idx = (unsigned) ( head & 0xffffffff );
+    if( idx == 0 ) {
+      __atomic_add_fetch( &slab->refused, 1, __ATOMIC_RELAXED );
+      return NULL;
+    }
+    next = ( ( ( head >> 32 ) + 1 ) << 32 ) |
+      __atomic_load_n( &slab->slots[idx-1].next_free, __ATOMIC_RELAXED );
+  } while( !__atomic_compare_exchange_n( &slab->free_head, &head, next, HMS_TRUE,
+					 __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE ) );
+
+  used = __atomic_add_fetch( &slab->used, 1, __ATOMIC_RELAXED );
+  peak = __atomic_load_n( &slab->peak, __ATOMIC_RELAXED );
+  while( used > peak &&
+	 !__atomic_compare_exchange_n( &slab->peak, &peak, used, HMS_TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) );
+
+  hms_conn_slot *slot = &slab->slots[idx-1];
+  slot->endpoint.conn = ( (hms_conn) slot->gen << 32 ) | (hms_conn) idx;
+
+  return &slot->endpoint;
+
+} /* end _hms_conn_alloc() */
+
+/* No sender finds the endpoint from here on */
+static void _hms_conn_retire( hms_endpoint *endpoint ) {
+
+  pthread_mutex_lock( &endpoint->meta_lock );
+  ( (hms_conn_slot *) endpoint )->gen++;
+  endpoint->conn = 0;
+  pthread_mutex_unlock( &endpoint->meta_lock );
+
+} /* end _hms_conn_retire() */
+
+static void _hms_conn_free( hms_conn_slab *slab, hms_endpoint *endpoint ) {
+
+  hms_conn_slot *slot = (hms_conn_slot *) endpoint;
+  unsigned idx = (unsigned) ( slot - slab->slots ) + 1;
+  uint64_t head = __atomic_load_n( &slab->free_head, __ATOMIC_RELAXED ), next;
+
+  do {
+    __atomic_store_n( &slot->next_free, (unsigned) ( head & 0xffffffff ), __ATOMIC_RELAXED );
+    next = ( ( ( head >> 32 ) + 1 ) << 32 ) | idx;
+  } while( !__atomic_compare_exchange_n( &slab->free_head, &head, next, HMS_TRUE,
+					 __ATOMIC_RELEASE, __ATOMIC_RELAXED ) );
+
+  __atomic_sub_fetch( &slab->used, 1, __ATOMIC_RELAXED );
+
+} /* end _hms_conn_free() */
+
+static int _hms_conn_queue( hms *manager, hms_conn conn, struct iovec *iov, int iovcnt ) {
+
+  hms_conn_slab *slab = manager->conns;
+  hms_conn_slot *slot;
+  int idx = (int) ( conn & 0xffffffff ) - 1, ret = -1, post = HMS_FALSE;
+
+  if( slab == NULL || idx < 0 || idx >= slab->size ) { return -1; }
+
+  /* only staged loops take sends from other threads; a thread-per-
+     connection handler holds meta_lock for as long as its connection */
+  if( manager->num_loops == 0 || !manager->config.staged_replies ) { return -1; }
+
+  slot = &slab->slots[idx];
+  pthread_mutex_lock( &slot->endpoint.meta_lock );
+  if( slot->gen == (unsigned) ( conn >> 32 ) && slot->endpoint.loop && slot->endpoint.loop->staged ) {
+    ret = _hms_loop_append_locked( &slot->endpoint, iov, iovcnt, &post );
+  }
+  pthread_mutex_unlock( &slot->endpoint.meta_lock );
+
+  /* posted by this call: the endpoint stays until its loop has written */
+  if( post ) { _hms_loop_post( &slot->endpoint ); }
+
+  return ret;
+
+} /* end _hms_conn_queue() */
+
+/* Admission control */
+/* ----------------------------------------------------- */
+
+/**
+ * Work that finds the worker queue full is turned away right away
+ * instead of waiting: a connection is closed, a message dropped. Both
+ * get a BUSY reply first if config.busy_reply is set. The reply is
+ * only sent if the socket takes all of it at once; a connection whose
+ * message was dropped without one is closed too.
+ **/
+static int _hms_send_busy( hms *manager, int fd ) {
+
+  if( !manager->config.busy_reply ) { return 0; }
+
+  int n = send( fd, _hms_busy_reply.data, _hms_busy_reply.len, MSG_DONTWAIT | MSG_NOSIGNAL );
+
+  return ( n == _hms_busy_reply.len ) ? 0 : -1;
+
+} /* end _hms_send_busy() */
+
+static void _hms_shed_endpoint( hms *manager, hms_endpoint *endpoint ) {
+
+  __atomic_add_fetch( &manager->shed_stats.connections, 1, __ATOMIC_RELAXED );
+  _hms_send_busy( manager, endpoint->socket );
+  hms_endpoint_destroy( endpoint );
+
+} /* end _hms_shed_endpoint() */
+
+/* -1 if no BUSY reply went out, the connection should be closed then:
+   the peer must not wait for a reply that never comes */
+static int _hms_shed_msg( hms *manager, hms_endpoint *endpoint, hms_msg *msg ) {
+
+  __atomic_add_fetch( &manager->shed_stats.requests, 1, __ATOMIC_RELAXED );
+  hms_msg_destroy( msg );
+
+  if( !manager->config.busy_reply ) { return -1; }
+
+  /* behind the replies still queued for the connection */
+  if( endpoint->loop && endpoint->loop->staged ) {
+    return hms_endpoint_send_template( endpoint, &_hms_busy_reply );
+  }
+
+  return _hms_send_busy( manager, endpoint->socket );
+
+} /* end _hms_shed_msg() */
+
+/* Body helpers */
+/* ----------------------------------------------------- */
+
+typedef struct _hms_body_ctx {
+  hms_endpoint *endpoint;
+  hms_ops *ops;
+  hms_msg *msg;
+} _hms_body_ctx;
+
+static int _hms_endpoint_recv_header( hms_endpoint *endpoint, hms_msg **msg ) {
+
+  *msg = hms_msg_parse_header_rbuf( endpoint->socket, &endpoint->rbuf, endpoint->max_hdr_size );
+
+  return (*msg) ? 0 : -1;
+
+} /* end _hms_endpoint_recv_header() */
 
-  hms *manager = NULL;
+static int _hms_endpoint_recv_body( hms_endpoint *endpoint, hms_msg *msg ) {
 
-  /* malloc space */
-  manager = (hms *) malloc( sizeof(hms) );
-  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) manager);
+  return hms_msg_parse_body_rbuf( endpoint->socket, &endpoint->rbuf, msg );
 
-  /* ignore broken pipe */
-  signal( SIGPIPE, SIG_IGN );
+} /* end _hms_endpoint_recv_body() */
 
-  /* initialize mutexes */
-  pthread_mutex_init( &(manager->manager_lock), NULL);
+static int _hms_body_sink( void *arg, char *data, int len, int offset ) {
 
-  /* set defaults */
-  manager->num_threads = num_threads;
-  manager->shutdown = HMS_FALSE;
-  manager->server_port = server_port;
+  _hms_body_ctx *ctx = (_hms_body_ctx *) arg;
+  return ctx->ops->hms_body( ctx->endpoint, ctx->msg, data, len, offset );
 
-  manager->dops.hms_validate = _hms_default_validate;
-  manager->dops.hms_handle = _hms_default_handle;
-  manager->ops = ops;
+} /* end _hms_body_sink() */
 
-  /* create the thread pool */
-  tpool_init(&manager->pool, (num_threads + 2), 10, HMS_TRUE );
-  //fprintf(stdout, "created thread pool\n"); fflush(stdout);
-  
-  /* starts a thread to listen */
-  if( server_port > 0 ) {
-    hms_assert_not_equals(__FILE__, __LINE__,  -1, tpool_add_work(manager->pool, (void *) _hms_listen, (void *) manager) );    
-  }
+static int _hms_endpoint_stream_body( hms_endpoint *endpoint, hms_ops *ops, hms_msg *msg ) {
 
-  return manager;
+  if( !(msg->flags & HMS_BODY_PENDING) ) { return 0; }
 
-} /* end hermes_init */
+  _hms_body_ctx ctx = { endpoint, ops, msg };
+  int ret = hms_msg_stream_body_rbuf( endpoint->socket, &endpoint->rbuf, msg, _hms_body_sink, &ctx );
 
+  /* let the handler clean up after a short body */
+  if( ret != 0 ) {
+    ops->hms_body( endpoint, msg, NULL, 0, 0 );
+  }
 
+  return ret;
 
-int  hermes_shutdown( hms *manager, int force ) {
+} /* end _hms_endpoint_stream_body() */
 
-  pthread_mutex_lock( &manager->manager_lock );
-  manager->shutdown = HMS_TRUE;
+static int _hms_endpoint_sink_body( hms_endpoint *endpoint, hms_ops *ops, hms_msg *msg,
+				    int out_fd, off_t offset ) {
 
-  /* blocks until all threads end */
-  tpool_destroy( manager->pool, force );
+  int ret = hms_msg_sink_body_rbuf( endpoint->socket, &endpoint->rbuf, msg, out_fd, offset );
 
-  /* clean up memory */
-  close(manager->server_socket);
-  pthread_mutex_unlock( &manager->manager_lock );
+  /* let the handler clean up after a short body */
+  if( ret != 0 ) {
+    ops->hms_sink( endpoint, msg, NULL, NULL );
+  }
 
-  return 0;
+  return ret;
 
-} /* end hermes_shutdown() */
+} /* end _hms_endpoint_sink_body() */
 
-/**
- *
- * Runs in a separate thread and spawns new threads to 
- * handle connections 
- *
- **/
+/* Pending body of an accepted message: a file, hms_body or the message */
+static int _hms_endpoint_deliver_body( hms_endpoint *endpoint, hms_ops *ops, hms_msg *msg ) {
 
-static void _hms_listen(hms *manager ) {
+  if( !(msg->flags & HMS_BODY_PENDING) ) {
+    return ( msg->content ) ? _hms_endpoint_deliver_buffered( endpoint, ops, msg ) : 0;
+  }
 
-  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) manager );
+  int out_fd = -1; off_t offset = 0;
+  if( ops->hms_sink && ops->hms_sink( endpoint, msg, &out_fd, &offset ) == 0 ) {
+    return _hms_endpoint_sink_body( endpoint, ops, msg, out_fd, offset );
+  }
+  if( ops->hms_body ) {
+    return _hms_endpoint_stream_body( endpoint, ops, msg );
+  }
 
-  int sockfd;
-  struct sockaddr_in my_addr;
-  struct sockaddr_in their_addr;
-  int new_fd;
-  socklen_t sin_size;
-  int yes;
-  int server_port = manager->server_port;
-  unsigned sleep_time = 0;
+  return _hms_endpoint_recv_body( endpoint, msg );
 
- retry_listen:
+} /* end _hms_endpoint_deliver_body() */
 
-  /* exponential backoff */
-  if(sleep_time) sleep(sleep_time);
+/* A body the parser already read (event loops): same callbacks, from memory */
+static int _hms_endpoint_deliver_buffered( hms_endpoint *endpoint, hms_ops *ops, hms_msg *msg ) {
 
-  if(sleep_time == 0) { sleep_time = 2; }
-  else if(sleep_time == 2) { sleep_time = 2*sleep_time; }
+  int out_fd = -1; off_t offset = 0;
+  const char *body = NULL; int body_len = 0;
+  hms_msg_peek_body( msg, &body, &body_len );
 
-  /* open the socket */
-  if( (sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-    perror("socket"); goto retry_listen;
+  if( ops->hms_sink && ops->hms_sink( endpoint, msg, &out_fd, &offset ) == 0 ) {
+    if( __pwrite_all( out_fd, (char *) body, body_len, offset ) != 0 ) {
+      ops->hms_sink( endpoint, msg, NULL, NULL );
+      return -1;
+    }
+    return 0;
   }
-  /* set socket options */
-  if(setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int) ) == -1) {
-    perror("setsockopt"); goto retry_listen;
+  if( ops->hms_body ) {
+    return ops->hms_body( endpoint, msg, (char *) body, body_len, 0 );
   }
-  my_addr.sin_family = AF_INET;
-  my_addr.sin_port = htons(server_port);
-  my_addr.sin_addr.s_addr = INADDR_ANY;
-  memset(my_addr.sin_zero, '\0', sizeof(my_addr.sin_zero));
 
-  /* bind the socket */
-  if( bind(sockfd, (struct sockaddr *) &my_addr, sizeof(my_addr) ) == -1) {
-      perror("bind"); 
-      goto retry_listen;
-  }
-  manager->server_socket = sockfd;
+  return 0;
 
-  /* listen on the socket */
-  if(listen(sockfd, 10) == -1){
-    perror("listen"); goto retry_listen;
-  }
+} /* end _hms_endpoint_deliver_buffered() */
 
-  /* spawn thread to accept connections */
-  //fprintf(stdout, "waiting to accept\n"); fflush(stdout);
-  while( HMS_TRUE ) {
+/* Socket helpers */
+/* ----------------------------------------------------- */
 
-    int flag = 1, ret;
-    sin_size = sizeof(their_addr);
-    if((new_fd = accept(sockfd, (struct sockaddr *) &their_addr, &sin_size)) == -1) {
-      perror("accept"); return;
-    }
-    ret = setsockopt( new_fd , IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(flag) );
-    ret = setsockopt( new_fd, SOL_SOCKET, SO_REUSEADDR, (char *)&flag, sizeof(flag) );
-    //fprintf(stdout, "accepting new connection\n"); fflush(stdout); 
+/* Sends all of iov in as few sendmsg() calls as the socket allows */
+/* A non-blocking socket that takes nothing for timeout ms (-1: no
+   limit) fails with ETIMEDOUT */
+static int __sendv_all( int fd, struct iovec *iov, int iovcnt, int timeout ) {
 
-    /* shutdown */
-    if(manager->shutdown) break;
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) iov);
+
+  struct msghdr mh;
+  struct timespec now, deadline;
+  ssize_t n;
+  int sent = 0, wait = timeout;
+
+  if( timeout >= 0 ) {
+    clock_gettime( CLOCK_MONOTONIC, &deadline );
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += ( timeout % 1000 ) * 1000000L;
+    if( deadline.tv_nsec >= 1000000000L ) { deadline.tv_sec++; deadline.tv_nsec -= 1000000000L; }
+  }
 
-    /* allocate an endpoint and add to manager */
-    hms_endpoint *endpoint = hms_endpoint_init( new_fd, manager->ops );
-    hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) endpoint);    
+  memset( &mh, 0, sizeof(mh) );
+  while( iovcnt > 0 ) {
+
+    mh.msg_iov = iov; mh.msg_iovlen = iovcnt;
+    if( (n = sendmsg( fd, &mh, 0 )) == -1 ) {
+      if( errno == EINTR ) continue;
+      /* non-blocking socket of an event loop: wait for room, until the
+	 deadline */
+      if( errno == EAGAIN || errno == EWOULDBLOCK ) {
+	struct pollfd pfd = { fd, POLLOUT, 0 };
+	if( timeout >= 0 ) {
+	  clock_gettime( CLOCK_MONOTONIC, &now );
+	  wait = ( deadline.tv_sec - now.tv_sec ) * 1000 + ( deadline.tv_nsec - now.tv_nsec ) / 1000000;
+	  if( wait <= 0 ) { errno = ETIMEDOUT; return -1; }
+	}
+	if( poll( &pfd, 1, wait ) == -1 && errno != EINTR ) { return -1; }
+	continue;
+      }
+      return -1;
+    }
+    sent += n;
 
-    /* spawn a thread to handle the new conn */
-    hms_assert_not_equals( __FILE__, __LINE__, -1, tpool_add_work(manager->pool, (void *) _hms_handle_endpoint, (void *) endpoint) );    
-    //fprintf(stdout, "spawned handler thread success\n"); fflush(stdout);
+    /* skip what went out; a partial write resumes mid-vector */
+    while( iovcnt > 0 && (size_t) n >= iov->iov_len ) {
+      n -= iov->iov_len; iov++; iovcnt--;
+    }
+    if( iovcnt > 0 ) {
+      iov->iov_base = (char *) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
 
-  } /* end while() */
+  }
 
-  /* should not reach here until shutdown */
-  hms_assert_not_equals( __FILE__, __LINE__,  0, manager->shutdown);
+  return sent;
 
-  return;
+} /* __sendv_all() */
 
-} /* end _hms_listen() */
+static int __pwrite_all( int fd, char *p, int len, off_t offset ) {
 
-static void _hms_handle_endpoint( hms_endpoint *endpoint ) {
+  int n;
 
-  pthread_mutex_lock( &endpoint->meta_lock );
+  while( len > 0 ) {
+    n = pwrite( fd, p, len, offset );
+    if( n == -1 && errno == EINTR ) { continue; }
+    if( n <= 0 ) { return -1; }
+    p += n; len -= n; offset += n;
+  }
 
-  int handler_status = 0;
+  return 0;
 
-  while( HMS_TRUE ) {
+} /* __pwrite_all() */
 
-    /* read hms message */
-    hms_msg *msg = NULL;
-    int parse_status = hms_endpoint_recv_msg( endpoint, &msg );
-    if(parse_status != 0) { /*fprintf(stderr, "parser failed\n");*/ break;}
+/* Header and body of msg in one sendmsg(); the header is serialized into
+   the connection's write buffer, the body is not copied */
+static int __send_msg( int fd, char **wbuf, int *wbuf_cap, hms_msg *msg ) {
 
-    /* validate then handle */
-    if( !endpoint->ops.hms_validate || endpoint->ops.hms_validate(endpoint,msg) == 0 ) {
-      if( endpoint->ops.hms_accepts(endpoint,msg) == 0 ) {
-	handler_status = endpoint->ops.hms_handle(endpoint,msg);
-      }
-      /* call default handler */
-      else {
-	handler_status = _hms_default_handle( endpoint, msg );
-      }
-    }
+  struct iovec iov[2];
+  int iovcnt = __msg_iov( wbuf, wbuf_cap, msg, iov );
+  if( iovcnt == -1 ) { return -1; }
 
-    /* free memory used by message */
-    hms_msg_destroy( msg ); msg = NULL;
+  return ( __sendv_all( fd, iov, iovcnt, -1 ) == -1 ) ? -1 : 0;
 
-    if(handler_status != 0 ) break;
-    
-  } /* end while() */
+} /* __send_msg() */
 
-  /* close the endpoint */
-  hms_endpoint_destroy( endpoint );
+/* The header serialized into the write buffer and the body, as is;
+   returns the number of iovecs filled (at most 2) or -1 */
+static int __msg_iov( char **wbuf, int *wbuf_cap, hms_msg *msg, struct iovec *iov ) {
 
-  pthread_mutex_unlock( &endpoint->meta_lock);
+  int iovcnt = 1;
 
-  return;
+  /* serialize the header, growing the write buffer if needed */
+  int hdr_len = 0; hdr_len = hms_msg_get_header_size( msg );
+  hms_assert_not_equals( __FILE__, __LINE__ , (int) 0, (int) hdr_len);
+  if( hdr_len > *wbuf_cap ) {
+    int cap = (*wbuf_cap) ? *wbuf_cap : HERMES_MAX_HDR_SIZE;
+    while( cap < hdr_len ) { cap *= 2; }
+    char *buf = realloc( *wbuf, cap );
+    if( buf == NULL ) { return -1; }
+    *wbuf = buf; *wbuf_cap = cap;
+  }
+  if( hms_msg_print_header( msg, *wbuf, *wbuf_cap ) != 0 ) { return -1; }
+  iov[0].iov_base = *wbuf; iov[0].iov_len = hdr_len;
 
-} /* end _hms_handle_endpoint() */
+  /* body straight from the message; ok if no body exists */
+  if( hms_msg_get_body_size( msg ) > 0 ) {
+    const char *body = NULL; int body_len = 0;
+    if( hms_msg_peek_body( msg, &body, &body_len ) || !body ) {
+      return -1;
+    }
+    iov[1].iov_base = (char *) body; iov[1].iov_len = body_len;
+    iovcnt = 2;
+  }
 
-/* Socket helpers */
-/* ----------------------------------------------------- */
+  return iovcnt;
 
-static int __send_all( int fd, char *buf, int len) {
+} /* __msg_iov() */
 
-  /* Check input */
-  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) buf);
-  hms_assert_not_equals( __FILE__, __LINE__ , (int) 0, (int) len);
+/* Appends all of iov to a buffer that grows as needed */
+static int __buf_append( char **buf, int *len, int *cap, struct iovec *iov, int iovcnt ) {
 
-  const char *p = buf;
-  int n;
-  
-  do {
-    if((n = send(fd, p, len, 0)) == -1)
-      return n;
-    len -= n;
-    p += n;
-  } while(len > 0);
+  int i, need = *len;
 
-  return p - (const char *) buf;
+  for( i=0; i < iovcnt; i++ ) { need += iov[i].iov_len; }
+  if( need > *cap ) {
+    int new_cap = (*cap) ? *cap : HERMES_MAX_HDR_SIZE;
+    while( new_cap < need ) { new_cap *= 2; }
+    char *p = realloc( *buf, new_cap );
+    if( p == NULL ) { return -1; }
+    *buf = p; *cap = new_cap;
+  }
+  for( i=0; i < iovcnt; i++ ) {
+    memcpy( *buf + *len, iov[i].iov_base, iov[i].iov_len );
+    *len += iov[i].iov_len;
+  }
+
+  return 0;
 
-} /* __send_all() */
+} /* end __buf_append() */
 
 static int __recv_all(int fd, char *buf, int len) {
 
@@ -280,7 +2322,7 @@ hms_connector* hms_connector_init( char *hostname, int port ) {
   /* connect to server */
   if(connect(sockfd, (struct sockaddr *) &their_addr, sizeof(their_addr) ) == -1) {
     close(sockfd);
-    return -1;
+    return NULL;
   }
 
   /* disable nagle */
@@ -297,6 +2339,10 @@ hms_connector* hms_connector_init( char *hostname, int port ) {
 
   /* initialize the connector */
   connector->socket = sockfd;
+  hms_rbuf_init( &connector->rbuf );
+  connector->wbuf = NULL; connector->wbuf_cap = 0;
+  connector->rbuf.zero_copy = HMS_TRUE;
+  connector->max_hdr_size = HERMES_MAX_HDR_SIZE;
   gettimeofday( &connector->start, NULL );
   pthread_mutex_init( &connector->meta_lock, NULL );
 
@@ -311,7 +2357,7 @@ int hms_connector_recv_msg( hms_connector *connector, hms_msg **msg ) {
 
   /* Receive msg */
   hms_msg *tmp_msg = NULL;
-  tmp_msg = hms_msg_parse( connector->socket, HERMES_MAX_HDR_SIZE );
+  tmp_msg = hms_msg_parse_rbuf( connector->socket, &connector->rbuf, connector->max_hdr_size );
 
   /* Parsing failed */
   if(!tmp_msg) {
@@ -323,40 +2369,30 @@ int hms_connector_recv_msg( hms_connector *connector, hms_msg **msg ) {
 
 } /* end hms_connector_recv_msg() */
 
+/**
+ * The receive buffer starts at rbuf_size bytes (0 keeps the default)
+ * and doubles while a header needs it, up to max_hdr_size.
+ **/
+int hms_connector_set_hdr_size( hms_connector *connector, int rbuf_size, int max_hdr_size ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) connector);
+  if( rbuf_size < 0 || max_hdr_size <= 2 ) { return -1; }
+
+  connector->rbuf.init_cap = (rbuf_size) ? rbuf_size : HERMES_RBUF_SIZE;
+  connector->max_hdr_size = max_hdr_size;
+
+  return 0;
+
+} /* end hms_connector_set_hdr_size() */
+
 int hms_connector_send_msg( hms_connector *connector, hms_msg *msg ) {
 
   /* Check input */
   hms_assert_not_equals( __FILE__, __LINE__ , (int) NULL, (int) connector);
   hms_assert_not_equals( __FILE__, __LINE__ , (int) NULL, (int) msg);
   
-  int erred = HMS_FALSE;
-
-  /* Put header in bufffer to send in one shot */
-  int hdr_len = 0; hdr_len = hms_msg_get_header_size( msg );
-  hms_assert_not_equals( __FILE__, __LINE__ , (int) 0, (int) hdr_len);
-  char *hdr_buf = malloc( hdr_len + 1 );
-  hms_assert_not_equals( __FILE__, __LINE__ , (int) NULL, (int) hdr_buf);
-  
-  /* get header */
-  if( hms_msg_print_header( msg, hdr_buf, hdr_len) == 0 ) {
-    if( __send_all( connector->socket, hdr_buf, hdr_len ) == -1 ) {
-      erred = HMS_TRUE;
-    }
-  } else { erred = HMS_TRUE; }
-  free(hdr_buf); hdr_buf = NULL; hdr_len = 0;
-
-  /* send body */
-  if( hms_msg_get_body_size( msg ) > 0 ) {
-    char *body = NULL; int body_len = 0;
-    if( !hms_msg_get_body( msg, &body, &body_len) && body ) {
-      if( __send_all( connector->socket, body, body_len ) == -1 ) {
-	erred = HMS_TRUE;
-      }
-      free(body); body = NULL; body_len = 0;
-    } else { erred = HMS_TRUE; }
-  } else { erred = HMS_TRUE; }
-
-  return (erred == HMS_FALSE) ? 0 : -1;
+  return __send_msg( connector->socket, &connector->wbuf, &connector->wbuf_cap, msg );
 
 } /* end hms_connector_send_msg() */
 
@@ -367,6 +2403,8 @@ int hms_connector_destroy( hms_connector *connector ) {
 
   close(connector->socket);
   connector->socket = -1;
+  hms_rbuf_deinit( &connector->rbuf );
+  if( connector->wbuf ) { free( connector->wbuf ); connector->wbuf = NULL; }
   connector->status = HMS_ENDPOINT_FREE;
   
   free(connector); connector = NULL;
@@ -385,23 +2423,56 @@ hms_endpoint* hms_endpoint_init( int fd, hms_ops ops ) {
   /* Malloc space */
   endpoint = calloc( 1, sizeof(hms_endpoint) );
   hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) endpoint);
+  pthread_mutex_init( &endpoint->meta_lock, NULL );
+
+  _hms_endpoint_setup( endpoint, fd, ops );
+
+  return endpoint;
+
+} /* end hms_endpoint_init() */
+
+/* Everything but meta_lock (and the handle and slab of a slab
+   endpoint), which the endpoint keeps */
+static void _hms_endpoint_setup( hms_endpoint *endpoint, int fd, hms_ops ops ) {
+
+  hms_conn conn = endpoint->conn;
+  hms_conn_slab *slab = endpoint->slab;
+
+  memset( endpoint, 0, offsetof( hms_endpoint, meta_lock ) );
+  endpoint->conn = conn;
+  endpoint->slab = slab;
 
   /* Initialize the endpoint */
   endpoint->socket = fd;
+  hms_rbuf_init( &endpoint->rbuf );
+  endpoint->wbuf = NULL; endpoint->wbuf_cap = 0;
+  endpoint->rbuf.zero_copy = HMS_TRUE;
+  endpoint->max_hdr_size = HERMES_MAX_HDR_SIZE;
   endpoint->status = HMS_ENDPOINT_FREE;
   endpoint->ops = ops;
-  pthread_mutex_init( &endpoint->meta_lock, NULL );
+  endpoint->data = NULL;
+  endpoint->loop = NULL;
+  endpoint->parser = NULL;
+  endpoint->msg = NULL;
+  endpoint->verbs = NULL;
+  endpoint->out = endpoint->sending = NULL;
+  endpoint->out_len = endpoint->out_cap = 0;
+  endpoint->sending_len = endpoint->sending_cap = endpoint->sent = 0;
+  endpoint->out_wait = endpoint->closing = endpoint->posted = HMS_FALSE;
+  endpoint->send_next = NULL;
+  endpoint->reqs = NULL;
+  endpoint->req_depth = 0;
+  endpoint->req_head = endpoint->req_tail = 0;
+  endpoint->parked = endpoint->close_asked = HMS_FALSE;
+  endpoint->unsent = 0;
   gettimeofday( &endpoint->start, NULL );
 
   /* Setup ops */
   if(ops.hms_validate == NULL ) endpoint->ops.hms_validate = _hms_default_validate;
   if(ops.hms_accepts == NULL ) endpoint->ops.hms_accepts = _hms_default_accepts;
   if(ops.hms_handle == NULL ) endpoint->ops.hms_handle = _hms_default_handle;
-  
-
-  return endpoint;
 
-} /* end hms_endpoint_init() */
+} /* end _hms_endpoint_setup() */
 
 int hms_endpoint_recv_msg( hms_endpoint *endpoint, hms_msg **msg ) {
 
@@ -410,7 +2481,7 @@ int hms_endpoint_recv_msg( hms_endpoint *endpoint, hms_msg **msg ) {
 
   /* Receive msg */
   hms_msg *tmp_msg = NULL;
-  tmp_msg = hms_msg_parse( endpoint->socket, HERMES_MAX_HDR_SIZE );
+  tmp_msg = hms_msg_parse_rbuf( endpoint->socket, &endpoint->rbuf, endpoint->max_hdr_size );
 
   /* Parsing failed */
   if(!tmp_msg) {
@@ -422,53 +2493,140 @@ int hms_endpoint_recv_msg( hms_endpoint *endpoint, hms_msg **msg ) {
 
 } /* end hms_endpoint_recv_msg() */
 
+int hms_endpoint_set_hdr_size( hms_endpoint *endpoint, int rbuf_size, int max_hdr_size ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) endpoint);
+  if( rbuf_size < 0 || max_hdr_size <= 2 ) { return -1; }
+
+  endpoint->rbuf.init_cap = (rbuf_size) ? rbuf_size : HERMES_RBUF_SIZE;
+  endpoint->max_hdr_size = max_hdr_size;
+
+  return 0;
+
+} /* end hms_endpoint_set_hdr_size() */
+
+/* Bodies past max_body_size fail the message instead of being read
+   into memory; 0 for no bound */
+int hms_endpoint_set_body_size( hms_endpoint *endpoint, int max_body_size ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) endpoint);
+  if( max_body_size < 0 ) { return -1; }
+
+  endpoint->rbuf.max_body = max_body_size;
+
+  return 0;
+
+} /* end hms_endpoint_set_body_size() */
+
 int hms_endpoint_send_msg( hms_endpoint *endpoint, hms_msg *msg ) {
 
   /* Check input */
   hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) endpoint);
   hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) msg);
-  
-  int erred = HMS_FALSE;
-
-  /* Put header in bufffer to send in one shot */
-  int hdr_len = 0; hdr_len = hms_msg_get_header_size( msg );
-  hms_assert_not_equals( __FILE__, __LINE__ , (int) 0, (int) hdr_len);
-  char *hdr_buf = malloc( hdr_len + 1 );
-  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) hdr_buf);
-  
-  /* get header */
-  if( hms_msg_print_header( msg, hdr_buf, hdr_len) == 0 ) {
-    if( __send_all( endpoint->socket, hdr_buf, hdr_len ) == -1 ) {
-      erred = HMS_TRUE;
-    }
-  } else { erred = HMS_TRUE; }
-  free(hdr_buf); hdr_buf = NULL; hdr_len = 0;
 
+  struct iovec iov[2];
+  char **wbuf = &endpoint->wbuf; int *wbuf_cap = &endpoint->wbuf_cap;
+  int iovcnt;
 
-  /* send body */
-  if( hms_msg_get_body_size( msg ) > 0 ) {
-    char *body = NULL; int body_len = 0;
-    if( !hms_msg_get_body( msg, &body, &body_len) && body ) {
-      if( __send_all( endpoint->socket, body, body_len ) == -1 ) {
-	erred = HMS_TRUE;
-      }
-      free(body); body = NULL; body_len = 0;
-    } else { erred = HMS_TRUE; }
-  } /* ok if no body exists */
+  /* handlers of one connection running side by side each have their own */
+  if( _hms_request && _hms_request->endpoint == endpoint ) {
+    wbuf = &_hms_request->wbuf; wbuf_cap = &_hms_request->wbuf_cap;
+  }
+  iovcnt = __msg_iov( wbuf, wbuf_cap, msg, iov );
+  if( iovcnt == -1 ) { return -1; }
 
-  return (erred == HMS_FALSE) ? 0 : -1;
+  return _hms_endpoint_sendv( endpoint, iov, iovcnt );
 
 } /* end hms_endpoint_send_msg() */
 
+int hms_endpoint_send_template( hms_endpoint *endpoint, hms_reply_template *tmpl ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) endpoint);
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) tmpl);
+
+  struct iovec iov;
+  iov.iov_base = tmpl->data; iov.iov_len = tmpl->len;
+
+  return _hms_endpoint_sendv( endpoint, &iov, 1 );
+
+} /* end hms_endpoint_send_template() */
+
+/* The handle other threads send to this connection with; 0 unless it
+   is served by event loops with staged replies */
+hms_conn hms_endpoint_conn( hms_endpoint *endpoint ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) endpoint);
+
+  return ( endpoint->loop && endpoint->loop->staged ) ? endpoint->conn : 0;
+
+} /* end hms_endpoint_conn() */
+
+/* All of iov to the peer; with staged replies the endpoint's loop
+   writes it later */
+static int _hms_endpoint_sendv( hms_endpoint *endpoint, struct iovec *iov, int iovcnt ) {
+
+  /* a parallel request's replies wait for those before it */
+  if( _hms_request && _hms_request->endpoint == endpoint ) {
+    return _hms_request_append( _hms_request, iov, iovcnt );
+  }
+  if( endpoint->loop && endpoint->loop->staged ) {
+    return _hms_loop_queue( endpoint, iov, iovcnt );
+  }
+  if( endpoint->loop == NULL ) {
+    return ( __sendv_all( endpoint->socket, iov, iovcnt, -1 ) == -1 ) ? -1 : 0;
+  }
+
+  /* a worker writing for a loop gives up on a reader that stopped; the
+     loop sees the shut down socket and closes the connection */
+  hms *manager = endpoint->loop->manager;
+  if( __sendv_all( endpoint->socket, iov, iovcnt, manager->config.send_timeout ) == -1 ) {
+    if( errno == ETIMEDOUT ) {
+      __atomic_add_fetch( &manager->shed_stats.slow, 1, __ATOMIC_RELAXED );
+      shutdown( endpoint->socket, SHUT_RDWR );
+    }
+    return -1;
+  }
+
+  return 0;
+
+} /* end _hms_endpoint_sendv() */
+
 int hms_endpoint_destroy( hms_endpoint *endpoint ) {
 
   /* Check input */
   hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) endpoint);
 
+  if( endpoint->slab ) { _hms_conn_retire( endpoint ); }
+
   close(endpoint->socket);
   endpoint->socket = -1;
+  hms_rbuf_deinit( &endpoint->rbuf );
+  if( endpoint->wbuf ) { free( endpoint->wbuf ); endpoint->wbuf = NULL; }
+  if( endpoint->out ) { free( endpoint->out ); endpoint->out = NULL; }
+  if( endpoint->sending ) { free( endpoint->sending ); endpoint->sending = NULL; }
+  if( endpoint->reqs ) {
+    int i;
+    for( i=0; i < endpoint->req_depth; i++ ) {
+      if( endpoint->reqs[i].msg ) { hms_msg_destroy( endpoint->reqs[i].msg ); }
+      if( endpoint->reqs[i].out ) { free( endpoint->reqs[i].out ); }
+      if( endpoint->reqs[i].wbuf ) { free( endpoint->reqs[i].wbuf ); }
+    }
+    free( endpoint->reqs ); endpoint->reqs = NULL;
+  }
+  if( endpoint->msg ) { hms_msg_destroy( endpoint->msg ); endpoint->msg = NULL; }
+  if( endpoint->parser ) { hms_parser_destroy( endpoint->parser ); endpoint->parser = NULL; }
   endpoint->status = HMS_ENDPOINT_FREE;
-  
+
+  /* a slab endpoint keeps its lock for the slot's next connection */
+  if( endpoint->slab ) {
+    _hms_conn_free( endpoint->slab, endpoint );
+    return 0;
+  }
+  pthread_mutex_destroy( &endpoint->meta_lock );
   free(endpoint); endpoint = NULL;
 
   return 0;
@@ -477,6 +2635,46 @@ int hms_endpoint_destroy( hms_endpoint *endpoint ) {
 
 
 
+/* Reply templates */
+/* ---------------------------------------------------- */
+
+/* Header and body of msg in one buffer; msg is not needed afterwards */
+hms_reply_template* hms_reply_template_create( hms_msg *msg ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) msg);
+
+  hms_reply_template *tmpl = NULL;
+  const char *body = NULL; int body_len = 0;
+
+  int hdr_len = hms_msg_get_header_size( msg );
+  if( hdr_len == 0 ) { return NULL; }
+  hms_msg_peek_body( msg, &body, &body_len );
+
+  /* the bytes follow the template */
+  tmpl = malloc( sizeof(hms_reply_template) + hdr_len + body_len );
+  if( tmpl == NULL ) { return NULL; }
+  tmpl->data = (char *) (tmpl + 1);
+  tmpl->len = hdr_len + body_len;
+
+  hms_assert_equals( __FILE__, __LINE__, 0, hms_msg_print_header( msg, tmpl->data, hdr_len ) );
+  if( body ) { memcpy( tmpl->data + hdr_len, body, body_len ); }
+
+  return tmpl;
+
+} /* end hms_reply_template_create() */
+
+int hms_reply_template_destroy( hms_reply_template *tmpl ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__ , (uintptr_t) NULL, (uintptr_t) tmpl);
+
+  free( tmpl );
+
+  return 0;
+
+} /* end hms_reply_template_destroy() */
+
 /* Default function implementations */
 /* ---------------------------------------------------- */
 
@@ -490,41 +2688,58 @@ static int _hms_default_accepts( struct hms_endpoint *endpoint, hms_msg *msg ) {
 
 static int _hms_default_handle( struct hms_endpoint *endpoint, hms_msg *msg ) {
 
-  int erred = HMS_FALSE;
-  char *verb = NULL;
-  hms_msg *reply = hms_msg_create();
+  const char *verb = NULL; int verb_len = 0;
+  hms_verb *builtin = NULL;
 
   /* get the verb */
-  hms_msg_get_verb( msg, &verb );
-  
-  if( !verb ) {
-    hms_msg_set_verb(reply, "ERROR");
-    hms_endpoint_send_msg( endpoint, reply );
-    erred = HMS_TRUE;
-  } 
-  else if( strcasecmp(verb, "PING") == 0 ) {
-    hms_msg_set_verb(reply, "PONG");
-    hms_endpoint_send_msg( endpoint, reply );
-  }
-  else if( strcasecmp(verb, "INFO") == 0 ) {
-    hms_msg_set_verb(reply, "INFO");
-    /* return current time */
-    char time_buf[30]; time_t now; struct tm tm;
-    time( &now ); localtime_r( &now, &tm ); asctime_r( &tm, time_buf);
-    hms_msg_add_named_header( reply, "Localtime", time_buf );
-    hms_endpoint_send_msg( endpoint, reply );
-  }
-  else if( strcasecmp( verb, "BYE" ) == 0 ) {erred = HMS_TRUE;}
-  else { erred = HMS_TRUE; }
-
-
-  /* free verb */
-  if(verb) { free(verb); verb = NULL; }
-
-  /* free reply */
-  hms_msg_destroy( reply );
-  
-  return (erred == HMS_FALSE ) ? 0 : -1;
+  if( hms_msg_peek_verb( msg, &verb, &verb_len ) != 0 ) {
+    hms_endpoint_send_template( endpoint, &_hms_error_reply );
+    return -1;
+  }
+
+  /* one lookup; hermes_init() filled the table */
+  builtin = _hms_verb_find( &_hms_builtin_verbs, verb, verb_len );
+  if( !builtin ) { return -1; }
+
+  return builtin->ops.hms_handle( endpoint, msg );
 
 } /* end _hms_default_handle() */
 
+static int _hms_default_ping( hms_endpoint *endpoint, hms_msg *msg ) {
+  hms_endpoint_send_template( endpoint, &_hms_pong_reply );
+  return 0;
+} /* end _hms_default_ping() */
+
+static int _hms_default_info( hms_endpoint *endpoint, hms_msg *msg ) {
+  _hms_send_info( endpoint );
+  return 0;
+} /* end _hms_default_info() */
+
+static int _hms_default_bye( hms_endpoint *endpoint, hms_msg *msg ) {
+  return -1; /* close the connection */
+} /* end _hms_default_bye() */
+
+/* INFO reply with the current time, formatted in place */
+static int _hms_send_info( hms_endpoint *endpoint ) {
+
+  char reply[64];
+  struct iovec iov;
+
+  iov.iov_base = reply;
+  iov.iov_len = _hms_info_reply( reply, sizeof(reply) );
+
+  return _hms_endpoint_sendv( endpoint, &iov, 1 );
+
+} /* end _hms_send_info() */
+
+/* The INFO reply, with the local time; returns its length */
+static int _hms_info_reply( char *reply, int cap ) {
+
+  char time_buf[30]; time_t now; struct tm tm;
+
+  time( &now ); localtime_r( &now, &tm ); asctime_r( &tm, time_buf );
+  time_buf[ strcspn( time_buf, "\n" ) ] = '\0';
+
+  return snprintf( reply, cap, "INFO\nLocaltime:%s\n.\n", time_buf );
+
+} /* end _hms_info_reply() */
@@ -9,19 +9,78 @@
 
 #include <hermes.h>
 
+/* arena of a message built through the API; parsed messages are sized
+   from their header */
+#define HMS_MSG_ARENA_SIZE  256
+#define HMS_MSG_ARENA_ALIGN 8
+
+/* how many pooled messages a create looks at for one big enough */
+#define HMS_MSG_POOL_SCAN   4
+
+/* named headers a message holds before it builds a key index */
+#define HMS_MSG_INDEX_MIN   8
+
+/* A header node of either type */
+typedef union __hms_msg_view {
+  hms_msg_uheader uhdr;
+  hms_msg_nheader nhdr;
+} __hms_msg_view;
+
+/* A pooled message, reusing the memory of the message itself */
+typedef struct __hms_msg_free {
+  struct __hms_msg_free *next;
+  int arena_size;
+} __hms_msg_free;
+
+/* Destroyed messages kept by one thread, newest first */
+typedef struct __hms_msg_pool {
+  __hms_msg_free *free;
+  /* written by the owner only, read by any thread: __atomic on both sides */
+  hms_msg_pool_stats stats;
+  /* all live pools, for hms_msg_pool_get_stats() */
+  struct __hms_msg_pool *prev, *next;
+} __hms_msg_pool;
+
+static __thread __hms_msg_pool *__hms_pool = NULL;
+static pthread_key_t   __hms_pool_key;
+static pthread_once_t  __hms_pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t __hms_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static __hms_msg_pool *__hms_pools = NULL;
+static hms_msg_pool_stats __hms_pool_retired; /* counts of exited threads */
+/* process-wide, read by every thread that destroys a message */
+static int __hms_pool_limit = HERMES_MSG_POOL_BYTES;
 
 /* Function prototypes */
 /* -------------------------------------------------- */
-static hms_msg_uheader* __hms_create_header( char * value );
-static int              __hms_init_header( hms_msg_uheader *hdr, char *value );
+static hms_msg*         __hms_msg_alloc( int arena_size );
+static hms_msg*         __hms_msg_pool_get( int arena_size );
+static void             __hms_msg_pool_put( hms_msg *msg );
+static __hms_msg_pool*  __hms_msg_pool_self();
+static void             __hms_msg_pool_exit( void *arg );
+static void             __hms_msg_pool_init_key();
+static char*            __hms_msg_strdup( hms_msg *msg, char *str, int len, int *borrowed );
+static hms_msg_uheader* __hms_create_header( hms_msg *msg, char * value );
+static int              __hms_init_header( hms_msg *msg, hms_msg_uheader *hdr, char *value );
 static int              __hms_destroy_header( hms_msg_uheader *hdr );
 static int              __hms_deinit_header( hms_msg_uheader *hdr );
 
-static hms_msg_nheader* __hms_create_named_header( char *key, char *value );
-static int              __hms_init_named_header( hms_msg_nheader *hdr, char *key, char *value ); 
+static unsigned         __hms_key_hash( const char *key, int len );
+static int              __hms_msg_index_buckets( int nodes );
+static int              __hms_msg_index_build( hms_msg *msg, int buckets );
+static void             __hms_msg_index_drop( hms_msg *msg );
+static void             __hms_msg_index_add( hms_msg *msg, hms_msg_nheader *hdr );
+static void             __hms_msg_index_del( hms_msg *msg, hms_msg_nheader *hdr );
+static hms_msg_nheader* __hms_msg_find_named( hms_msg *msg, const char *key );
+static int              __hms_msg_link_named( hms_msg *msg, hms_msg_nheader *hdr );
+
+static hms_msg_nheader* __hms_create_named_header( hms_msg *msg, char *key, char *value );
+static int              __hms_init_named_header( hms_msg *msg, hms_msg_nheader *hdr, char *key, char *value ); 
 static int              __hms_destroy_named_header( hms_msg_nheader *hdr );
 static int              __hms_deinit_named_header( hms_msg_nheader *hdr );
 
+static int              __hms_msg_body_headers( hms_msg *msg );
+static void             __hms_msg_free_content( hms_msg *msg );
+
 /* Implementation */
 /* -------------------------------------------------- */
 
@@ -30,13 +89,28 @@ static int              __hms_deinit_named_header( hms_msg_nheader *hdr );
 
 hms_msg *hms_msg_create() {
 
-  /* malloc space */
-  hms_msg *msg = calloc( 1, sizeof(hms_msg) );
+  return __hms_msg_alloc( HMS_MSG_ARENA_SIZE );
+  
+} /* end hms_msg_create() */
+
+static hms_msg *__hms_msg_alloc( int arena_size ) {
+
+  /* a pooled message with a big enough arena, or malloc space; the
+     arena lives right after the message and is not cleared, everything
+     carved from it is filled in */
+  hms_msg *msg = __hms_msg_pool_get( arena_size );
+  if( msg ) { arena_size = ((__hms_msg_free *) msg)->arena_size; }
+  else { msg = malloc( sizeof(hms_msg) + arena_size ); }
   hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  memset( msg, 0, sizeof(hms_msg) );
   
   /* initialize verb */
   msg->id = NULL;
   msg->verb = NULL;
+  msg->verb_len = 0;
+
+  /* "\n" ending the verb line and ".\n" ending the header */
+  msg->hdr_size = 3;
   
   /* initialize headers/named headers */
   //__hms_init_header( &msg->headers, "" ); --buggy
@@ -50,45 +124,33 @@ hms_msg *hms_msg_create() {
   msg->content = NULL;
   msg->content_len = 0;
 
+  /* initialize views */
+  msg->flags = 0;
+  msg->buffer = NULL;
+
+  /* initialize arena */
+  msg->arena = (arena_size) ? (char *) (msg + 1) : NULL;
+  msg->arena_used = 0;
+  msg->arena_size = arena_size;
+
   return msg;
   
-} /* end hms_msg_create() */
+} /* end __hms_msg_alloc() */
 
 int hms_msg_get_header_size( hms_msg *msg ) {
 
-  int size = 0;
-  hms_msg_uheader *uhdr;
-  hms_msg_nheader *nhdr;
-
   /* Check input */
   hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
 
   /* if no verb then it is malformed so return 0 */
   if(!msg->verb) { return 0; }
-  
-  /* verb length */
-  if(msg->verb) { size += strlen( msg->verb ); }
-  /* header lengths */
-  hms_list_for_each_entry( uhdr, &msg->headers.lh, lh) {
-    size += 1 + strlen(uhdr->val);
-  }
-  /* end of line */
-  size += 1;
-
-  /* named headers */
-  /* 1 for ":" and 1 for "\n" */
-  hms_list_for_each_entry( nhdr, &msg->named_headers.lh, lh) {
-    size += strlen(nhdr->key) + 1 + strlen(nhdr->val) + 1;
-  }
-
-  /* end of msg hdr */
-  /* 1 for "." and 1 for "\n" */
-  size+= 2;
 
-  return size;
+  return msg->hdr_size;
 
 } /* end hms_msg_get_header_size() */
 
+/* One pass over the headers using their stored lengths; "len" must hold
+   hms_msg_get_header_size() bytes */
 int hms_msg_print_header( hms_msg *msg, char *buffer, int len) {
 
   /* Check input */
@@ -97,41 +159,32 @@ int hms_msg_print_header( hms_msg *msg, char *buffer, int len) {
 
   /* Make sure buffer is big enough */
   int hdr_len = hms_msg_get_header_size( msg );
+  if( hdr_len == 0 || len < hdr_len ) { return -1; }
   hms_msg_uheader *uhdr;
   hms_msg_nheader *nhdr;
 
   /* Copy into user buffer */
   char *offset = buffer;
-  
-  /* verb length */
-  if(msg->verb) {
-    int verb_len = strlen(msg->verb);
-    strncpy( offset , msg->verb, verb_len );
-    offset += verb_len;
-  }
-  /* header lengths */
+  /* verb */
+  memcpy( offset, msg->verb, msg->verb_len ); offset += msg->verb_len;
+  /* headers */
   hms_list_for_each_entry( uhdr, &msg->headers.lh, lh) {
-    int hdr_len = strlen(uhdr->val);
-    strncpy( offset, " ", 1); offset += 1;
-    strncpy( offset, uhdr->val, hdr_len ); offset += hdr_len;
+    *offset++ = ' ';
+    memcpy( offset, uhdr->val, uhdr->val_len ); offset += uhdr->val_len;
   }
   /* end of line */
-  strncpy( offset, "\n", 1); offset += 1;
+  *offset++ = '\n';
 
   /* named headers */
-  /* 1 for ":" and 1 for "\n" */
   hms_list_for_each_entry( nhdr, &msg->named_headers.lh, lh) {
-    int key_len = strlen(nhdr->key);
-    int val_len = strlen(nhdr->val);
-    strncpy( offset, nhdr->key, key_len); offset += key_len;
-    strncpy( offset, ":", 1); offset += 1;
-    strncpy( offset, nhdr->val, val_len); offset += val_len;
-    strncpy( offset, "\n", 1); offset += 1;
+    memcpy( offset, nhdr->key, nhdr->key_len ); offset += nhdr->key_len;
+    *offset++ = ':';
+    memcpy( offset, nhdr->val, nhdr->val_len ); offset += nhdr->val_len;
+    *offset++ = '\n';
   }
 
   /* end of msg hdr */
-  /* 1 for "." and 1 for "\n" */
-  strncpy( offset, ".\n", 2); offset += 2;
+  *offset++ = '.'; *offset++ = '\n';
 
   hms_assert_equals( __FILE__, __LINE__, (int) hdr_len, (int) (offset-buffer) );
 
@@ -146,12 +199,14 @@ int hms_msg_destroy( hms_msg *msg ) {
   
   /* Delete content */
   if( msg->content ) {
-    free(msg->content); msg->content = NULL; msg->content_len = 0;
+    __hms_msg_free_content( msg );
+    msg->content = NULL; msg->content_len = 0;
   }
 
   /*Delete verb */
   if( msg->verb ) {
-    free(msg->verb); msg->verb = NULL;
+    if( !(msg->flags & HMS_BORROWED_VERB) ) free(msg->verb);
+    msg->verb = NULL;
   }
 
   /* Delete headers */
@@ -176,8 +231,16 @@ int hms_msg_destroy( hms_msg *msg ) {
     hms_assert_equals( __FILE__, __LINE__, (int) 0, (int) msg->num_named_headers );
   }
 
-  /* Delete the message itself */
-  free( msg ); msg = NULL;
+  /* Delete the key index */
+  __hms_msg_index_drop( msg );
+
+  /* Delete the buffer the views pointed into */
+  if( msg->buffer ) {
+    free( msg->buffer ); msg->buffer = NULL;
+  }
+
+  /* Delete the message itself (and its arena), or keep it for reuse */
+  __hms_msg_pool_put( msg ); msg = NULL;
 
   return 0;
 
@@ -193,12 +256,20 @@ int hms_msg_set_verb(hms_msg *msg, char *verb ) {
   hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) verb );
 
   /* replaces existing verb */
-  if( msg->verb ) { free( msg->verb ); msg->verb = NULL;}
+  if( msg->verb ) {
+    if( !(msg->flags & HMS_BORROWED_VERB) ) free( msg->verb );
+    msg->verb = NULL; msg->flags &= ~HMS_BORROWED_VERB;
+    msg->hdr_size -= msg->verb_len;
+  }
   hms_assert_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg->verb );
 
   /* add new verb */
-  msg->verb = strdup( verb );
+  int borrowed;
+  msg->verb_len = strlen( verb );
+  msg->verb = __hms_msg_strdup( msg, verb, msg->verb_len, &borrowed );
   hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg->verb );
+  msg->hdr_size += msg->verb_len;
+  if( borrowed ) { msg->flags |= HMS_BORROWED_VERB; }
 
   return 0;
 
@@ -219,6 +290,24 @@ int hms_msg_get_verb(hms_msg *msg, char **verb ) {
 
 } /* end hms_msg_get_verb() */
 
+/**
+ * The peek accessors hand out the message's own storage instead of a
+ * copy: strings are NUL-terminated and stay valid until the message is
+ * changed or destroyed. "len" may be NULL.
+ **/
+int hms_msg_peek_verb( hms_msg *msg, const char **verb, int *len ) {
+
+  /* Check inputs */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) verb );
+
+  *verb = msg->verb;
+  if( len ) { *len = (msg->verb) ? msg->verb_len : 0; }
+
+  return (msg->verb) ? 0 : -1;
+
+} /* end hms_msg_peek_verb() */
+
 /* Headers */
 /* -------------------------------------------------- */
 
@@ -229,11 +318,12 @@ int hms_msg_add_header(hms_msg *msg, char *value ) {
   hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) value );
 
   /* create header */
-  hms_msg_uheader *hdr = __hms_create_header( value );
+  hms_msg_uheader *hdr = __hms_create_header( msg, value );
   
   /* add to list */
   hms_list_add_tail( &hdr->lh, &msg->headers.lh );
   msg->num_headers++;
+  msg->hdr_size += 1 + hdr->val_len;
   return 0;
 
 } /* end hms_msg_add_header() */
@@ -260,6 +350,31 @@ int hms_msg_get_header(hms_msg *msg, int index , char **value) {
 
 } /* end hms_msg_get_header() */
 
+int hms_msg_peek_header( hms_msg *msg, int index, const char **value, int *len ) {
+
+  /* Check inputs */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) value );
+
+  /* index must be in bounds */
+  if( msg->num_headers <= 0 || index < 0 || index >= msg->num_headers ) {
+    *value = NULL; if( len ) { *len = 0; }
+    return -1;
+  }
+
+  /* find the entry */
+  int i = 0;
+  hms_msg_uheader *hdr = NULL;
+  hms_list_for_each_entry( hdr, &msg->headers.lh, lh) {
+    if(i++ == index) break;
+  }
+
+  *value = hdr->val;
+  if( len ) { *len = hdr->val_len; }
+  return 0;
+
+} /* end hms_msg_peek_header() */
+
 
 int hms_msg_del_header(hms_msg *msg, int index ) {
 
@@ -277,6 +392,7 @@ int hms_msg_del_header(hms_msg *msg, int index ) {
   hms_list_for_each_entry_safe(hdr, tmp, &msg->headers.lh, lh) {
     if( i++ == index) {
       hms_list_del( &hdr->lh );
+      msg->hdr_size -= 1 + hdr->val_len;
       __hms_destroy_header( hdr );
       msg->num_headers--;
       break;
@@ -310,14 +426,11 @@ int hms_msg_add_named_header( hms_msg *msg, char *key, char *value ) {
   hms_msg_del_named_header( msg, key );
 
   /* Malloc space for header */
-  hms_msg_nheader *hdr = __hms_create_named_header( key, value );
+  hms_msg_nheader *hdr = __hms_create_named_header( msg, key, value );
   hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) hdr );
   
-  /* Add to list */
-  hms_list_add_tail( &hdr->lh, &msg->named_headers.lh);
-  msg->num_named_headers++;
-
-  return 0;
+  /* Add to list and index */
+  return __hms_msg_link_named( msg, hdr );
 
 } /* end hms_msg_add_named_header() */
 
@@ -328,14 +441,10 @@ int hms_msg_get_named_header( hms_msg *msg, char *key, char **value ) {
   hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) key );
 
   /* Search through the headers */
-  hms_msg_nheader *hdr = NULL;
-  unsigned found = HMS_FALSE;
-  hms_list_for_each_entry( hdr, &msg->named_headers.lh, lh) {
-    if(strcasecmp( hdr->key, key) == 0) { found = HMS_TRUE; break; }
-  }
+  hms_msg_nheader *hdr = __hms_msg_find_named( msg, key );
 
   /* Return value */
-  if(found && hdr) {
+  if(hdr) {
     *value = strdup( hdr->val );
     return 0;
   }
@@ -346,6 +455,21 @@ int hms_msg_get_named_header( hms_msg *msg, char *key, char **value ) {
 
 } /* end hms_msg_get_named_header() */
 
+int hms_msg_peek_named_header( hms_msg *msg, const char *key, const char **value, int *len ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) key );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) value );
+
+  hms_msg_nheader *hdr = __hms_msg_find_named( msg, key );
+  *value = (hdr) ? hdr->val : NULL;
+  if( len ) { *len = (hdr) ? hdr->val_len : 0; }
+
+  return (hdr) ? 0 : -1;
+
+} /* end hms_msg_peek_named_header() */
+
 int hms_msg_del_named_header( hms_msg *msg, char *key ) {
 
   /* Check inputs */
@@ -353,14 +477,13 @@ int hms_msg_del_named_header( hms_msg *msg, char *key ) {
   hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) key );
 
   /* Delete the header */
-  hms_msg_nheader *hdr = NULL, *tmp;
-  hms_list_for_each_entry_safe(hdr, tmp, &msg->named_headers.lh, lh) {
-    if( strcasecmp(hdr->key, key) == 0) {
-      hms_list_del( &hdr->lh );
-      __hms_destroy_named_header( hdr );
-      msg->num_named_headers--;
-      break;
-    }
+  hms_msg_nheader *hdr = __hms_msg_find_named( msg, key );
+  if( hdr ) {
+    hms_list_del( &hdr->lh );
+    __hms_msg_index_del( msg, hdr );
+    msg->hdr_size -= hdr->key_len + 1 + hdr->val_len + 1;
+    __hms_destroy_named_header( hdr );
+    msg->num_named_headers--;
   }
 
   return 0;
@@ -385,12 +508,9 @@ int hms_msg_get_body_size( hms_msg *msg ) {
   hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
   
   /* Get Content-Length */
-  unsigned content_len = 0;
-  char *value;
-  if( 0 == hms_msg_get_named_header( msg, HMS_CONTENT_LENGTH, &value ) ) {
-    content_len = atoi( value );
-    free( value );
-    hms_assert_equals( __FILE__, __LINE__, (int) msg->content_len, (int) content_len );
+  hms_msg_nheader *hdr = __hms_msg_find_named( msg, HMS_CONTENT_LENGTH );
+  if( hdr ) {
+    hms_assert_equals( __FILE__, __LINE__, (int) msg->content_len, (int) atoi( hdr->val ) );
     return msg->content_len;
   }
 
@@ -410,14 +530,10 @@ int hms_msg_get_body( hms_msg *msg, char **data, int *len) {
   /* Check if content exists  */
   if( msg->content ) {
 
-    char *value;
-
     /* make sure named header matches actual length */
-    int ret = hms_msg_get_named_header( msg, HMS_CONTENT_LENGTH, &value );
-    hms_assert_equals( __FILE__, __LINE__, (int) 0, (int) ret );
-    unsigned content_len = atoi( value );
-    free( value );
-    hms_assert_equals( __FILE__, __LINE__, (int) msg->content_len, (int) content_len );
+    hms_msg_nheader *hdr = __hms_msg_find_named( msg, HMS_CONTENT_LENGTH );
+    hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) hdr );
+    hms_assert_equals( __FILE__, __LINE__, (int) msg->content_len, (int) atoi( hdr->val ) );
 
     /* copy to user */
     *data = ( char *) malloc( msg->content_len );
@@ -436,6 +552,20 @@ int hms_msg_get_body( hms_msg *msg, char **data, int *len) {
 
 } /* end hms_msg_get_body() */
 
+/* The body is not NUL-terminated; NULL if there is none in the message */
+int hms_msg_peek_body( hms_msg *msg, const char **data, int *len ) {
+
+  /* Check inputs */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) data );
+
+  *data = msg->content;
+  if( len ) { *len = (msg->content) ? msg->content_len : 0; }
+
+  return 0;
+
+} /* end hms_msg_peek_body() */
+
 int hms_msg_set_body( hms_msg *msg, char *data, int len ) {
 
   /* Check inputs */
@@ -451,15 +581,335 @@ int hms_msg_set_body( hms_msg *msg, char *data, int len ) {
   hms_assert_equals( __FILE__, __LINE__, (int) 0, (int) msg->content_len );
 
   /* Copy the data in and also add named header */
-  msg->content = ( char * ) malloc( len );
+  msg->content = ( char * ) hms_msg_arena_alloc( msg, len );
+  if( msg->content ) { msg->flags |= HMS_BORROWED_BODY; }
+  else { msg->content = ( char * ) malloc( len ); }
   hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg->content );
   memcpy( msg->content, data, len );
   msg->content_len = len;
 
+  /* named headers */
+  return __hms_msg_body_headers( msg );
+
+} /* end hms_msg_set_body() */
+
+/* The message owns "data" from now on and never copies it; free_fn(arg,
+   data, len) releases it with the message, free() if free_fn is NULL */
+int hms_msg_take_body( hms_msg *msg, char *data, int len,
+		       hms_body_free free_fn, void *arg ) {
+
+  /* Check inputs */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) data );
+  hms_assert_not_equals( __FILE__, __LINE__, (int) 0, (int) len );
+
+  /* Delete old content */
+  hms_msg_del_body( msg );
+  hms_assert_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg->content );
+
+  msg->content = data;
+  msg->content_len = len;
+  msg->content_free = free_fn;
+  msg->content_free_arg = arg;
+
+  /* named headers */
+  return __hms_msg_body_headers( msg );
+
+} /* end hms_msg_take_body() */
+
+/* Hands the body out of the message, which is left without one. The caller
+   frees *data with *free_fn(*arg, *data, *len), or free() if that is NULL.
+   A body the message does not own alone (a view or in the arena) is copied,
+   as is one with a free callback when free_fn is NULL */
+int hms_msg_release_body( hms_msg *msg, char **data, int *len,
+			  hms_body_free *free_fn, void **arg ) {
+
+  /* Check inputs */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) data );
+
+  *data = NULL;
+  if( len ) { *len = 0; }
+  if( free_fn ) { *free_fn = NULL; }
+  if( arg ) { *arg = NULL; }
+
+  if( !msg->content ) { return 0; }
+
+  if( (msg->flags & HMS_BORROWED_BODY) || (msg->content_free && !free_fn) ) {
+
+    /* copy; hms_msg_del_body() frees the original */
+    *data = ( char * ) malloc( msg->content_len );
+    if( *data == NULL ) { return -1; }
+    memcpy( *data, msg->content, msg->content_len );
+
+  } else {
+
+    /* move */
+    *data = msg->content;
+    if( free_fn ) { *free_fn = msg->content_free; }
+    if( arg ) { *arg = msg->content_free_arg; }
+    msg->flags |= HMS_BORROWED_BODY;
+    msg->content_free = NULL; msg->content_free_arg = NULL;
+
+  }
+  if( len ) { *len = msg->content_len; }
+
+  /* remove content and its named headers */
+  return hms_msg_del_body( msg );
+
+} /* end hms_msg_release_body() */
+
+int hms_msg_del_body( hms_msg *msg ) {
+
+  /* Check inputs */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+
+  if( msg->content || (msg->flags & (HMS_BODY_PENDING | HMS_BODY_STREAMED)) ) {
+
+    /* free old content */
+    if( msg->content ) { __hms_msg_free_content( msg ); }
+    msg->flags &= ~(HMS_BORROWED_BODY | HMS_BODY_PENDING | HMS_BODY_STREAMED);
+
+    /* make sure named header matches actual length */
+    hms_msg_nheader *hdr = __hms_msg_find_named( msg, HMS_CONTENT_LENGTH );
+    hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) hdr );
+    hms_assert_equals( __FILE__, __LINE__, (int) msg->content_len, (int) atoi( hdr->val ) );
+
+    /* remove named header */
+    int ret = hms_msg_del_named_header( msg, HMS_CONTENT_LENGTH );
+    hms_assert_equals( __FILE__, __LINE__, (int) 0, (int) ret );
+    ret = hms_msg_del_named_header( msg, HMS_CONTENT_CHECKSUM );
+    hms_assert_equals( __FILE__, __LINE__, (int) 0, (int) ret );
+
+    msg->content = NULL;
+    msg->content_len = 0;
+
+  }
+  
+  return 0;
+
+} /* end hms_msg_del_body() */
+
+/* Message arena */
+/* -------------------------------------------------- */
+
+/* A message whose arena holds "arena_size" bytes; see hms_msg_arena_size() */
+hms_msg *hms_msg_create_arena( int arena_size ) {
+
+  return __hms_msg_alloc( arena_size );
+
+} /* end hms_msg_create_arena() */
+
+/* Arena bytes for "nodes" header nodes plus "bytes" more in "allocs" pieces */
+int hms_msg_arena_size( int nodes, int allocs, int bytes ) {
+
+  int node_size = (sizeof(__hms_msg_view) + HMS_MSG_ARENA_ALIGN - 1) & ~(HMS_MSG_ARENA_ALIGN - 1);
+  int index_size = ( nodes >= HMS_MSG_INDEX_MIN ) ?
+    __hms_msg_index_buckets( nodes ) * sizeof(hms_msg_nheader *) + HMS_MSG_ARENA_ALIGN : 0;
+
+  return nodes * node_size + index_size + allocs * (HMS_MSG_ARENA_ALIGN - 1) + bytes;
+
+} /* end hms_msg_arena_size() */
+
+/**
+ * Carves "size" bytes from the arena. Returns NULL once it is full;
+ * callers then fall back to malloc and leave the BORROWED flag unset.
+ **/
+void *hms_msg_arena_alloc( hms_msg *msg, int size ) {
+
+  int used = (msg->arena_used + HMS_MSG_ARENA_ALIGN - 1) & ~(HMS_MSG_ARENA_ALIGN - 1);
+  if( used + size > msg->arena_size ) { return NULL; }
+
+  msg->arena_used = used + size;
+  return msg->arena + used;
+
+} /* end hms_msg_arena_alloc() */
+
+/* Builds the key index up front for a message that will hold up to
+   "nodes" headers; hms_msg_arena_size() counted its room */
+int hms_msg_index_reserve( hms_msg *msg, int nodes ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+
+  if( nodes < HMS_MSG_INDEX_MIN || msg->index_size >= nodes ) { return 0; }
+
+  return __hms_msg_index_build( msg, __hms_msg_index_buckets( nodes ) );
+
+} /* end hms_msg_index_reserve() */
+
+/* Message pool */
+/* -------------------------------------------------- */
+
+/* Caps the bytes each thread keeps; 0 frees messages on destroy. One
+   limit for the whole process: the last call wins, for every thread
+   and every manager */
+void hms_msg_pool_set_limit( int max_bytes ) {
+
+  __atomic_store_n( &__hms_pool_limit, (max_bytes > 0) ? max_bytes : 0, __ATOMIC_RELAXED );
+
+} /* end hms_msg_pool_set_limit() */
+
+int hms_msg_pool_get_limit( void ) {
+
+  return __atomic_load_n( &__hms_pool_limit, __ATOMIC_RELAXED );
+
+} /* end hms_msg_pool_get_limit() */
+
+void hms_msg_pool_get_stats( hms_msg_pool_stats *stats ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) stats );
+
+  /* the lock keeps the list; counters of live threads are read
+     without their owners stopping */
+  pthread_mutex_lock( &__hms_pool_lock );
+  *stats = __hms_pool_retired;
+  __hms_msg_pool *pool;
+  for( pool = __hms_pools; pool; pool = pool->next ) {
+    stats->hits += __atomic_load_n( &pool->stats.hits, __ATOMIC_RELAXED );
+    stats->misses += __atomic_load_n( &pool->stats.misses, __ATOMIC_RELAXED );
+    stats->recycled += __atomic_load_n( &pool->stats.recycled, __ATOMIC_RELAXED );
+    stats->dropped += __atomic_load_n( &pool->stats.dropped, __ATOMIC_RELAXED );
+    stats->bytes += __atomic_load_n( &pool->stats.bytes, __ATOMIC_RELAXED );
+  }
+  pthread_mutex_unlock( &__hms_pool_lock );
+
+} /* end hms_msg_pool_get_stats() */
+
+/* Zero-copy parsing */
+/* -------------------------------------------------- */
+
+/**
+ * A view message points into a buffer it owns instead of holding
+ * its own copies. Strings must be NUL-terminated in that buffer.
+ **/
+
+int hms_msg_own_buffer( hms_msg *msg, char *buffer ) {
+
+  /* Check inputs */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  hms_assert_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg->buffer );
+
+  msg->buffer = buffer;
+  return 0;
+
+} /* end hms_msg_own_buffer() */
+
+int hms_msg_view_verb( hms_msg *msg, char *verb, int len ) {
+
+  /* Check inputs */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) verb );
+
+  /* replaces existing verb */
+  if( msg->verb && !(msg->flags & HMS_BORROWED_VERB) ) { free( msg->verb ); }
+  if( msg->verb ) { msg->hdr_size -= msg->verb_len; }
+
+  msg->verb = verb;
+  msg->verb_len = len;
+  msg->hdr_size += len;
+  msg->flags |= HMS_BORROWED_VERB;
+
+  return 0;
+
+} /* end hms_msg_view_verb() */
+
+int hms_msg_view_header( hms_msg *msg, char *value, int len ) {
+
+  /* Check inputs */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) value );
+
+  /* node from the message when possible */
+  hms_msg_uheader *hdr = hms_msg_arena_alloc( msg, sizeof(hms_msg_uheader) );
+  if( hdr ) { hdr->flags = HMS_BORROWED_STR | HMS_BORROWED_NODE; }
+  else {
+    hdr = calloc( 1, sizeof(hms_msg_uheader) );
+    hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) hdr );
+    hdr->flags = HMS_BORROWED_STR;
+  }
+  hdr->val = value;
+  hdr->val_len = len;
+
+  /* add to list */
+  hms_list_add_tail( &hdr->lh, &msg->headers.lh );
+  msg->num_headers++;
+  msg->hdr_size += 1 + len;
+
+  return 0;
+
+} /* end hms_msg_view_header() */
+
+int hms_msg_view_named_header( hms_msg *msg, char *key, int key_len, char *value, int val_len ) {
+
+  /* Check inputs */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) key );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) value );
+
+  /* Delete old value if it exists */
+  hms_msg_del_named_header( msg, key );
+
+  /* node from the message when possible */
+  hms_msg_nheader *hdr = hms_msg_arena_alloc( msg, sizeof(hms_msg_nheader) );
+  if( hdr ) { hdr->flags = HMS_BORROWED_STR | HMS_BORROWED_NODE; }
+  else {
+    hdr = calloc( 1, sizeof(hms_msg_nheader) );
+    hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) hdr );
+    hdr->flags = HMS_BORROWED_STR;
+  }
+  hdr->key = key;
+  hdr->key_len = key_len;
+  hdr->val = value;
+  hdr->val_len = val_len;
+
+  /* Add to list and index */
+  return __hms_msg_link_named( msg, hdr );
+
+} /* end hms_msg_view_named_header() */
+
+int hms_msg_view_body( hms_msg *msg, char *data, int len, int borrowed ) {
+
+  /* Check inputs */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) data );
+  hms_assert_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg->content );
+
+  /* Content-Length came with the parsed headers */
+  msg->content = data;
+  msg->content_len = len;
+  msg->flags &= ~HMS_BODY_PENDING;
+  if( borrowed ) { msg->flags |= HMS_BORROWED_BODY; }
+
+  return 0;
+
+} /* end hms_msg_view_body() */
+
+/* Content-Length came with the parsed headers, the bytes come later */
+int hms_msg_pend_body( hms_msg *msg, int len ) {
+
+  /* Check inputs */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  hms_assert_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg->content );
+
+  msg->content_len = len;
+  msg->flags |= HMS_BODY_PENDING;
+
+  return 0;
+
+} /* end hms_msg_pend_body() */
+
+/* Helper Functions */
+/* -------------------------------------------------- */
+
+/* Content-Length (and checksum) for the content just set */
+static int __hms_msg_body_headers( hms_msg *msg ) {
+
   /* named header */
   {
     char value[256];
-    sprintf( value, "%d", len );
+    sprintf( value, "%d", msg->content_len );
     hms_assert_equals( __FILE__, __LINE__, (int) 0, 
 		       hms_msg_add_named_header( msg, HMS_CONTENT_LENGTH, value ) 
 		       );
@@ -479,69 +929,299 @@ int hms_msg_set_body( hms_msg *msg, char *data, int len ) {
 
   return 0;
 
-} /* end hms_msg_set_body() */
+} /* end __hms_msg_body_headers() */
 
-int hms_msg_del_body( hms_msg *msg ) {
+/* Frees content the message owns, through its free callback if it has one */
+static void __hms_msg_free_content( hms_msg *msg ) {
 
-  /* Check inputs */
-  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  if( !(msg->flags & HMS_BORROWED_BODY) ) {
+    if( msg->content_free ) {
+      msg->content_free( msg->content_free_arg, msg->content, msg->content_len );
+    } else {
+      free( msg->content );
+    }
+  }
+  msg->content_free = NULL; msg->content_free_arg = NULL;
 
-  if( msg->content ) {
+} /* end __hms_msg_free_content() */
 
-    char *value;
+static void __hms_msg_pool_init_key() {
 
-    /* free old content */
-    free( msg->content );
+  pthread_key_create( &__hms_pool_key, __hms_msg_pool_exit );
 
-    /* make sure named header matches actual length */
-    int ret = hms_msg_get_named_header( msg, HMS_CONTENT_LENGTH, &value );
-    hms_assert_equals( __FILE__, __LINE__, (int) 0, (int) ret );
-    unsigned content_len = atoi( value );
-    free( value );
-    hms_assert_equals( __FILE__, __LINE__, (int) msg->content_len, (int) content_len );
+} /* end __hms_msg_pool_init_key() */
 
-    /* remove named header */
-    ret = hms_msg_del_named_header( msg, HMS_CONTENT_LENGTH );
-    hms_assert_equals( __FILE__, __LINE__, (int) 0, (int) ret );
-    ret = hms_msg_del_named_header( msg, HMS_CONTENT_CHECKSUM );
-    hms_assert_equals( __FILE__, __LINE__, (int) 0, (int) ret );
+/* The calling thread's pool, created on first use; NULL if that fails */
+static __hms_msg_pool *__hms_msg_pool_self() {
 
-    msg->content = NULL;
-    msg->content_len = 0;
+  if( __hms_pool ) { return __hms_pool; }
 
+  __hms_msg_pool *pool = calloc( 1, sizeof(__hms_msg_pool) );
+  if( !pool ) { return NULL; }
+
+  /* freed by __hms_msg_pool_exit() when the thread ends */
+  pthread_once( &__hms_pool_once, __hms_msg_pool_init_key );
+  if( pthread_setspecific( __hms_pool_key, pool ) != 0 ) { free( pool ); return NULL; }
+
+  pthread_mutex_lock( &__hms_pool_lock );
+  pool->next = __hms_pools;
+  if( __hms_pools ) { __hms_pools->prev = pool; }
+  __hms_pools = pool;
+  pthread_mutex_unlock( &__hms_pool_lock );
+
+  __hms_pool = pool;
+  return pool;
+
+} /* end __hms_msg_pool_self() */
+
+static void __hms_msg_pool_exit( void *arg ) {
+
+  __hms_msg_pool *pool = (__hms_msg_pool *) arg;
+
+  /* free the pooled messages */
+  while( pool->free ) {
+    __hms_msg_free *f = pool->free;
+    pool->free = f->next;
+    free( f );
+  }
+  __atomic_store_n( &pool->stats.bytes, 0, __ATOMIC_RELAXED );
+
+  /* keep the counts */
+  pthread_mutex_lock( &__hms_pool_lock );
+  if( pool->prev ) { pool->prev->next = pool->next; }
+  else { __hms_pools = pool->next; }
+  if( pool->next ) { pool->next->prev = pool->prev; }
+  __hms_pool_retired.hits += pool->stats.hits;
+  __hms_pool_retired.misses += pool->stats.misses;
+  __hms_pool_retired.recycled += pool->stats.recycled;
+  __hms_pool_retired.dropped += pool->stats.dropped;
+  pthread_mutex_unlock( &__hms_pool_lock );
+
+  __hms_pool = NULL;
+  free( pool );
+
+} /* end __hms_msg_pool_exit() */
+
+/* Newest pooled message whose arena holds at least "arena_size" bytes */
+static hms_msg *__hms_msg_pool_get( int arena_size ) {
+
+  __hms_msg_pool *pool = __hms_msg_pool_self();
+  if( !pool ) { return NULL; }
+
+  int i;
+  __hms_msg_free **prev = &pool->free;
+  for( i = 0; *prev && i < HMS_MSG_POOL_SCAN; i++, prev = &(*prev)->next ) {
+    __hms_msg_free *f = *prev;
+    if( f->arena_size >= arena_size ) {
+      *prev = f->next;
+      __atomic_sub_fetch( &pool->stats.bytes, sizeof(hms_msg) + f->arena_size, __ATOMIC_RELAXED );
+      __atomic_add_fetch( &pool->stats.hits, 1, __ATOMIC_RELAXED );
+      return (hms_msg *) f;
+    }
   }
-  
-  return 0;
 
-} /* end hms_msg_del_body() */
+  __atomic_add_fetch( &pool->stats.misses, 1, __ATOMIC_RELAXED );
+  return NULL;
 
-/* Helper Functions */
+} /* end __hms_msg_pool_get() */
+
+static void __hms_msg_pool_put( hms_msg *msg ) {
+
+  __hms_msg_pool *pool = __hms_msg_pool_self();
+  long size = sizeof(hms_msg) + msg->arena_size;
+
+  if( !pool || __atomic_load_n( &pool->stats.bytes, __ATOMIC_RELAXED ) + size >
+      __atomic_load_n( &__hms_pool_limit, __ATOMIC_RELAXED ) ) {
+    if( pool ) { __atomic_add_fetch( &pool->stats.dropped, 1, __ATOMIC_RELAXED ); }
+    free( msg );
+    return;
+  }
+
+  /* keeps its arena for the next create */
+  int arena_size = msg->arena_size;
+  __hms_msg_free *f = (__hms_msg_free *) msg;
+  f->arena_size = arena_size;
+  f->next = pool->free;
+  pool->free = f;
+  __atomic_add_fetch( &pool->stats.bytes, size, __ATOMIC_RELAXED );
+  __atomic_add_fetch( &pool->stats.recycled, 1, __ATOMIC_RELAXED );
+
+} /* end __hms_msg_pool_put() */
+
+/* Key index */
 /* -------------------------------------------------- */
 
-static hms_msg_uheader* __hms_create_header( char * value ) {
+/* FNV-1a over the case-folded key */
+static unsigned __hms_key_hash( const char *key, int len ) {
+
+  unsigned hash = 2166136261u;
+  int i;
+  for( i = 0; i < len; i++ ) {
+    unsigned char c = (unsigned char) key[i];
+    if( c >= 'A' && c <= 'Z' ) { c += 'a' - 'A'; }
+    hash = (hash ^ c) * 16777619u;
+  }
+
+  return hash;
+
+} /* end __hms_key_hash() */
+
+static int __hms_msg_index_buckets( int nodes ) {
+
+  int buckets = HMS_MSG_INDEX_MIN;
+  while( buckets < nodes ) { buckets *= 2; }
+
+  return buckets;
+
+} /* end __hms_msg_index_buckets() */
+
+/* (Re)builds the index with "buckets" chains over every named header */
+static int __hms_msg_index_build( hms_msg *msg, int buckets ) {
+
+  int size = buckets * sizeof(hms_msg_nheader *);
+  int borrowed = HMS_TRUE;
+  hms_msg_nheader **index = hms_msg_arena_alloc( msg, size );
+  if( !index ) { index = malloc( size ); borrowed = HMS_FALSE; }
+  if( !index ) { return -1; }
+  memset( index, 0, size );
+
+  if( msg->index && !(msg->flags & HMS_BORROWED_INDEX) ) { free( msg->index ); }
+  msg->index = index;
+  msg->index_size = buckets;
+  if( borrowed ) { msg->flags |= HMS_BORROWED_INDEX; }
+  else { msg->flags &= ~HMS_BORROWED_INDEX; }
+
+  hms_msg_nheader *hdr;
+  hms_list_for_each_entry( hdr, &msg->named_headers.lh, lh ) {
+    hms_msg_nheader **bucket = &msg->index[hdr->hash & (buckets - 1)];
+    hdr->hnext = *bucket;
+    *bucket = hdr;
+  }
+
+  return 0;
+
+} /* end __hms_msg_index_build() */
+
+/* No index: lookups walk the list until one is built again */
+static void __hms_msg_index_drop( hms_msg *msg ) {
+
+  if( msg->index && !(msg->flags & HMS_BORROWED_INDEX) ) { free( msg->index ); }
+  msg->index = NULL; msg->index_size = 0;
+  msg->flags &= ~HMS_BORROWED_INDEX;
+
+} /* end __hms_msg_index_drop() */
+
+static void __hms_msg_index_add( hms_msg *msg, hms_msg_nheader *hdr ) {
+
+  /* no index yet, or one about to run past one header per bucket; the
+     old one misses hdr, so it goes if a new one cannot be had */
+  if( msg->num_named_headers > msg->index_size ) {
+    if( msg->num_named_headers >= HMS_MSG_INDEX_MIN &&
+	__hms_msg_index_build( msg, __hms_msg_index_buckets( 2 * msg->num_named_headers ) ) != 0 ) {
+      __hms_msg_index_drop( msg );
+    }
+    return;
+  }
+
+  hms_msg_nheader **bucket = &msg->index[hdr->hash & (msg->index_size - 1)];
+  hdr->hnext = *bucket;
+  *bucket = hdr;
+
+} /* end __hms_msg_index_add() */
+
+static void __hms_msg_index_del( hms_msg *msg, hms_msg_nheader *hdr ) {
+
+  if( !msg->index ) { return; }
+
+  hms_msg_nheader **p = &msg->index[hdr->hash & (msg->index_size - 1)];
+  while( *p && *p != hdr ) { p = &(*p)->hnext; }
+  if( *p ) { *p = hdr->hnext; }
+
+} /* end __hms_msg_index_del() */
+
+/* Named header by key, any case: the index when built, else the list */
+static hms_msg_nheader *__hms_msg_find_named( hms_msg *msg, const char *key ) {
+
+  int len = strlen( key );
+  unsigned hash = __hms_key_hash( key, len );
+  hms_msg_nheader *hdr;
+
+  if( msg->index ) {
+    for( hdr = msg->index[hash & (msg->index_size - 1)]; hdr; hdr = hdr->hnext ) {
+      if( hdr->hash == hash && hdr->key_len == len && strncasecmp( hdr->key, key, len ) == 0 ) { return hdr; }
+    }
+    return NULL;
+  }
+
+  hms_list_for_each_entry( hdr, &msg->named_headers.lh, lh ) {
+    if( hdr->hash == hash && hdr->key_len == len && strncasecmp( hdr->key, key, len ) == 0 ) { return hdr; }
+  }
+
+  return NULL;
+
+} /* end __hms_msg_find_named() */
+
+/* Appends a new named header; its key is hashed here, once */
+static int __hms_msg_link_named( hms_msg *msg, hms_msg_nheader *hdr ) {
+
+  hdr->hash = __hms_key_hash( hdr->key, hdr->key_len );
+  hdr->hnext = NULL;
+
+  hms_list_add_tail( &hdr->lh, &msg->named_headers.lh );
+  msg->num_named_headers++;
+  msg->hdr_size += hdr->key_len + 1 + hdr->val_len + 1;
+  __hms_msg_index_add( msg, hdr );
+
+  return 0;
+
+} /* end __hms_msg_link_named() */
+
+/* A NUL-terminated copy in the arena, or on the heap once it is full */
+static char *__hms_msg_strdup( hms_msg *msg, char *str, int len, int *borrowed ) {
+
+  char *copy = hms_msg_arena_alloc( msg, len + 1 );
+  *borrowed = (copy != NULL);
+  if( !copy ) { copy = malloc( len + 1 ); }
+  if( !copy ) { return NULL; }
+
+  memcpy( copy, str, len );
+  copy[len] = '\0';
+
+  return copy;
+
+} /* end __hms_msg_strdup() */
+
+static hms_msg_uheader* __hms_create_header( hms_msg *msg, char * value ) {
 
   /* Check input */
   hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) NULL, (uintptr_t) value );  
 
-  /* malloc space */
-  hms_msg_uheader *hdr = calloc( 1, sizeof(hms_msg_uheader) );
+  /* space from the arena when possible */
+  unsigned node_flags = HMS_BORROWED_NODE;
+  hms_msg_uheader *hdr = hms_msg_arena_alloc( msg, sizeof(hms_msg_uheader) );
+  if( !hdr ) { hdr = calloc( 1, sizeof(hms_msg_uheader) ); node_flags = 0; }
   hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) NULL, (uintptr_t) hdr );
 
   /* initialize it */
-  __hms_init_header( hdr, value );
+  __hms_init_header( msg, hdr, value );
+  hdr->flags |= node_flags;
 
   return hdr;
 
 } /* end __hms_create_header() */
 
-static int __hms_init_header( hms_msg_uheader *hdr, char *value ) {
+static int __hms_init_header( hms_msg *msg, hms_msg_uheader *hdr, char *value ) {
 
   /* Check input */
   hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) 0, (uintptr_t) hdr );  
   hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) 0, (uintptr_t) value );  
 
   /* set the values */
-  hdr->val = strdup( value );
+  int borrowed;
+  hdr->val_len = strlen( value );
+  hdr->val = __hms_msg_strdup( msg, value, hdr->val_len, &borrowed );
+  hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) NULL, (uintptr_t) hdr->val );
+  hdr->flags = (borrowed) ? HMS_BORROWED_STR : 0;
   HMS_INIT_LIST_HEAD( &hdr->lh );
 
   return 0;
@@ -554,7 +1234,7 @@ static int __hms_deinit_header( hms_msg_uheader *hdr ) {
   hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) NULL, (uintptr_t) hdr );  
   hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) NULL, (uintptr_t) hdr->val );  
   
-  free( hdr->val );
+  if( !(hdr->flags & HMS_BORROWED_STR) ) free( hdr->val );
 
   return 0;
 
@@ -571,40 +1251,57 @@ static int __hms_destroy_header( hms_msg_uheader *hdr ) {
   __hms_deinit_header( hdr );
   
   /* free hdr itself */
-  free( hdr );
+  if( !(hdr->flags & HMS_BORROWED_NODE) ) free( hdr );
 
   return 0;
 
 } /* end __hms_destroy_header() */
 
-static hms_msg_nheader* __hms_create_named_header( char *key, char *value ) {
+static hms_msg_nheader* __hms_create_named_header( hms_msg *msg, char *key, char *value ) {
 
   /* Check inputs */
   hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) NULL, (uintptr_t) key );
   hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) NULL, (uintptr_t) value );
 
-  /* Malloc space for header */
-  hms_msg_nheader *hdr = calloc( 1, sizeof(hms_msg_nheader) );
+  /* Space for header, from the arena when possible */
+  unsigned node_flags = HMS_BORROWED_NODE;
+  hms_msg_nheader *hdr = hms_msg_arena_alloc( msg, sizeof(hms_msg_nheader) );
+  if( !hdr ) { hdr = calloc( 1, sizeof(hms_msg_nheader) ); node_flags = 0; }
   hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) NULL, (uintptr_t) hdr );
 
   /* Initialize it */
-  __hms_init_named_header( hdr, key, value );
+  __hms_init_named_header( msg, hdr, key, value );
+  hdr->flags |= node_flags;
 
   return hdr;
 
 } /* end __hms_create_named_header() */
 
-static int __hms_init_named_header( hms_msg_nheader *hdr, char *key, char *value ) {
+static int __hms_init_named_header( hms_msg *msg, hms_msg_nheader *hdr, char *key, char *value ) {
 
   /* Check inputs */
   hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) NULL, (uintptr_t) hdr );
   hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) NULL, (uintptr_t) key );
   hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) NULL, (uintptr_t) value );
 
-  hdr->key = strdup( key );
-  hdr->val = strdup( value );
+  hdr->key_len = strlen( key );
+  hdr->val_len = strlen( value );
+  hdr->flags = 0;
   HMS_INIT_LIST_HEAD( &hdr->lh );
 
+  /* key and value share one piece of the arena, or are both on the heap */
+  char *str = hms_msg_arena_alloc( msg, hdr->key_len + hdr->val_len + 2 );
+  if( str ) {
+    hdr->key = str;
+    hdr->val = str + hdr->key_len + 1;
+    memcpy( hdr->key, key, hdr->key_len + 1 );
+    memcpy( hdr->val, value, hdr->val_len + 1 );
+    hdr->flags = HMS_BORROWED_STR;
+  } else {
+    hdr->key = strdup( key );
+    hdr->val = strdup( value );
+  }
+
   /* Make sure it copied correctly */
   hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) NULL, (uintptr_t) hdr->key );
   hms_assert_not_equals( __FILE__ , __LINE__ , (uintptr_t) NULL, (uintptr_t) hdr->val );
@@ -624,7 +1321,7 @@ static int __hms_destroy_named_header( hms_msg_nheader *hdr ) {
   __hms_deinit_named_header( hdr );
   
   /* free hdr itself */
-  free( hdr );
+  if( !(hdr->flags & HMS_BORROWED_NODE) ) free( hdr );
 
   return 0;
 
@@ -638,8 +1335,10 @@ static int __hms_deinit_named_header( hms_msg_nheader *hdr ) {
   hms_assert_not_equals( __FILE__ , __LINE__ , 0, (uintptr_t) hdr->key );  
   hms_assert_not_equals( __FILE__ , __LINE__ , 0, (uintptr_t) hdr->val );  
   
-  free( hdr->key );
-  free( hdr->val );
+  if( !(hdr->flags & HMS_BORROWED_STR) ) {
+    free( hdr->key );
+    free( hdr->val );
+  }
 
   return 0;
 
@@ -8,40 +8,282 @@
  *
  **/
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#define HMS_HAVE_SPLICE
+#endif
+
 #include <hermes.h>
 #include <hermes_internal.h>
 #include <errno.h>
 #include <ctype.h>
 #include <strings.h>
+#include <limits.h>
+
+#define HMS_PARSER_MIN_BUF 256
+#define HMS_SPLICE_CHUNK   65536
 
 /* Function prototypes */
 /* ---------------------------------------------------- */
-static void __hms_str_strip( char ** str );
-static int __hms_parse_read_header( int fd, char *buffer, int buf_len );
-static int __hms_parse_header( hms_msg *msg, char *buffer, int len, int *body_len );
-static int __hms_parse_verb_line( hms_msg *msg, char *line );
-static int __hms_parse_named_header( hms_msg *msg, char *line, int *body_len );
-static int __hms_parse_read_body( int fd, hms_msg *msg, int body_len );
+static void __hms_str_strip( char **str, char **end );
+static int __hms_rbuf_fill( int fd, hms_rbuf *rb, int room, int want );
+static int __hms_parse_read_header( int fd, hms_rbuf *rb, int max_hdr_len );
+static int __hms_parse_header( hms_msg *msg, char *buffer, hms_scan_index *idx, int *body_len, int views );
+static int __hms_parse_verb_line( hms_msg *msg, char *line, int len, int views );
+static int __hms_parse_named_header( hms_msg *msg, char *line, int len, int colon, int *body_len, int views );
+static int __hms_rbuf_alloc( hms_rbuf *rb );
+static int __hms_rbuf_grow( hms_rbuf *rb, int limit );
+static hms_msg *__hms_parse_rbuf( int fd, hms_rbuf *rb, int max_hdr_len, int with_body );
+static hms_msg *__hms_parse_views( int fd, hms_rbuf *rb, int hdr_len, int with_body );
+static hms_msg *__hms_parse_view_header( char *buffer, char *hdr, hms_scan_index *idx );
+static int __hms_parse_body_len( char *buffer, hms_scan_index *idx );
+static int __hms_parse_body_fits( int hdr_len, int body_len, int max_body );
+static int __hms_parse_max_nodes( hms_scan_index *idx );
+static int __hms_read_all( int fd, char *p, int len );
+static int __hms_parse_check_body( hms_msg *msg, char *buffer, int body_len );
+static int __hms_pwrite_all( int fd, char *p, int len, off_t offset );
+#ifdef HMS_HAVE_SPLICE
+static int __hms_splice_body( int fd, hms_rbuf *rb, int out_fd, off_t *offset, int *left );
+static int __hms_splice_drain( hms_rbuf *rb, int out_fd, off_t *offset, int len );
+#endif
+static int __hms_match_fast( char *p, int len, int *used );
 
 /* Implementation */
 /* ---------------------------------------------------- */
 
 hms_msg *hms_msg_parse( int fd , int max_hdr_len ) {
 
-  char *buffer = NULL; int len = 0;
-  buffer = (char *) malloc( max_hdr_len + 1); len=max_hdr_len;
-  buffer[max_hdr_len] = '\0';
+  /* No connection to carry leftovers, so never read past the message */
+  hms_rbuf rb;
+  hms_rbuf_init( &rb );
+  rb.no_readahead = HMS_TRUE;
+
+  hms_msg *msg = hms_msg_parse_rbuf( fd, &rb, max_hdr_len );
+
+  hms_rbuf_deinit( &rb );
+
+  return msg;
+
+} /* end hms_msg_parse() */
+
+hms_msg *hms_msg_parse_rbuf( int fd, hms_rbuf *rb, int max_hdr_len ) {
+
+  return __hms_parse_rbuf( fd, rb, max_hdr_len, HMS_TRUE );
+
+} /* end hms_msg_parse_rbuf() */
+
+/**
+ * Parses only the header. A body is left pending on the socket for
+ * hms_msg_parse_body_rbuf() or hms_msg_stream_body_rbuf().
+ **/
+hms_msg *hms_msg_parse_header_rbuf( int fd, hms_rbuf *rb, int max_hdr_len ) {
+
+  return __hms_parse_rbuf( fd, rb, max_hdr_len, HMS_FALSE );
+
+} /* end hms_msg_parse_header_rbuf() */
+
+int hms_msg_parse_body_rbuf( int fd, hms_rbuf *rb, hms_msg *msg ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+
+  if( !(msg->flags & HMS_BODY_PENDING) ) { return 0; }
+  if( __hms_rbuf_alloc( rb ) ) { return -1; }
+
+  /* into the arena when the header reserved room for it */
+  int body_len = msg->content_len, read_in = 0, erred = HMS_FALSE;
+  if( __hms_parse_body_fits( 0, body_len, rb->max_body ) ) { return -1; }
+  char *body = hms_msg_arena_alloc( msg, body_len + 1 );
+  int borrowed = (body != NULL);
+  if( !body ) { body = malloc( body_len + 1 ); }
+  if( !body ) { return -1; }
+
+  /* Small bodies are gathered in the receive buffer, so the read that
+     completes them can pick up the next header too */
+  if( body_len <= rb->cap ) {
+    while( (read_in = rb->end - rb->start) < body_len ) {
+      int left = body_len - read_in;
+      if( __hms_rbuf_fill( fd, rb, left, left ) <= 0 ) { erred = HMS_TRUE; break; }
+    }
+    if( !erred ) {
+      memcpy( body, rb->buf + rb->start, body_len );
+      rb->start += body_len;
+    }
+  }
+  /* Large bodies take what is buffered and read the rest in place */
+  else {
+    read_in = rb->end - rb->start;
+    memcpy( body, rb->buf + rb->start, read_in );
+    rb->start = rb->end = 0;
+    if( __hms_read_all( fd, body + read_in, body_len - read_in ) != 0 ) { erred = HMS_TRUE; }
+  }
+  if( erred ) {
+    if( !borrowed ) { free( body ); }
+    return -1;
+  }
+
+  /* the message owns the body now */
+  hms_msg_view_body( msg, body, body_len, borrowed );
+
+  return __hms_parse_check_body( msg, body, body_len );
+
+} /* end hms_msg_parse_body_rbuf() */
+
+/**
+ * Hands a pending body to "sink" piece by piece as it is read, with
+ * pieces no larger than the receive buffer. Checksums are not verified
+ * for streamed bodies.
+ **/
+int hms_msg_stream_body_rbuf( int fd, hms_rbuf *rb, hms_msg *msg, hms_body_sink sink, void *arg ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) sink );
+
+  if( !(msg->flags & HMS_BODY_PENDING) ) { return 0; }
+  if( __hms_rbuf_alloc( rb ) ) { return -1; }
+
+  int body_len = msg->content_len, offset = 0, erred = HMS_FALSE;
+
+  while( offset < body_len ) {
+
+    int avail = rb->end - rb->start;
+
+    /* refill from the start of the buffer */
+    if( avail == 0 ) {
+      rb->start = rb->end = 0;
+      if( __hms_rbuf_fill( fd, rb, 0, body_len - offset ) <= 0 ) { erred = HMS_TRUE; break; }
+      continue;
+    }
+
+    int n = ( avail < body_len - offset ) ? avail : body_len - offset;
+    int ret = sink( arg, rb->buf + rb->start, n, offset );
+    rb->start += n; offset += n;
+    if( ret != 0 ) { erred = HMS_TRUE; break; }
+
+  } /* end while() */
+
+  /* the message keeps its length but not the bytes */
+  msg->flags &= ~HMS_BODY_PENDING;
+  msg->flags |= HMS_BODY_STREAMED;
+
+  return (erred == HMS_TRUE) ? -1 : 0;
+
+} /* end hms_msg_stream_body_rbuf() */
+
+/**
+ * Writes a pending body to out_fd from "offset" on. Bytes already
+ * buffered are written directly; the rest moves from the socket to the
+ * file with splice() through a pipe where the kernel allows it, and
+ * through the receive buffer otherwise. out_fd must be seekable.
+ **/
+int hms_msg_sink_body_rbuf( int fd, hms_rbuf *rb, hms_msg *msg, int out_fd, off_t offset ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+
+  if( !(msg->flags & HMS_BODY_PENDING) ) { return 0; }
+  if( __hms_rbuf_alloc( rb ) ) { return -1; }
+
+  int left = msg->content_len, erred = HMS_FALSE, n;
+
+  /* what the header read already pulled in */
+  n = ( rb->end - rb->start < left ) ? rb->end - rb->start : left;
+  if( n > 0 ) {
+    if( __hms_pwrite_all( out_fd, rb->buf + rb->start, n, offset ) != 0 ) { erred = HMS_TRUE; }
+    rb->start += n; offset += n; left -= n;
+  }
+
+#ifdef HMS_HAVE_SPLICE
+  if( !erred && left > 0 && __hms_splice_body( fd, rb, out_fd, &offset, &left ) != 0 ) {
+    erred = HMS_TRUE;
+  }
+#endif
+
+  /* whatever splice did not move goes through the buffer */
+  while( !erred && left > 0 ) {
+    rb->start = rb->end = 0;
+    if( __hms_rbuf_fill( fd, rb, 0, left ) <= 0 ) { erred = HMS_TRUE; break; }
+    n = ( rb->end < left ) ? rb->end : left;
+    if( __hms_pwrite_all( out_fd, rb->buf, n, offset ) != 0 ) { erred = HMS_TRUE; }
+    rb->start = n; offset += n; left -= n;
+  }
+
+  if( rb->start == rb->end ) { rb->start = rb->end = 0; }
+
+  /* the message keeps its length but not the bytes */
+  msg->flags &= ~HMS_BODY_PENDING;
+  msg->flags |= HMS_BODY_STREAMED;
+
+  return (erred == HMS_TRUE) ? -1 : 0;
+
+} /* end hms_msg_sink_body_rbuf() */
+
+/**
+ * Consumes the next message if it is a bare PING, INFO or BYE (no headers,
+ * no body) and returns which; anything else is left for the full parser.
+ * Reads only if nothing is buffered. -1 if the connection is done.
+ **/
+int hms_msg_parse_fast_rbuf( int fd, hms_rbuf *rb ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb );
+
+  int used = 0, verb;
+
+  /* Allocate on first use */
+  if( __hms_rbuf_alloc( rb ) ) { return -1; }
+  if( rb->start == rb->end && __hms_rbuf_fill( fd, rb, rb->cap, 1 ) <= 0 ) { return -1; }
+
+  verb = __hms_match_fast( rb->buf + rb->start, rb->end - rb->start, &used );
+  if( verb != HMS_FAST_NONE ) {
+    rb->start += used;
+    if( rb->start == rb->end ) { rb->start = rb->end = 0; }
+  }
+
+  return verb;
+
+} /* end hms_msg_parse_fast_rbuf() */
+
+static hms_msg *__hms_parse_rbuf( int fd, hms_rbuf *rb, int max_hdr_len, int with_body ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb );
+  hms_assert_not_equals( __FILE__, __LINE__, (int) 0, (int) max_hdr_len );
+
   hms_msg *msg = NULL;
 
+  /* Allocate on first use */
+  if( __hms_rbuf_alloc( rb ) ) { return NULL; }
+
   /* Read header */
-  int hdr_len = __hms_parse_read_header( fd, buffer, len);
-  //printf("hdr: len: %d data: |%s|\n", hdr_len, buffer);
-  if( hdr_len > 2 ) {
+  int hdr_len = __hms_parse_read_header( fd, rb, max_hdr_len );
+  //printf("hdr: len: %d data: |%s|\n", hdr_len, rb->buf + rb->start);
+  if( hdr_len > 2 && rb->zero_copy ) {
+    msg = __hms_parse_views( fd, rb, hdr_len, with_body );
+  }
+  else if( hdr_len > 2 ) {
     int erred = HMS_FALSE; int body_len = 0;
-    msg = hms_msg_create();
-    if(!__hms_parse_header(msg, buffer, hdr_len, &body_len) ) {
+    char *buffer = rb->buf + rb->start;
+
+    /* one allocation: nodes, the strings (never longer than the header)
+       and the body when it is read right away */
+    int nodes = __hms_parse_max_nodes( &rb->idx );
+    int arena_body = ( with_body ) ? __hms_parse_body_len( buffer, &rb->idx ) : 0;
+    if( __hms_parse_body_fits( hdr_len, arena_body, rb->max_body ) ) { arena_body = 0; }
+    int arena_size = ( arena_body > 0 ) ?
+      hms_msg_arena_size( nodes, nodes + 2, hdr_len + arena_body + 1 ) :
+      hms_msg_arena_size( nodes, nodes + 1, hdr_len );
+    msg = hms_msg_create_arena( arena_size );
+    hms_msg_index_reserve( msg, nodes );
+    if(!__hms_parse_header(msg, buffer, &rb->idx, &body_len, HMS_FALSE) && body_len >= 0 ) {
+      rb->start += hdr_len;
       if(body_len) {
-	if( __hms_parse_read_body( fd, msg , body_len ) != 0 ) {
+	hms_msg_pend_body( msg, body_len );
+	if( with_body && hms_msg_parse_body_rbuf( fd, rb, msg ) != 0 ) {
 	  erred = HMS_TRUE;
 	}
       }
@@ -50,181 +292,848 @@ hms_msg *hms_msg_parse( int fd , int max_hdr_len ) {
     if(erred && msg) { hms_msg_destroy( msg ); msg = NULL; }
   }
 
-  free(buffer); buffer = NULL; len = 0;
+  /* Rewind once everything buffered is consumed */
+  if( rb->buf && rb->start == rb->end ) { rb->start = rb->end = 0; }
 
   return msg;
 
-} /* end hms_msg_parse() */
+} /* end __hms_parse_rbuf() */
 
-/* Helper Functions */
+void hms_rbuf_init( hms_rbuf *rb ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb );
+
+  /* buffer is allocated by the first parse */
+  rb->buf = NULL;
+  rb->cap = 0;
+  rb->start = rb->end = 0;
+  rb->init_cap = HERMES_RBUF_SIZE;
+  rb->no_readahead = HMS_FALSE;
+  rb->zero_copy = HMS_FALSE;
+  rb->max_body = 0;
+  hms_scan_init( &rb->idx );
+  rb->splice_pipe[0] = rb->splice_pipe[1] = -1;
+
+} /* end hms_rbuf_init() */
+
+/* Keeps bytes that arrived elsewhere (e.g. in an io_uring buffer) */
+int hms_rbuf_append( hms_rbuf *rb, char *data, int len ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb );
+
+  if( __hms_rbuf_alloc( rb ) ) { return -1; }
+
+  /* compact, then grow to fit */
+  if( rb->start > 0 && rb->cap - rb->end < len ) {
+    memmove( rb->buf, rb->buf + rb->start, rb->end - rb->start );
+    rb->end -= rb->start;
+    rb->start = 0;
+  }
+  if( rb->cap - rb->end < len ) {
+    char *buf = (char *) realloc( rb->buf, rb->end + len );
+    if( !buf ) { return -1; }
+    rb->buf = buf;
+    rb->cap = rb->end + len;
+  }
+
+  memcpy( rb->buf + rb->end, data, len );
+  rb->end += len;
+
+  return 0;
+
+} /* end hms_rbuf_append() */
+
+/* Frees the buffer while nothing is in it; the next read allocates again */
+void hms_rbuf_trim( hms_rbuf *rb ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb );
+
+  if( rb->buf && rb->start == rb->end ) {
+    free( rb->buf ); rb->buf = NULL;
+    rb->cap = 0; rb->start = rb->end = 0;
+  }
+
+} /* end hms_rbuf_trim() */
+
+/* Drops len bytes from the front of the buffer */
+void hms_rbuf_skip( hms_rbuf *rb, int len ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb );
+
+  rb->start += len;
+  if( rb->start >= rb->end ) { rb->start = rb->end = 0; }
+
+} /* end hms_rbuf_skip() */
+
+/* One read from a non-blocking fd into an empty buffer: the bytes read,
+   0 if the fd would block, -1 once the connection is closed */
+int hms_rbuf_read( int fd, hms_rbuf *rb ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb );
+
+  int n;
+
+  if( __hms_rbuf_alloc( rb ) ) { return -1; }
+  rb->start = rb->end = 0;
+  do {
+    n = read( fd, rb->buf, rb->cap );
+  } while( n == -1 && errno == EINTR );
+
+  if( n == 0 ) { return -1; }
+  if( n < 0 ) { return ( errno == EAGAIN || errno == EWOULDBLOCK ) ? 0 : -1; }
+  rb->end = n;
+
+  return n;
+
+} /* end hms_rbuf_read() */
+
+void hms_rbuf_deinit( hms_rbuf *rb ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb );
+
+  if( rb->buf ) { free( rb->buf ); rb->buf = NULL; }
+  rb->cap = 0;
+  rb->start = rb->end = 0;
+  hms_scan_deinit( &rb->idx );
+  if( rb->splice_pipe[0] >= 0 ) {
+    close( rb->splice_pipe[0] ); close( rb->splice_pipe[1] );
+    rb->splice_pipe[0] = rb->splice_pipe[1] = -1;
+  }
+
+} /* end hms_rbuf_deinit() */
+
+/* Push parser */
 /* ---------------------------------------------------- */
 
-static int __hms_parse_read_header( int fd, char *buffer, int buf_len ) {
+hms_parser *hms_parser_create( int max_hdr_len ) {
 
   /* Check input */
-  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) buffer );
-  hms_assert_not_equals( __FILE__, __LINE__, (int) 0, (int) buf_len );
+  hms_assert_not_equals( __FILE__, __LINE__, (int) 0, (int) max_hdr_len );
+
+  hms_parser *parser = calloc( 1, sizeof(hms_parser) );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) parser );
+
+  parser->max_hdr_len = max_hdr_len;
+  parser->max_body_len = 0;
+  parser->buf = NULL;
+  parser->cap = 0;
+  parser->msg = NULL;
+  hms_scan_init( &parser->idx );
+  hms_parser_reset( parser );
+
+  return parser;
+
+} /* end hms_parser_create() */
+
+/* Longer bodies fail the message; 0 for no bound */
+int hms_parser_set_max_body( hms_parser *parser, int max_body_len ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) parser );
+  if( max_body_len < 0 ) { return -1; }
+
+  parser->max_body_len = max_body_len;
+
+  return 0;
+
+} /* end hms_parser_set_max_body() */
+
+/**
+ * Feeds "len" bytes to the parser. Returns HMS_PARSE_DONE with the
+ * message once one is complete, HMS_PARSE_MORE if every byte was taken
+ * and more are needed, or HMS_PARSE_ERROR. "consumed" is how many bytes
+ * of "data" were used; bytes after a complete message are left alone.
+ **/
+int hms_parser_feed( hms_parser *parser, char *data, int len, int *consumed, hms_msg **msg ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) parser );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) consumed );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+
+  int taken = 0;
+  *consumed = 0; *msg = NULL;
+
+  if( parser->state == HMS_PARSE_HEADER ) {
+
+    /* copy what could still be header */
+    int n = parser->max_hdr_len - parser->used;
+    if( n > len ) { n = len; }
+    if( parser->used + n > parser->cap ) {
+      int cap = (parser->cap) ? parser->cap : HMS_PARSER_MIN_BUF;
+      while( cap < parser->used + n ) { cap *= 2; }
+      if( cap > parser->max_hdr_len ) { cap = parser->max_hdr_len; }
+      char *buf = realloc( parser->buf, cap );
+      if( !buf ) { return HMS_PARSE_ERROR; }
+      parser->buf = buf; parser->cap = cap;
+    }
+    memcpy( parser->buf + parser->used, data, n );
+    int before = parser->used;
+    parser->used += n;
+
+    int hdr_len = hms_scan_header( parser->buf, parser->used, &parser->idx );
+    if( hdr_len < 0 ) { return HMS_PARSE_ERROR; }
+    if( hdr_len == 0 ) {
+      if( parser->used >= parser->max_hdr_len ) { return HMS_PARSE_ERROR; }
+      *consumed = n;
+      return HMS_PARSE_MORE;
+    }
+    if( hdr_len <= 2 ) { return HMS_PARSE_ERROR; }
+
+    int body_len = __hms_parse_body_len( parser->buf, &parser->idx );
+    if( body_len < 0 ) { return HMS_PARSE_ERROR; }
+    if( __hms_parse_body_fits( hdr_len, body_len, parser->max_body_len ) ) { return HMS_PARSE_ERROR; }
+
+    /* header and body share one allocation */
+    if( hdr_len + body_len != parser->cap ) {
+      char *buf = realloc( parser->buf, hdr_len + body_len );
+      if( !buf ) { return HMS_PARSE_ERROR; }
+      parser->buf = buf; parser->cap = hdr_len + body_len;
+    }
+
+    /* bytes copied past the header are body (or the next message) */
+    int extra = parser->used - hdr_len;
+    if( extra > body_len ) { extra = body_len; }
+    parser->used = hdr_len + extra;
+    taken = parser->used - before;
+
+    parser->hdr_len = hdr_len;
+    parser->body_len = body_len;
+    parser->state = HMS_PARSE_BODY;
+
+    /* the message owns the buffer from here on */
+    parser->msg = __hms_parse_view_header( parser->buf, parser->buf, &parser->idx );
+    if( !parser->msg ) { parser->buf = NULL; parser->cap = 0; return HMS_PARSE_ERROR; }
+
+  }
+
+  /* body */
+  {
+    int n = parser->hdr_len + parser->body_len - parser->used;
+    if( n > len - taken ) { n = len - taken; }
+    memcpy( parser->buf + parser->used, data + taken, n );
+    parser->used += n;
+    taken += n;
+  }
+  *consumed = taken;
+
+  if( parser->used < parser->hdr_len + parser->body_len ) { return HMS_PARSE_MORE; }
+
+  /* complete */
+  hms_msg *tmp_msg = parser->msg;
+  if( parser->body_len ) {
+    char *body = parser->buf + parser->hdr_len;
+    hms_msg_view_body( tmp_msg, body, parser->body_len, HMS_TRUE );
+    if( __hms_parse_check_body( tmp_msg, body, parser->body_len ) != 0 ) {
+      return HMS_PARSE_ERROR;
+    }
+  }
+
+  /* hand over and start the next message */
+  parser->msg = NULL;
+  parser->buf = NULL; parser->cap = 0;
+  hms_parser_reset( parser );
+
+  *msg = tmp_msg;
+  return HMS_PARSE_DONE;
+
+} /* end hms_parser_feed() */
+
+/**
+ * Feeds the parser from a non-blocking fd: bytes left in the receive
+ * buffer first, then reads until a message is complete or the fd would
+ * block. Returns 1 with the message, 0 if the fd would block, -1 once
+ * the connection is closed or sent something unparsable. Bytes after the
+ * message stay in the buffer for the next call.
+ **/
+int hms_parser_pump_rbuf( int fd, hms_rbuf *rb, hms_parser *parser, hms_msg **msg ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) parser );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+
+  int status, n;
+  *msg = NULL;
+
+  while( HMS_TRUE ) {
+
+    /* buffered bytes */
+    status = hms_parser_drain_rbuf( rb, parser, msg );
+    if( status != 0 ) { return status; }
 
-  /* Read until ".\n" or buf_len */
-  unsigned hdr_len = 0, dot_seen = HMS_FALSE, is_done = HMS_FALSE;
-  char *dot_ptr = NULL;
-  while( (hdr_len < buf_len) ) {
-      char c;
-      if( read( fd, &c, 1) == 1 ) {
-	if( c == '\r' ) { c = ' '; }
-	buffer[hdr_len++] = c;
-	if( c == '.' ) { dot_seen = HMS_TRUE; dot_ptr = &buffer[hdr_len-1]; continue; }
-	if(dot_seen && c == '\n' ) { is_done = HMS_TRUE; break; }
-	if(dot_seen && (c != ' ' && c != '\r' && c != '\n') ) { dot_seen = HMS_FALSE; dot_ptr = NULL; }
-      } else { break; }
+    /* everything was fed: refill from the start */
+    if( __hms_rbuf_alloc( rb ) ) { return -1; }
+    do {
+      n = read( fd, rb->buf + rb->end, rb->cap - rb->end );
+    } while( n == -1 && errno == EINTR );
+
+    if( n == 0 ) { return -1; }
+    if( n < 0 ) { return ( errno == EAGAIN || errno == EWOULDBLOCK ) ? 0 : -1; }
+    rb->end += n;
 
   } /* end while() */
 
-  //printf("buf:|%s|\n", buffer); fflush(stdout);
+} /* end hms_parser_pump_rbuf() */
 
-  /* Put "\0" where "." exists */
-  if(dot_ptr) *dot_ptr = '\0';
+/**
+ * Feeds the parser only what is already in the receive buffer. Returns
+ * 1 with a message, 0 once every buffered byte was taken, -1 on bytes
+ * that do not parse.
+ **/
+int hms_parser_drain_rbuf( hms_rbuf *rb, hms_parser *parser, hms_msg **msg ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) parser );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) msg );
+
+  int status, consumed;
+  *msg = NULL;
+
+  if( rb->start == rb->end ) { return 0; }
+
+  status = hms_parser_feed( parser, rb->buf + rb->start, rb->end - rb->start, &consumed, msg );
+  rb->start += consumed;
+  if( rb->start == rb->end ) { rb->start = rb->end = 0; }
+  if( status == HMS_PARSE_DONE ) { return 1; }
+  if( status == HMS_PARSE_ERROR ) { return -1; }
+
+  return 0;
+
+} /* end hms_parser_drain_rbuf() */
+
+/**
+ * A bare PING, INFO or BYE at the front of the buffered bytes while the
+ * parser is between messages; it stays in the buffer until
+ * hms_rbuf_skip( rb, *used ). HMS_FAST_NONE for anything else, also for
+ * one not all buffered yet: that is left to the parser.
+ **/
+int hms_parser_fast_rbuf( hms_rbuf *rb, hms_parser *parser, int *used ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) parser );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) used );
+
+  *used = 0;
+  if( parser->state != HMS_PARSE_HEADER || parser->used > 0 || rb->start == rb->end ) {
+    return HMS_FAST_NONE;
+  }
+
+  return __hms_match_fast( rb->buf + rb->start, rb->end - rb->start, used );
+
+} /* end hms_parser_fast_rbuf() */
+
+int hms_parser_reset( hms_parser *parser ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) parser );
+
+  /* drop a partial message */
+  if( parser->msg ) {
+    hms_msg_destroy( parser->msg ); parser->msg = NULL;
+    parser->buf = NULL; parser->cap = 0;
+  }
+
+  parser->state = HMS_PARSE_HEADER;
+  parser->used = 0;
+  parser->hdr_len = 0;
+  parser->body_len = 0;
+  hms_scan_reset( &parser->idx );
+
+  return 0;
+
+} /* end hms_parser_reset() */
+
+int hms_parser_destroy( hms_parser *parser ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) parser );
+
+  hms_parser_reset( parser );
+  if( parser->buf ) { free( parser->buf ); parser->buf = NULL; }
+  hms_scan_deinit( &parser->idx );
+  free( parser );
+
+  return 0;
+
+} /* end hms_parser_destroy() */
+
+/* Helper Functions */
+/* ---------------------------------------------------- */
+
+/* Fresh buffers start at init_cap; headers grow them as needed */
+static int __hms_rbuf_alloc( hms_rbuf *rb ) {
+
+  if( rb->buf ) { return 0; }
+
+  rb->cap = ( rb->init_cap > 0 ) ? rb->init_cap : HERMES_RBUF_SIZE;
+  rb->buf = (char *) malloc( rb->cap );
+  if( !rb->buf ) { rb->cap = 0; return -1; }
+  rb->start = rb->end = 0;
+
+  return 0;
+
+} /* end __hms_rbuf_alloc() */
+
+/* Doubles the buffer, up to "limit" bytes */
+static int __hms_rbuf_grow( hms_rbuf *rb, int limit ) {
+
+  if( rb->cap >= limit ) { return -1; }
+
+  int cap = ( 2 * rb->cap < limit ) ? 2 * rb->cap : limit;
+  char *buf = (char *) realloc( rb->buf, cap );
+  if( !buf ) { return -1; }
+  rb->buf = buf;
+  rb->cap = cap;
+
+  return 0;
+
+} /* end __hms_rbuf_grow() */
+
+/**
+ * Reads more bytes into the tail of the buffer. Unconsumed bytes are
+ * moved to the front if fewer than "room" bytes are free at the tail.
+ * Without readahead only "want" bytes are requested from the fd.
+ **/
+static int __hms_rbuf_fill( int fd, hms_rbuf *rb, int room, int want ) {
+
+  int n;
+
+  /* compact */
+  if( rb->start > 0 && (rb->cap - rb->end) < room ) {
+    memmove( rb->buf, rb->buf + rb->start, rb->end - rb->start );
+    rb->end -= rb->start;
+    rb->start = 0;
+  }
+
+  /* how much to ask for */
+  int len = rb->cap - rb->end;
+  if( rb->no_readahead && want < len ) { len = want; }
+  if( len <= 0 ) { return -1; }
+
+  do {
+    n = read( fd, rb->buf + rb->end, len );
+  } while( n == -1 && errno == EINTR );
+
+  if( n > 0 ) { rb->end += n; }
+
+  return n;
+
+} /* end __hms_rbuf_fill() */
+
+static int __hms_parse_read_header( int fd, hms_rbuf *rb, int max_hdr_len ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) rb->buf );
+  hms_assert_not_equals( __FILE__, __LINE__, (int) 0, (int) max_hdr_len );
 
-  /* Put "\0" at the end if theres room */
-  if(hdr_len < buf_len) buffer[hdr_len]='\0';
+  /* Scan until ".\n" or max_hdr_len, reading only when the buffer runs dry.
+     Index offsets are relative to rb->start, so a fill may move the bytes */
+  hms_scan_index *idx = &rb->idx;
+  hms_scan_reset( idx );
+  while( HMS_TRUE ) {
 
-  return (is_done == HMS_TRUE) ? hdr_len : -1;
+    int avail = rb->end - rb->start;
+    if( avail > max_hdr_len ) { avail = max_hdr_len; }
+
+    int hdr_len = hms_scan_header( rb->buf + rb->start, avail, idx );
+    if( hdr_len != 0 ) { return hdr_len; }
+    if( avail == max_hdr_len ) { break; }
+
+    /* the buffer holds nothing but header: make room up to the limit */
+    if( rb->end - rb->start == rb->cap && __hms_rbuf_grow( rb, max_hdr_len + 1 ) ) { break; }
+    if( __hms_rbuf_fill( fd, rb, max_hdr_len - avail, 1 ) <= 0 ) { break; }
+
+  } /* end while() */
+
+  return -1;
 
 } /* end __hms_parse_read_header() */
 
-static int __hms_parse_header( hms_msg *msg, char *buffer, int len, int *body_len ) {
+static int __hms_parse_header( hms_msg *msg, char *buffer, hms_scan_index *idx, int *body_len, int views ) {
 
-  char *line, *line_save, *line_sep = "\n";
-  int count = 0;
+  int i;
   int erred = HMS_FALSE;
 
-  for( line=strtok_r(buffer, line_sep, &line_save);
-       line;
-       line=strtok_r(NULL, line_sep, &line_save) ) {
+  /* Put "\0" where "." exists */
+  buffer[idx->dot] = '\0';
+
+  for( i = 0; i < idx->num_lines; i++ ) {
+
+    hms_scan_line *line = &idx->lines[i];
 
-    if( count == 0) {
-      if(__hms_parse_verb_line(msg,line)) { 
+    if( i == 0 ) {
+      if(__hms_parse_verb_line(msg, buffer + line->start, line->end - line->start, views)) { 
 	erred=HMS_TRUE; break;
       }
     } else {
-      if(__hms_parse_named_header( msg, line, body_len )) {
+      if(line->colon < 0) { erred = HMS_TRUE; break; }
+      if(__hms_parse_named_header( msg, buffer + line->start, line->end - line->start,
+				   line->colon - line->start, body_len, views )) {
 	erred = HMS_TRUE; break;
       }
     }
 
-    count++;
-
   } /* end for loop */
 
   return ( erred == HMS_FALSE ) ? 0 : -1;
 
 } /* end __hms_parse_header() */
 
-static int __hms_parse_verb_line( hms_msg *msg, char *line ) {
+static int __hms_parse_verb_line( hms_msg *msg, char *line, int len, int views ) {
 
-  char *word, *word_save, *word_sep = " \t";
+  char *p = line, *end = line + len;
   int count = 0;
   int found_verb = HMS_FALSE;
 
-  for( word=strtok_r(line, word_sep, &word_save);
-       word;
-       word=strtok_r(NULL, word_sep, &word_save)) {
+  while( p < end ) {
+
+    /* skip separators */
+    while( p < end && (*p == ' ' || *p == '\t') ) { p++; }
+    if( p == end ) { break; }
+
+    /* terminate the word in place */
+    char *word = p;
+    while( p < end && *p != ' ' && *p != '\t' ) { p++; }
+    int word_len = p - word;
+    *p++ = '\0';
 
     /* verb */
     if( count == 0 ) { 
-      hms_msg_set_verb( msg, word ); found_verb = HMS_TRUE; 
+      if( views ) hms_msg_view_verb( msg, word, word_len );
+      else hms_msg_set_verb( msg, word );
+      found_verb = HMS_TRUE; 
       //printf("verb:|%s|\n", word);
     } else {
-      hms_msg_add_header( msg, word ); 
+      if( views ) hms_msg_view_header( msg, word, word_len );
+      else hms_msg_add_header( msg, word ); 
       //printf("uhdr:|%s|\n", word);
     }
 
     count++;
 
-  } /* end for loop */
+  } /* end while() */
 
   return found_verb ? 0 : -1;
 
 } /* end __hms_parse_verb_line() */
 
-static int __hms_parse_named_header( hms_msg *msg, char *line, int *body_len ) {
+static int __hms_parse_named_header( hms_msg *msg, char *line, int len, int colon, int *body_len, int views ) {
 
-  char hdr_sep = ':';
-  char *key, *val;
-  key = line; val = strchr(line, hdr_sep );
+  char *key = line, *key_end = line + colon;
+  char *val = line + colon + 1, *val_end = line + len;
 
-  if(val == NULL) { return -1; } else { *val='\0';  val++; }
-  __hms_str_strip( &key ); __hms_str_strip( &val );
+  __hms_str_strip( &key, &key_end ); __hms_str_strip( &val, &val_end );
+  *key_end = '\0'; *val_end = '\0';
 
   /* check for content-length */
   if( strcasecmp(key, HMS_CONTENT_LENGTH ) == 0) {
-    *body_len = (int) strtol(val, (char **)NULL, 10);
-    if(*body_len == 0) return -1;
+    long n = strtol(val, (char **)NULL, 10);
+    if(n <= 0 || n >= INT_MAX) return -1;
+    *body_len = (int) n;
   }
 
-  hms_msg_add_named_header( msg, key, val );
+  if( views ) hms_msg_view_named_header( msg, key, key_end - key, val, val_end - val );
+  else hms_msg_add_named_header( msg, key, val );
   //printf("nhdr: key: |%s| val:|%s| \n", key, val);
 
   return 0;
 
 } /* end __hms_parse_named_header() */
 
-static void __hms_str_strip( char ** str ) {
-  char* last;	
-  while( isspace( **str ) ) { (*str)++; }
-  last = *str + strlen( *str ) - 1;
-  while( isspace( *last ) ){ *last = 0;last--;}
-
+static void __hms_str_strip( char **str, char **end ) {
+  while( *str < *end && isspace( **str ) ) { (*str)++; }
+  while( *end > *str && isspace( *(*end - 1) ) ) { (*end)--; }
 } /* end __hms_str_strip() */
 
-static int __hms_parse_read_body( int fd, hms_msg *msg, int body_len ) {
-
-  char *buffer = NULL, *p = NULL;
-  int read_in = 0, erred = HMS_FALSE;
-  char computed_checksum[33], *given_checksum = NULL;
-  
-  buffer = malloc( body_len + 1 );
-  if(buffer == NULL ) { erred = HMS_TRUE; }
-  p = buffer;
-
-  while( read_in < body_len ) {
-    int sz = read( fd, p, (body_len - read_in) );
-    if( sz <= 0 ) { erred = HMS_TRUE; break; }
-    else { 
-      read_in += sz; 
-      p += sz;
+/**
+ * Zero-copy parse. The header (and the body when it fits) is gathered in
+ * the receive buffer, the message takes that buffer over and its headers
+ * point straight into it. The connection keeps a copy of the bytes that
+ * belong to later messages.
+ **/
+static hms_msg *__hms_parse_views( int fd, hms_rbuf *rb, int hdr_len, int with_body ) {
+
+  hms_scan_index *idx = &rb->idx;
+  int erred = HMS_FALSE;
+
+  /* Body length first: gathering may still move the buffered bytes */
+  int body_len = __hms_parse_body_len( rb->buf + rb->start, idx );
+  if( body_len < 0 ) { return NULL; }
+  if( with_body && __hms_parse_body_fits( hdr_len, body_len, rb->max_body ) ) { return NULL; }
+
+  int total = hdr_len + body_len;
+  if( with_body && total <= rb->cap ) {
+    int avail;
+    while( (avail = rb->end - rb->start) < total ) {
+      if( __hms_rbuf_fill( fd, rb, total - avail, total - avail ) <= 0 ) { return NULL; }
     }
   }
 
-  if(erred == HMS_FALSE) {
+  /* Split the buffer: this message and whatever follows it */
+  char *buffer = rb->buf, *hdr = rb->buf + rb->start;
+  int avail = rb->end - rb->start;
+  int body_in = ( avail - hdr_len < body_len ) ? avail - hdr_len : body_len;
+  if( !with_body ) { body_in = 0; }
+  int left = avail - hdr_len - body_in;
 
-#ifdef HERMES_ENABLE_CHECKSUMS
-    /* Computed checksum */
-    char hex_checksum[16];
-    md5_buffer( buffer, body_len, (void *) hex_checksum );
-    md5_sig_to_string( hex_checksum, computed_checksum, 33);
-
-    /* Check the checksum if passed */
-    int ret_chk = 0;
-    ret_chk = hms_msg_get_named_header(msg, HMS_CONTENT_CHECKSUM, &given_checksum);
-    if( ret_chk == 0 && given_checksum != NULL ) {
-      if( strncasecmp( given_checksum, computed_checksum, sizeof(computed_checksum) ) != 0 ) {
-	fprintf(stderr, "[ERROR] Checksums don't match!!\n"); fflush(stderr);
-	fprintf(stderr, "[ERROR] Computed: %s Given: %s\n", computed_checksum, given_checksum );
-	erred = 1;
-      }// else { fprintf(stderr, "[NOTE] Checksums matched!\n"); }
-    } else { fprintf(stderr, "[NOTE] No checksum provided!\n"); }
-#endif
+  if( left > 0 ) {
+    rb->buf = (char *) malloc( rb->cap );
+    if( !rb->buf ) { rb->buf = buffer; return NULL; }
+    memcpy( rb->buf, hdr + hdr_len + body_in, left );
+  } else {
+    rb->buf = NULL; /* allocated by the next parse */
+  }
+  rb->start = 0; rb->end = left;
+
+  hms_msg *msg = __hms_parse_view_header( buffer, hdr, idx );
+  if( !msg ) { return NULL; }
+
+  /* Left on the socket for the caller */
+  if( !with_body && body_len ) {
+    hms_msg_pend_body( msg, body_len );
+  }
+  /* Body: a view when it fits, otherwise read the rest in place */
+  else if( body_len ) {
+    char *body = hdr + hdr_len;
+    int borrowed = HMS_TRUE;
+    if( body_in < body_len ) {
+      body = malloc( body_len + 1 );
+      if( !body ) { erred = HMS_TRUE; }
+      else {
+	borrowed = HMS_FALSE;
+	memcpy( body, hdr + hdr_len, body_in );
+	if( __hms_read_all( fd, body + body_in, body_len - body_in ) != 0 ) { erred = HMS_TRUE; }
+      }
+    }
+    if( body ) { hms_msg_view_body( msg, body, body_len, borrowed ); }
+    if( !erred && __hms_parse_check_body( msg, body, body_len ) != 0 ) { erred = HMS_TRUE; }
+  }
+
+  if( erred ) { hms_msg_destroy( msg ); msg = NULL; }
+
+  return msg;
+
+} /* end __hms_parse_views() */
+
+/**
+ * Builds a view message over a complete header. The message owns
+ * "buffer" (which holds "hdr") from here on, even if parsing fails.
+ **/
+static hms_msg *__hms_parse_view_header( char *buffer, char *hdr, hms_scan_index *idx ) {
+
+  /* nodes only: the strings stay in "buffer" */
+  int nodes = __hms_parse_max_nodes( idx );
+  hms_msg *msg = hms_msg_create_arena( hms_msg_arena_size( nodes, 0, 0 ) );
+  hms_msg_index_reserve( msg, nodes );
+  hms_msg_own_buffer( msg, buffer );
+
+  int body_len = 0;
+  if( __hms_parse_header( msg, hdr, idx, &body_len, HMS_TRUE ) ) {
+    hms_msg_destroy( msg ); msg = NULL;
+  }
+
+  return msg;
+
+} /* end __hms_parse_view_header() */
 
-    /* Update the body */
-    assert(read_in == body_len );
-    hms_msg_set_body( msg, buffer, body_len );
+/* One node per named header plus room for every word of the verb line */
+static int __hms_parse_max_nodes( hms_scan_index *idx ) {
 
+  if( idx->num_lines == 0 ) { return 0; }
+
+  return idx->num_lines - 1 + (idx->lines[0].end - idx->lines[0].start + 1) / 2;
+
+} /* end __hms_parse_max_nodes() */
+
+/* Content-Length from the index, before anything is parsed. -1 if invalid */
+static int __hms_parse_body_len( char *buffer, hms_scan_index *idx ) {
+
+  int i, body_len = 0;
+  int cl_len = strlen( HMS_CONTENT_LENGTH );
+
+  for( i = 1; i < idx->num_lines; i++ ) {
+
+    hms_scan_line *line = &idx->lines[i];
+    if( line->colon < 0 ) { continue; }
+
+    char *key = buffer + line->start, *key_end = buffer + line->colon;
+    char *val = buffer + line->colon + 1, *val_end = buffer + line->end;
+    __hms_str_strip( &key, &key_end ); __hms_str_strip( &val, &val_end );
+
+    if( key_end - key == cl_len && strncasecmp( key, HMS_CONTENT_LENGTH, cl_len ) == 0 ) {
+      char num[32];
+      int len = val_end - val;
+      if( len >= (int) sizeof(num) ) { return -1; }
+      memcpy( num, val, len ); num[len] = '\0';
+      long n = strtol( num, (char **) NULL, 10 );
+      if( n <= 0 || n >= INT_MAX ) { return -1; }
+      body_len = (int) n;
+    }
+
+  } /* end for loop */
+
+  return body_len;
+
+} /* end __hms_parse_body_len() */
+
+/* 0 if a body of body_len after hdr_len header bytes may be read into
+   memory: within max_body (0 for no bound), and header, body and a
+   terminating NUL still counted in an int */
+static int __hms_parse_body_fits( int hdr_len, int body_len, int max_body ) {
+
+  if( max_body > 0 && body_len > max_body ) { return -1; }
+  if( body_len > INT_MAX - 1 - hdr_len ) { return -1; }
+
+  return 0;
+
+} /* end __hms_parse_body_fits() */
+
+static int __hms_read_all( int fd, char *p, int len ) {
+
+  while( len > 0 ) {
+    int sz = read( fd, p, len );
+    if( sz == -1 && errno == EINTR ) { continue; }
+    if( sz <= 0 ) { return -1; }
+    len -= sz;
+    p += sz;
   }
 
-  if(buffer) { free(buffer); buffer = NULL; }
-  if(given_checksum) { free(given_checksum); given_checksum = NULL; }
+  return 0;
+
+} /* end __hms_read_all() */
+
+static int __hms_pwrite_all( int fd, char *p, int len, off_t offset ) {
+
+  while( len > 0 ) {
+    int sz = pwrite( fd, p, len, offset );
+    if( sz == -1 && errno == EINTR ) { continue; }
+    if( sz <= 0 ) { return -1; }
+    len -= sz;
+    p += sz;
+    offset += sz;
+  }
+
+  return 0;
+
+} /* end __hms_pwrite_all() */
+
+#ifdef HMS_HAVE_SPLICE
+
+/**
+ * Moves up to *left body bytes socket -> pipe -> out_fd, updating
+ * *offset and *left. Returns 0 with bytes left over when either side
+ * cannot splice, so the caller can finish through the buffer.
+ **/
+static int __hms_splice_body( int fd, hms_rbuf *rb, int out_fd, off_t *offset, int *left ) {
+
+  if( rb->splice_pipe[0] < 0 && pipe2( rb->splice_pipe, O_CLOEXEC ) != 0 ) {
+    rb->splice_pipe[0] = rb->splice_pipe[1] = -1;
+    return 0;
+  }
+
+  while( *left > 0 ) {
+
+    int want = ( *left < HMS_SPLICE_CHUNK ) ? *left : HMS_SPLICE_CHUNK;
+    ssize_t in = splice( fd, NULL, rb->splice_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE );
+    if( in == -1 && errno == EINTR ) { continue; }
+    if( in == -1 && (errno == EINVAL || errno == ENOSYS) ) { return 0; }
+    if( in <= 0 ) { return -1; }
+
+    /* empty the pipe before the next read */
+    while( in > 0 ) {
+      loff_t off = *offset;
+      ssize_t out = splice( rb->splice_pipe[0], NULL, out_fd, &off, in, SPLICE_F_MOVE | SPLICE_F_MORE );
+      if( out == -1 && errno == EINTR ) { continue; }
+      if( out == -1 && errno == EINVAL ) {
+	if( __hms_splice_drain( rb, out_fd, offset, in ) != 0 ) { return -1; }
+	*left -= in;
+	return 0;
+      }
+      if( out <= 0 ) { return -1; }
+      in -= out; *left -= out; *offset += out;
+    }
+
+  } /* end while() */
+
+  return 0;
+
+} /* end __hms_splice_body() */
+
+/* out_fd refused the pipe: copy what is in it through the buffer */
+static int __hms_splice_drain( hms_rbuf *rb, int out_fd, off_t *offset, int len ) {
+
+  while( len > 0 ) {
+    int n = read( rb->splice_pipe[0], rb->buf, ( len < rb->cap ) ? len : rb->cap );
+    if( n == -1 && errno == EINTR ) { continue; }
+    if( n <= 0 ) { return -1; }
+    if( __hms_pwrite_all( out_fd, rb->buf, n, *offset ) != 0 ) { return -1; }
+    len -= n; *offset += n;
+  }
+
+  return 0;
+
+} /* end __hms_splice_drain() */
+
+#endif /* HMS_HAVE_SPLICE */
+
+/* "VERB\n.\n", each "\n" optionally "\r\n", verb in any case */
+static int __hms_match_fast( char *p, int len, int *used ) {
+
+  static const struct { const char *verb; int len; int code; } fast[] = {
+    { "PING", 4, HMS_FAST_PING }, { "INFO", 4, HMS_FAST_INFO }, { "BYE", 3, HMS_FAST_BYE }
+  };
+  int i, n;
+
+  for( i=0; i < (int) (sizeof(fast)/sizeof(fast[0])); i++ ) {
+    n = fast[i].len;
+    if( len < n + 3 || strncasecmp( p, fast[i].verb, n ) != 0 ) { continue; }
+    if( n < len && p[n] == '\r' ) { n++; }
+    if( n >= len || p[n++] != '\n' ) { return HMS_FAST_NONE; }
+    if( n >= len || p[n++] != '.' ) { return HMS_FAST_NONE; }
+    if( n < len && p[n] == '\r' ) { n++; }
+    if( n >= len || p[n++] != '\n' ) { return HMS_FAST_NONE; }
+    *used = n;
+    return fast[i].code;
+  }
+
+  return HMS_FAST_NONE;
+
+} /* end __hms_match_fast() */
+
+static int __hms_parse_check_body( hms_msg *msg, char *buffer, int body_len ) {
+
+  int erred = HMS_FALSE;
+
+#ifdef HERMES_ENABLE_CHECKSUMS
+  char computed_checksum[33];
+  const char *given_checksum = NULL;
+
+  /* Computed checksum */
+  char hex_checksum[16];
+  md5_buffer( buffer, body_len, (void *) hex_checksum );
+  md5_sig_to_string( hex_checksum, computed_checksum, 33);
+
+  /* Check the checksum if passed */
+  int ret_chk = 0;
+  ret_chk = hms_msg_peek_named_header(msg, HMS_CONTENT_CHECKSUM, &given_checksum, NULL);
+  if( ret_chk == 0 && given_checksum != NULL ) {
+    if( strncasecmp( given_checksum, computed_checksum, sizeof(computed_checksum) ) != 0 ) {
+      fprintf(stderr, "[ERROR] Checksums don't match!!\n"); fflush(stderr);
+      fprintf(stderr, "[ERROR] Computed: %s Given: %s\n", computed_checksum, given_checksum );
+      erred = 1;
+    }// else { fprintf(stderr, "[NOTE] Checksums matched!\n"); }
+  } else { fprintf(stderr, "[NOTE] No checksum provided!\n"); }
+#endif
 
-  return (erred == HMS_TRUE) ? -1 : 0; 
+  return (erred == HMS_TRUE) ? -1 : 0;
 
-} /* end __hms_parse_read_body() */
+} /* end __hms_parse_check_body() */
@@ -0,0 +1,253 @@
+/**
+ * HERMES
+ * ------
+ * by Gokul Soundararajan
+ *
+ * A C implementation of the Hermes protocol
+ * - header scanner: finds line breaks, the first ':' of
+ *   every line and the ".\n" terminator in one pass
+ *
+ **/
+
+#include <hermes.h>
+#include <hermes_internal.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HMS_SCAN_HAVE_X86
+#include <immintrin.h>
+#endif
+
+#define HMS_SCAN_MIN_LINES 16
+
+/* Function prototypes */
+/* ---------------------------------------------------- */
+static int __hms_scan_add_line( hms_scan_index *idx, int start, int end, int colon );
+static int __hms_scan_scalar( char *buf, int len, hms_scan_index *idx );
+#ifdef HMS_SCAN_HAVE_X86
+static int __hms_scan_sse2( char *buf, int len, hms_scan_index *idx );
+static int __hms_scan_avx2( char *buf, int len, hms_scan_index *idx );
+#endif
+
+/* Implementation */
+/* ---------------------------------------------------- */
+
+void hms_scan_init( hms_scan_index *idx ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) idx );
+
+  idx->lines = NULL;
+  idx->max_lines = 0;
+  hms_scan_reset( idx );
+
+} /* end hms_scan_init() */
+
+void hms_scan_reset( hms_scan_index *idx ) {
+
+  /* keeps the line array for the next message */
+  idx->scanned = 0;
+  idx->line_start = 0;
+  idx->colon = -1;
+  idx->dot = -1;
+  idx->hdr_len = 0;
+  idx->num_lines = 0;
+
+} /* end hms_scan_reset() */
+
+void hms_scan_deinit( hms_scan_index *idx ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) idx );
+
+  if( idx->lines ) { free( idx->lines ); idx->lines = NULL; }
+  idx->max_lines = 0;
+  hms_scan_reset( idx );
+
+} /* end hms_scan_deinit() */
+
+int hms_scan_best_impl() {
+
+#ifdef HMS_SCAN_HAVE_X86
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports( "avx2" ) ) { return HMS_SCAN_AVX2; }
+  if( __builtin_cpu_supports( "sse2" ) ) { return HMS_SCAN_SSE2; }
+#endif
+  return HMS_SCAN_SCALAR;
+
+} /* end hms_scan_best_impl() */
+
+int hms_scan_header( char *buf, int len, hms_scan_index *idx ) {
+
+  /* picked once; every thread computes the same answer */
+  static int impl = -1;
+  if( impl < 0 ) { impl = hms_scan_best_impl(); }
+
+  return hms_scan_header_impl( impl, buf, len, idx );
+
+} /* end hms_scan_header() */
+
+/**
+ * Scans buf[idx->scanned, len) and returns the header length once the
+ * terminator is found, 0 if more bytes are needed and -1 on error.
+ * Carriage returns inside the header are turned into spaces.
+ **/
+int hms_scan_header_impl( int impl, char *buf, int len, hms_scan_index *idx ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) buf );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) idx );
+
+  /* already done */
+  if( idx->hdr_len > 0 ) { return idx->hdr_len; }
+
+  int ret;
+  switch( impl ) {
+#ifdef HMS_SCAN_HAVE_X86
+  case HMS_SCAN_AVX2: ret = __hms_scan_avx2( buf, len, idx ); break;
+  case HMS_SCAN_SSE2: ret = __hms_scan_sse2( buf, len, idx ); break;
+#endif
+  default:            ret = __hms_scan_scalar( buf, len, idx ); break;
+  }
+
+  if( ret < 0 ) { return -1; }
+  return (ret > 0) ? idx->hdr_len : 0;
+
+} /* end hms_scan_header_impl() */
+
+/* Helper Functions */
+/* ---------------------------------------------------- */
+
+static int __hms_scan_add_line( hms_scan_index *idx, int start, int end, int colon ) {
+
+  /* empty lines carry nothing */
+  if( start == end ) { return 0; }
+
+  /* grow */
+  if( idx->num_lines == idx->max_lines ) {
+    int max_lines = (idx->max_lines) ? 2 * idx->max_lines : HMS_SCAN_MIN_LINES;
+    hms_scan_line *lines = realloc( idx->lines, max_lines * sizeof(hms_scan_line) );
+    if( !lines ) { return -1; }
+    idx->lines = lines;
+    idx->max_lines = max_lines;
+  }
+
+  hms_scan_line *line = &idx->lines[idx->num_lines++];
+  line->start = start;
+  line->end = end;
+  line->colon = (colon >= 0 && colon < end) ? colon : -1;
+
+  return 0;
+
+} /* end __hms_scan_add_line() */
+
+/**
+ * Handles one interesting byte (':', '\r' or '\n'). Returns 1 when
+ * the '\n' ends the header, -1 on error and 0 otherwise.
+ **/
+static inline int __hms_scan_event( char *buf, int pos, hms_scan_index *idx ) {
+
+  char c = buf[pos];
+
+  if( c == ':' ) {
+    if( idx->colon < 0 ) { idx->colon = pos; }
+    return 0;
+  }
+  if( c == '\r' ) {
+    buf[pos] = ' ';
+    return 0;
+  }
+
+  /* '\n': a "." followed only by spaces ends the header */
+  int end = pos, p = pos - 1, is_done = HMS_FALSE;
+  while( p >= idx->line_start && buf[p] == ' ' ) { p--; }
+  if( p >= idx->line_start && buf[p] == '.' ) { end = p; is_done = HMS_TRUE; }
+
+  if( __hms_scan_add_line( idx, idx->line_start, end, idx->colon ) ) { return -1; }
+  idx->line_start = pos + 1;
+  idx->colon = -1;
+
+  if( is_done ) {
+    idx->dot = end;
+    idx->hdr_len = pos + 1;
+    return 1;
+  }
+
+  return 0;
+
+} /* end __hms_scan_event() */
+
+static int __hms_scan_scalar( char *buf, int len, hms_scan_index *idx ) {
+
+  int i;
+  for( i = idx->scanned; i < len; i++ ) {
+    char c = buf[i];
+    if( c == '\n' || c == ':' || c == '\r' ) {
+      int ret = __hms_scan_event( buf, i, idx );
+      if( ret ) { idx->scanned = i + 1; return ret; }
+    }
+  }
+  idx->scanned = len;
+
+  return 0;
+
+} /* end __hms_scan_scalar() */
+
+#ifdef HMS_SCAN_HAVE_X86
+
+__attribute__((target("sse2")))
+static int __hms_scan_sse2( char *buf, int len, hms_scan_index *idx ) {
+
+  const __m128i nl = _mm_set1_epi8( '\n' );
+  const __m128i co = _mm_set1_epi8( ':' );
+  const __m128i cr = _mm_set1_epi8( '\r' );
+
+  int i;
+  for( i = idx->scanned; i + 16 <= len; i += 16 ) {
+    __m128i v = _mm_loadu_si128( (const __m128i *) (buf + i) );
+    __m128i m = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( v, nl ),
+					    _mm_cmpeq_epi8( v, co ) ),
+			      _mm_cmpeq_epi8( v, cr ) );
+    unsigned mask = (unsigned) _mm_movemask_epi8( m );
+    while( mask ) {
+      int pos = i + __builtin_ctz( mask );
+      int ret = __hms_scan_event( buf, pos, idx );
+      if( ret ) { idx->scanned = pos + 1; return ret; }
+      mask &= mask - 1;
+    }
+  }
+  idx->scanned = i;
+
+  /* tail */
+  return __hms_scan_scalar( buf, len, idx );
+
+} /* end __hms_scan_sse2() */
+
+__attribute__((target("avx2")))
+static int __hms_scan_avx2( char *buf, int len, hms_scan_index *idx ) {
+
+  const __m256i nl = _mm256_set1_epi8( '\n' );
+  const __m256i co = _mm256_set1_epi8( ':' );
+  const __m256i cr = _mm256_set1_epi8( '\r' );
+
+  int i;
+  for( i = idx->scanned; i + 32 <= len; i += 32 ) {
+    __m256i v = _mm256_loadu_si256( (const __m256i *) (buf + i) );
+    __m256i m = _mm256_or_si256( _mm256_or_si256( _mm256_cmpeq_epi8( v, nl ),
+						  _mm256_cmpeq_epi8( v, co ) ),
+				 _mm256_cmpeq_epi8( v, cr ) );
+    unsigned mask = (unsigned) _mm256_movemask_epi8( m );
+    while( mask ) {
+      int pos = i + __builtin_ctz( mask );
+      int ret = __hms_scan_event( buf, pos, idx );
+      if( ret ) { idx->scanned = pos + 1; return ret; }
+      mask &= mask - 1;
+    }
+  }
+  idx->scanned = i;
+
+  /* tail */
+  return __hms_scan_sse2( buf, len, idx );
+
+} /* end __hms_scan_avx2() */
+
+#endif /* HMS_SCAN_HAVE_X86 */
@@ -0,0 +1,359 @@
+/**
+ * HERMES
+ * ------
+ * by Gokul Soundararajan
+ *
+ * A C implementation of the Hermes protocol
+ * - contains a minimal io_uring driver for the event loops
+ *
+ **/
+
+#include <hermes.h>
+#include <hermes_internal.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+/* fast poll came with provided buffers (5.7): both are needed */
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_FAST_POLL)
+#define HMS_HAVE_URING
+#endif
+#endif
+
+/* the only buffer group */
+#define HMS_URING_GROUP 1
+
+#ifdef HMS_HAVE_URING
+
+/**
+ * Completions of operations queued by the ring itself (returned
+ * buffers) carry the ring as their data and are not reported.
+ **/
+typedef struct hms_uring {
+  int fd;
+  unsigned features;
+  /* submission queue */
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_entries;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned sq_local_tail;
+  /* completion queue */
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  /* mappings */
+  void *sq_ptr;
+  size_t sq_size;
+  void *cq_ptr;
+  size_t cq_size;
+  size_t sqes_size;
+  /* provided receive buffers */
+  char *bufs;
+  int nbufs;
+  int buf_size;
+} hms_uring;
+
+/* Function prototypes */
+/* ---------------------------------------------------- */
+static int __hms_uring_enter( hms_uring *ring, unsigned to_submit, unsigned min_complete, unsigned flags );
+static struct io_uring_sqe *__hms_uring_sqe( hms_uring *ring );
+static int __hms_uring_provide( hms_uring *ring, int bid, int count );
+
+/* Implementation */
+/* ---------------------------------------------------- */
+
+/**
+ * Sets up a ring and hands it nbufs receive buffers of buf_size bytes.
+ * Returns NULL when the kernel lacks io_uring or the features used here
+ * (fast poll, provided buffers), so callers can fall back to epoll.
+ **/
+hms_uring *hms_uring_create( unsigned entries, int nbufs, int buf_size ) {
+
+  struct io_uring_params params;
+  hms_uring *ring = NULL;
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (int) 0, (int) entries );
+  hms_assert_not_equals( __FILE__, __LINE__, (int) 0, (int) nbufs );
+  hms_assert_not_equals( __FILE__, __LINE__, (int) 0, (int) buf_size );
+
+  ring = calloc( 1, sizeof(hms_uring) );
+  if( !ring ) { return NULL; }
+  ring->sq_ptr = ring->cq_ptr = ring->sqes = MAP_FAILED;
+
+  /* every connection may have a receive in flight: room for completions */
+  memset( &params, 0, sizeof(params) );
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = 4 * entries;
+  ring->fd = syscall( __NR_io_uring_setup, entries, &params );
+  if( ring->fd < 0 ) { free( ring ); return NULL; }
+  ring->features = params.features;
+  if( !(ring->features & IORING_FEAT_FAST_POLL) || !(ring->features & IORING_FEAT_NODROP) ) {
+    goto failed;
+  }
+
+  /* map the queues */
+  ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if( ring->features & IORING_FEAT_SINGLE_MMAP ) {
+    if( ring->cq_size > ring->sq_size ) { ring->sq_size = ring->cq_size; }
+    ring->cq_size = ring->sq_size;
+  }
+  ring->sq_ptr = mmap( NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       ring->fd, IORING_OFF_SQ_RING );
+  if( ring->sq_ptr == MAP_FAILED ) { goto failed; }
+  if( ring->features & IORING_FEAT_SINGLE_MMAP ) {
+    ring->cq_ptr = ring->sq_ptr;
+  } else {
+    ring->cq_ptr = mmap( NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			 ring->fd, IORING_OFF_CQ_RING );
+    if( ring->cq_ptr == MAP_FAILED ) { goto failed; }
+  }
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap( NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		     ring->fd, IORING_OFF_SQES );
+  if( ring->sqes == MAP_FAILED ) { goto failed; }
+
+  ring->sq_head = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.head);
+  ring->sq_tail = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.tail);
+  ring->sq_mask = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.ring_mask);
+  ring->sq_entries = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.ring_entries);
+  ring->sq_array = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.array);
+  ring->sq_local_tail = *ring->sq_tail;
+  ring->cq_head = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.head);
+  ring->cq_tail = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.tail);
+  ring->cq_mask = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ptr + params.cq_off.cqes);
+
+  /* hand over the buffers and wait: a kernel without provided buffers
+     fails this, not the first receive */
+  ring->nbufs = nbufs;
+  ring->buf_size = buf_size;
+  ring->bufs = malloc( (size_t) nbufs * buf_size );
+  if( !ring->bufs ) { goto failed; }
+  if( __hms_uring_provide( ring, 0, nbufs ) != 0 ) { goto failed; }
+  if( __hms_uring_enter( ring, 1, 1, IORING_ENTER_GETEVENTS ) < 0 ) { goto failed; }
+  {
+    unsigned head = *ring->cq_head;
+    if( head == __atomic_load_n( ring->cq_tail, __ATOMIC_ACQUIRE ) ) { goto failed; }
+    int res = ring->cqes[head & *ring->cq_mask].res;
+    __atomic_store_n( ring->cq_head, head + 1, __ATOMIC_RELEASE );
+    if( res < 0 ) { goto failed; }
+  }
+
+  return ring;
+
+ failed:
+  hms_uring_destroy( ring );
+  return NULL;
+
+} /* end hms_uring_create() */
+
+/* Closing the ring cancels what is still queued; call it once the
+   thread that submitted is gone */
+void hms_uring_destroy( hms_uring *ring ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) ring );
+
+  if( ring->sqes != MAP_FAILED ) { munmap( ring->sqes, ring->sqes_size ); }
+  if( ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr ) { munmap( ring->cq_ptr, ring->cq_size ); }
+  if( ring->sq_ptr != MAP_FAILED ) { munmap( ring->sq_ptr, ring->sq_size ); }
+  if( ring->fd >= 0 ) { close( ring->fd ); }
+  if( ring->bufs ) { free( ring->bufs ); }
+  free( ring );
+
+} /* end hms_uring_destroy() */
+
+/* Queues an accept; the new socket is non-blocking */
+int hms_uring_accept( hms_uring *ring, int fd, void *data ) {
+
+  struct io_uring_sqe *sqe = __hms_uring_sqe( ring );
+  if( !sqe ) { return -1; }
+
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = (uint64_t) (uintptr_t) data;
+
+  return 0;
+
+} /* end hms_uring_accept() */
+
+/* Queues a receive into whichever provided buffer is free then */
+int hms_uring_recv( hms_uring *ring, int fd, void *data ) {
+
+  struct io_uring_sqe *sqe = __hms_uring_sqe( ring );
+  if( !sqe ) { return -1; }
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->len = ring->buf_size;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = HMS_URING_GROUP;
+  sqe->user_data = (uint64_t) (uintptr_t) data;
+
+  return 0;
+
+} /* end hms_uring_recv() */
+
+int hms_uring_read( hms_uring *ring, int fd, void *buf, int len, void *data ) {
+
+  struct io_uring_sqe *sqe = __hms_uring_sqe( ring );
+  if( !sqe ) { return -1; }
+
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) (uintptr_t) buf;
+  sqe->len = len;
+  sqe->user_data = (uint64_t) (uintptr_t) data;
+
+  return 0;
+
+} /* end hms_uring_read() */
+
+/* Completes once fd has one of the poll "events" (POLLOUT and so on) */
+int hms_uring_poll( hms_uring *ring, int fd, int events, void *data ) {
+
+  struct io_uring_sqe *sqe = __hms_uring_sqe( ring );
+  if( !sqe ) { return -1; }
+
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll_events = events;
+  sqe->user_data = (uint64_t) (uintptr_t) data;
+
+  return 0;
+
+} /* end hms_uring_poll() */
+
+/* Gives a buffer back once its bytes are used; goes out with the next wait */
+int hms_uring_put_buffer( hms_uring *ring, int bid ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) ring );
+
+  if( bid < 0 || bid >= ring->nbufs ) { return -1; }
+
+  return __hms_uring_provide( ring, bid, 1 );
+
+} /* end hms_uring_put_buffer() */
+
+/**
+ * Submits everything queued since the last call and waits for at least
+ * one completion, in a single system call. Returns up to "max" events,
+ * or -1 with errno set (EINTR included).
+ **/
+int hms_uring_wait( hms_uring *ring, hms_uring_event *events, int max ) {
+
+  /* Check input */
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) ring );
+  hms_assert_not_equals( __FILE__, __LINE__, (uintptr_t) NULL, (uintptr_t) events );
+
+  unsigned head, tail, to_submit;
+  int n = 0;
+
+  while( n == 0 ) {
+
+    /* nothing to wait for if completions are already there */
+    head = *ring->cq_head;
+    tail = __atomic_load_n( ring->cq_tail, __ATOMIC_ACQUIRE );
+    to_submit = ring->sq_local_tail - __atomic_load_n( ring->sq_head, __ATOMIC_ACQUIRE );
+    if( head == tail || to_submit > 0 ) {
+      if( __hms_uring_enter( ring, to_submit, (head == tail) ? 1 : 0, IORING_ENTER_GETEVENTS ) < 0 ) {
+	/* completions held back by the kernel still get reaped below */
+	if( errno != EBUSY ) { return -1; }
+      }
+      tail = __atomic_load_n( ring->cq_tail, __ATOMIC_ACQUIRE );
+    }
+
+    for( ; head != tail && n < max; head++ ) {
+      struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+      void *data = (void *) (uintptr_t) cqe->user_data;
+      if( data == (void *) ring ) { continue; }
+      events[n].data = data;
+      events[n].res = cqe->res;
+      events[n].buf = NULL;
+      events[n].bid = -1;
+      if( cqe->flags & IORING_CQE_F_BUFFER ) {
+	events[n].bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	events[n].buf = ring->bufs + (size_t) events[n].bid * ring->buf_size;
+      }
+      n++;
+    }
+    __atomic_store_n( ring->cq_head, head, __ATOMIC_RELEASE );
+
+  } /* end while() */
+
+  return n;
+
+} /* end hms_uring_wait() */
+
+/* Internal functions */
+/* ---------------------------------------------------- */
+
+static int __hms_uring_enter( hms_uring *ring, unsigned to_submit, unsigned min_complete, unsigned flags ) {
+
+  return syscall( __NR_io_uring_enter, ring->fd, to_submit, min_complete, flags, NULL, 0 );
+
+} /* end __hms_uring_enter() */
+
+/* A zeroed entry, already published at the tail; NULL if the queue
+   stays full after submitting what is in it */
+static struct io_uring_sqe *__hms_uring_sqe( hms_uring *ring ) {
+
+  unsigned head = __atomic_load_n( ring->sq_head, __ATOMIC_ACQUIRE );
+  if( ring->sq_local_tail - head >= *ring->sq_entries ) {
+    if( __hms_uring_enter( ring, ring->sq_local_tail - head, 0, 0 ) < 0 && errno != EBUSY ) { return NULL; }
+    head = __atomic_load_n( ring->sq_head, __ATOMIC_ACQUIRE );
+    if( ring->sq_local_tail - head >= *ring->sq_entries ) { return NULL; }
+  }
+
+  unsigned idx = ring->sq_local_tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[idx];
+  memset( sqe, 0, sizeof(*sqe) );
+  ring->sq_array[idx] = idx;
+  ring->sq_local_tail++;
+  /* the caller fills the entry before the next enter reads it */
+  __atomic_store_n( ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE );
+
+  return sqe;
+
+} /* end __hms_uring_sqe() */
+
+static int __hms_uring_provide( hms_uring *ring, int bid, int count ) {
+
+  struct io_uring_sqe *sqe = __hms_uring_sqe( ring );
+  if( !sqe ) { return -1; }
+
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = count;
+  sqe->addr = (uint64_t) (uintptr_t) (ring->bufs + (size_t) bid * ring->buf_size);
+  sqe->len = ring->buf_size;
+  sqe->off = bid;
+  sqe->buf_group = HMS_URING_GROUP;
+  sqe->user_data = (uint64_t) (uintptr_t) ring;
+
+  return 0;
+
+} /* end __hms_uring_provide() */
+
+#else
+
+/* No io_uring here: the event loops use epoll */
+struct hms_uring *hms_uring_create( unsigned entries, int nbufs, int buf_size ) { return NULL; }
+void hms_uring_destroy( struct hms_uring *ring ) { }
+int  hms_uring_accept( struct hms_uring *ring, int fd, void *data ) { return -1; }
+int  hms_uring_recv( struct hms_uring *ring, int fd, void *data ) { return -1; }
+int  hms_uring_read( struct hms_uring *ring, int fd, void *buf, int len, void *data ) { return -1; }
+int  hms_uring_poll( struct hms_uring *ring, int fd, int events, void *data ) { return -1; }
+int  hms_uring_put_buffer( struct hms_uring *ring, int bid ) { return -1; }
+int  hms_uring_wait( struct hms_uring *ring, hms_uring_event *events, int max ) { errno = ENOSYS; return -1; }
+
+#endif
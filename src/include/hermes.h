@@ -24,6 +24,7 @@
 #include <netinet/in.h> 
 #include <netinet/tcp.h>
 #include <sys/socket.h> 
+#include <sys/uio.h>
 #include <assert.h>
 #include <signal.h>
 #include <sys/time.h>
@@ -36,6 +37,18 @@
 #include <hms_list.h>
 
 #define HERMES_MAX_HDR_SIZE 1024
+#define HERMES_MAX_BODY_SIZE (64*1024*1024)
+#define HERMES_RBUF_SIZE    8192
+#define HERMES_MSG_POOL_BYTES (256*1024)
+#define HERMES_BACKLOG      SOMAXCONN
+#define HERMES_MAX_PENDING_CONNS 10
+#define HERMES_MAX_PENDING_MSGS  1024
+#define HERMES_MAX_VERBS    64
+#define HERMES_MAX_VERB_LEN 31
+#define HERMES_MAX_CONNS    4096
+#define HERMES_CACHE_LINE   64
+#define HERMES_MAX_OUTBOUND (4*1024*1024)
+#define HERMES_SEND_TIMEOUT 5000
 #undef HERMES_ENABLE_CHECKSUMS 
 
 /* Restricted headers */
@@ -46,6 +59,14 @@ typedef struct hashtab hashtab;
 
 enum hms_bool { HMS_FALSE=0, HMS_TRUE=1 };
 enum hms_type { HERMES_SERVER=0, HERMES_CLIENT=1 };
+/* what happens to a connection whose outbound queue is full */
+enum hms_slow_policy { HMS_SLOW_CLOSE=0, HMS_SLOW_DROP=1 };
+
+/* a connection served by event loops with staged replies, good from
+   any thread: slot in the connection slab and its generation; 0 is
+   never a connection, and is what hms_endpoint_conn() gives for any
+   other (thread-per-connection, or replies not staged) */
+typedef uint64_t hms_conn;
 
 struct hms_endpoint;
 struct hms_msg;
@@ -53,15 +74,45 @@ struct hms;
 struct hms_msg_uheader;
 struct hms_msg_nheader;
 
+/* header/message flags: storage the owner must not free */
+#define HMS_BORROWED_STR   0x1
+#define HMS_BORROWED_NODE  0x2
+#define HMS_BORROWED_VERB  0x4
+#define HMS_BORROWED_BODY  0x8
+/* body length is known but the bytes are not in the message */
+#define HMS_BODY_PENDING   0x10
+#define HMS_BODY_STREAMED  0x20
+#define HMS_BORROWED_INDEX 0x40
+
+/* frees a body handed to a message with hms_msg_take_body() */
+typedef void (*hms_body_free)( void *arg, char *data, int len );
+
 typedef struct hms_msg_uheader {
   char *val;
+  int val_len;
+  unsigned flags;
   struct hms_list_head lh;
 } hms_msg_uheader;
 
+/* per-thread pools of destroyed messages, summed over all threads */
+typedef struct hms_msg_pool_stats {
+  long hits;      /* creates served from a pool */
+  long misses;    /* creates that had to malloc */
+  long recycled;  /* destroys kept for reuse */
+  long dropped;   /* destroys freed because the pool was full */
+  long bytes;     /* held by the pools right now */
+} hms_msg_pool_stats;
+
 typedef struct hms_msg_nheader {
   char *key;
   char *val;
+  int key_len;
+  int val_len;
+  unsigned flags;
   struct hms_list_head lh;
+  /* key index: hash of the case-folded key, next in the same bucket */
+  unsigned hash;
+  struct hms_msg_nheader *hnext;
 } hms_msg_nheader;
 
 typedef struct hms_msg {
@@ -79,20 +130,204 @@ typedef struct hms_msg {
   /* named headers */
   struct hms_msg_nheader named_headers;
   int num_named_headers;
+  /* built once a message has a few named headers; size is a power of 2 */
+  struct hms_msg_nheader **index;
+  int index_size;
 
   /* content */
   int content_len;
   char *content;
+  /* frees content that is not borrowed; NULL means free() */
+  hms_body_free content_free;
+  void *content_free_arg;
+
+  /* bytes hms_msg_print_header() writes, kept up to date by every
+     change to the verb and headers */
+  int hdr_size;
+
+  /* zero-copy parse: headers are views into a buffer the message owns */
+  unsigned flags;
+  int verb_len;
+  char *buffer;
+
+  /* arena: header nodes, strings and small bodies are carved from the
+     tail of the message's own allocation and freed with it */
+  char *arena;
+  int arena_used;
+  int arena_size;
 
 } hms_msg;
 
+/* zero the struct before filling it in: unset callbacks must be NULL */
 typedef struct hms_ops {
   int (*hms_validate) ( struct hms_endpoint *endpoint, hms_msg *msg );
   int (*hms_accepts)  ( struct hms_endpoint *endpoint, hms_msg *msg );
   int (*hms_handle)   ( struct hms_endpoint *endpoint, hms_msg *msg );
+  /* optional: the body of an accepted message in pieces, before hms_handle
+     runs. offset is within the body; data is NULL if the body was cut short */
+  int (*hms_body)     ( struct hms_endpoint *endpoint, hms_msg *msg, char *data, int len, int offset );
+  /* optional: asked first for the body of an accepted message. Return 0 to
+     have hermes write it to *fd from *offset on without going through
+     hms_body or the message. fd is NULL if the body was cut short */
+  int (*hms_sink)     ( struct hms_endpoint *endpoint, hms_msg *msg, int *fd, off_t *offset );
   /* TODO: provide logging function */
 } hms_ops;
 
+/* a verb routed straight to its own ops */
+typedef struct hms_verb {
+  char name[HERMES_MAX_VERB_LEN + 1];
+  int len;
+  unsigned hash;
+  int used;
+  hms_ops ops;
+} hms_verb;
+
+/* verbs registered with hermes_register_verb(), by case-folded hash */
+typedef struct hms_verb_table {
+  hms_verb slots[2 * HERMES_MAX_VERBS];
+  int count;
+  /* some verb takes its body through hms_body or hms_sink */
+  int streams;
+} hms_verb_table;
+
+/* manager settings: fill in defaults with hms_config_init() first */
+typedef struct hms_config {
+  int num_threads;
+  int server_port;
+  /* per connection: receive buffer start size and header size limit */
+  int rbuf_size;
+  int max_hdr_size;
+  /* per connection: largest body read into memory, 0 for no bound; a
+     longer Content-Length fails the message. Bodies streamed to a
+     handler are not held, so not bounded */
+  int max_body_size;
+  /* answer bare PING, INFO and BYE messages before parsing them; the
+     handlers never see those, so only for servers that do not accept them.
+     Event loops and shards do it too, unless pipeline_depth > 1 */
+  int fast_replies;
+  /* epoll loops serving all connections, workers only run for complete
+     messages; 0 keeps a worker per connection. Handlers must not read
+     from the endpoint themselves in this mode (Linux only) */
+  int event_loops;
+  /* SO_REUSEPORT shards, each with its own listener, event loop and
+     num_threads workers pinned to one CPU; replaces event_loops. If a
+     loop or a shard's listener cannot be set up (the port is taken,
+     say), hermes_init_with_config() returns NULL */
+  int shards;
+  /* pending connections per listener */
+  int backlog;
+  /* event loops and shards accept and receive through io_uring when the
+     kernel has it (5.7 or later), epoll otherwise */
+  int io_uring;
+  /* set on the listeners, accepted sockets inherit them; 0 keeps the
+     system's buffer sizes */
+  int tcp_nodelay;
+  int sndbuf;
+  int rcvbuf;
+  /* admission control: connections waiting for a worker (a worker per
+     connection) and messages waiting for one (event loops, per pool).
+     Past these a connection is closed and a message dropped, after a
+     BUSY reply if busy_reply is set (without one, the connection of a
+     dropped message is closed as well) */
+  int max_pending_conns;
+  int max_pending_msgs;
+  int busy_reply;
+  /* event loops and shards as a staged pipeline: the loops (the I/O
+     stage, event_loops or shards threads) read and parse, num_threads
+     workers (the handler stage) run handlers, and replies go back
+     through the loop's send queue. Handlers never touch the socket */
+  int staged_replies;
+  /* with event loops: requests of one connection handled at once. Above
+     1 they run on different workers in parallel and their replies are
+     written in request order; implies staged_replies. Handlers must then
+     be safe to run side by side for the same endpoint */
+  int pipeline_depth;
+  /* servers: connections in the slab allocated at init (connections
+     past it are turned away like shed ones). Event loops: bytes queued
+     per connection and not yet written before the slow-consumer policy
+     applies (0: no bound); with pipeline_depth > 1 that includes
+     replies held for earlier requests.
+     HMS_SLOW_CLOSE shuts the connection down, HMS_SLOW_DROP refuses the
+     message with an error to its sender */
+  int max_conns;
+  int max_outbound;
+  int slow_consumer;
+  /* event loops without staged replies: ms a worker waits for a reader
+     that takes no more of a reply before the connection is shut down
+     (-1: no limit) */
+  int send_timeout;
+} hms_config;
+
+/* accepting connections, summed over all listeners */
+typedef struct hms_listen_stats {
+  long accepted;    /* connections taken off the accept queues */
+  long wakeups;     /* times a listener was drained */
+  long queue_full;  /* wakeups that found an accept queue at its backlog */
+  int  queue_peak;  /* most connections seen waiting in one queue */
+  long overflows;   /* host-wide since init: SYNs a full queue dropped (ListenOverflows) */
+  long drops;       /* host-wide since init: all listen drops (ListenDrops) */
+} hms_listen_stats;
+
+/* work turned away by admission control */
+typedef struct hms_shed_stats {
+  long connections; /* closed while all workers were busy */
+  long requests;    /* messages dropped while the queue was full */
+  long slow;        /* replies refused or connections shut past max_outbound
+		       or send_timeout */
+} hms_shed_stats;
+
+/* depth of each stage of the event loops, summed over loops and pools */
+typedef struct hms_stage_stats {
+  int  io_threads;      /* event loops or shards */
+  int  handler_threads; /* workers running handlers */
+  long handler_queued;  /* complete messages waiting for a worker */
+  long send_queued;     /* connections with replies not yet written (staged_replies) */
+  long send_bytes;      /* bytes of those replies */
+} hms_stage_stats;
+
+/* a reply serialized once, then sent as is any number of times */
+typedef struct hms_reply_template {
+  char *data;
+  int len;
+} hms_reply_template;
+
+/* connection slab occupancy */
+typedef struct hms_conn_stats {
+  int  capacity;  /* slots, config.max_conns */
+  int  used;      /* connections open right now */
+  int  peak;      /* most open at once */
+  long refused;   /* connections turned away with every slot in use */
+} hms_conn_stats;
+
+/* one epoll (or io_uring) loop and the connections it watches */
+typedef struct hms_loop {
+  struct hms *manager;
+  int epoll_fd;
+  /* io_uring instead of epoll_fd, if set */
+  struct hms_uring *ring;
+  /* written to stop the loop, and with a ring to hand it sockets */
+  int wake_fd;
+  uint64_t wake_count;
+  pthread_t thread;
+  /* shard: its own listener, workers and CPU; otherwise -1, -1 and the
+     manager's pool */
+  int listen_fd;
+  int cpu;
+  tpool_t pool;
+  /* all endpoints of this loop, idle or with a worker */
+  pthread_mutex_t lock;
+  struct hms_list_head endpoints;
+  /* with a ring: endpoints waiting for their next receive to be queued */
+  struct hms_endpoint *arm;
+  /* staged replies: endpoints handed over to write (or close), and the
+     epoll set of sockets waiting to take more; both depths counted */
+  int staged;
+  int out_fd;
+  struct hms_endpoint *sendq;
+  long send_conns;
+  long send_bytes;
+} hms_loop;
+
 typedef struct hms {
   /* server socket */
   int server_socket;
@@ -102,37 +337,175 @@ typedef struct hms {
   int status;
   int shutdown;
   int num_threads;
+  hms_config config;
 
   /* connection handlers */
   tpool_t pool;
 
+  /* event loops, when config.event_loops > 0 */
+  hms_loop *loops;
+  int num_loops;
+  unsigned next_loop;
+  int sharded;
+
+  /* accept counters, and the host's drop counters at init */
+  hms_listen_stats listen_stats;
+  long listen_overflows;
+  long listen_drops;
+  hms_shed_stats shed_stats;
+
+  /* every accepted connection's endpoint, by handle */
+  struct hms_conn_slab *conns;
+
   /* functions */
   hms_ops dops;
   hms_ops ops;
+  hms_verb_table verbs;
 
   /* mutexes */
   pthread_mutex_t manager_lock;
   
 } hms;
 
+/* one of the requests of a connection handled in parallel */
+typedef struct hms_request {
+  struct hms_endpoint *endpoint;
+  hms_msg *msg;
+  /* its replies, held back until those of earlier requests are out */
+  char *out;
+  int out_len;
+  int out_cap;
+  int done;
+  /* its handler's serialized headers */
+  char *wbuf;
+  int wbuf_cap;
+} hms_request;
+
 enum hms_endpoint_state { HMS_ENDPOINT_FREE=0, HMS_ENDPOINT_USED=1 };
 
+/* receive buffer: bytes in [start,end) are read but not yet parsed */
+typedef struct hms_rbuf {
+  char *buf;
+  int cap;
+  int start;
+  int end;
+  /* size of a fresh buffer; headers grow it up to the header limit */
+  int init_cap;
+  /* read only what the current message needs */
+  int no_readahead;
+  /* hand the buffer to parsed messages instead of copying out */
+  int zero_copy;
+  /* largest body read into memory, 0 for no bound */
+  int max_body;
+  /* header index of the message being read */
+  hms_scan_index idx;
+  /* pipe for splicing bodies to a file, opened on first use */
+  int splice_pipe[2];
+} hms_rbuf;
+
+/* push parser: fed bytes as they arrive, keeps all progress itself */
+enum hms_parse_status { HMS_PARSE_ERROR=-1, HMS_PARSE_MORE=0, HMS_PARSE_DONE=1 };
+enum hms_parse_state  { HMS_PARSE_HEADER=0, HMS_PARSE_BODY=1 };
+
+typedef struct hms_parser {
+  int max_hdr_len;
+  /* 0 for no bound */
+  int max_body_len;
+  int state;
+  /* current message: header bytes, then body bytes */
+  char *buf;
+  int cap;
+  int used;
+  hms_scan_index idx;
+  int hdr_len;
+  int body_len;
+  /* built once the header is complete */
+  hms_msg *msg;
+} hms_parser;
+
 typedef struct hms_endpoint {
   /* connected socket */
   int socket;
+  /* receive buffer */
+  hms_rbuf rbuf;
+  int max_hdr_size;
+  int fast_replies;
+  /* serialized headers of outgoing messages, kept between sends */
+  char *wbuf;
+  int wbuf_cap;
   /* start time */
   struct timeval start;
   /* status */
   int status;
-  /* functions */
+  /* functions; verbs of the manager that accepted it, if any */
   hms_ops ops;
-  /* mutexes */
+  hms_verb_table *verbs;
+  /* handler state, hermes never touches it */
+  void *data;
+  /* event loop serving: owning loop, parser state, message for a worker */
+  hms_loop *loop;
+  hms_parser *parser;
+  hms_msg *msg;
+  struct hms_list_head lh;
+  struct hms_endpoint *arm_next;
+  /* staged replies: handlers append to out under meta_lock, the loop
+     swaps it with sending and writes that; closing once all is out */
+  char *out;
+  int out_len;
+  int out_cap;
+  char *sending;
+  int sending_len;
+  int sending_cap;
+  int sent;
+  int out_wait;
+  int closing;
+  int posted;
+  struct hms_endpoint *send_next;
+  /* pipeline_depth > 1: a ring of requests in flight from head to tail,
+     released in order; reading parks while it is full */
+  hms_request *reqs;
+  int req_depth;
+  unsigned req_head;
+  unsigned req_tail;
+  int parked;
+  int close_asked;
+  /* handle and slab of a connection a manager accepted (0 and NULL
+     otherwise), and bytes queued for it and not yet written */
+  hms_conn conn;
+  struct hms_conn_slab *slab;
+  long unsent;
+  /* mutexes; the last member: a slab endpoint keeps its lock */
   pthread_mutex_t meta_lock;
 } hms_endpoint;
 
+/* connection slab: endpoints preallocated at init, one per cache-line
+   aligned slot, free slots on a lock-free stack. A slot's generation
+   changes when it is freed, so an old handle finds nothing */
+typedef struct hms_conn_slot {
+  hms_endpoint endpoint;
+  unsigned gen;
+  unsigned next_free;
+} __attribute__((aligned(HERMES_CACHE_LINE))) hms_conn_slot;
+
+typedef struct hms_conn_slab {
+  hms_conn_slot *slots;
+  int size;
+  /* top of the free stack: slot + 1 (0 when empty), a tag above */
+  uint64_t free_head;
+  int used;
+  int peak;
+  long refused;
+} hms_conn_slab;
+
 typedef struct hms_connector {
   /* connected socket */
   int socket;
+  /* receive buffer */
+  hms_rbuf rbuf;
+  int max_hdr_size;
+  /* serialized headers of outgoing messages, kept between sends */
+  char *wbuf;
+  int wbuf_cap;
   /* start time */
   struct timeval start;
   /* status */
@@ -147,14 +520,27 @@ typedef struct hms_connector {
 
 /* Manager */
 /* ----------------------------------------------------- */
+void           hms_config_init( hms_config *config );
 hms*           hermes_init( int num_threads , int server_port, hms_ops ops );
+hms*           hermes_init_with_config( hms_config *config, hms_ops ops );
 int            hermes_shutdown( hms *manager, int force );
+void           hermes_get_listen_stats( hms *manager, hms_listen_stats *stats );
+void           hermes_get_shed_stats( hms *manager, hms_shed_stats *stats );
+void           hermes_get_stage_stats( hms *manager, hms_stage_stats *stats );
+void           hermes_get_conn_stats( hms *manager, hms_conn_stats *stats );
+int            hermes_register_verb( hms *manager, const char *verb, hms_ops ops );
+int            hermes_send_msg( hms *manager, hms_conn conn, hms_msg *msg );
+int            hermes_send_template( hms *manager, hms_conn conn, hms_reply_template *tmpl );
 
 /* Endpoint */
 /* ----------------------------------------------------- */
 hms_endpoint*  hms_endpoint_init( int fd, hms_ops ops );
 int            hms_endpoint_recv_msg( hms_endpoint *endpoint, hms_msg **msg );
 int            hms_endpoint_send_msg( hms_endpoint *endpoint, hms_msg *msg );
+int            hms_endpoint_send_template( hms_endpoint *endpoint, hms_reply_template *tmpl );
+hms_conn       hms_endpoint_conn( hms_endpoint *endpoint );
+int            hms_endpoint_set_hdr_size( hms_endpoint *endpoint, int rbuf_size, int max_hdr_size );
+int            hms_endpoint_set_body_size( hms_endpoint *endpoint, int max_body_size );
 int            hms_endpoint_destroy( hms_endpoint *endpoint );
 
 /* Connector */
@@ -162,8 +548,22 @@ int            hms_endpoint_destroy( hms_endpoint *endpoint );
 hms_connector* hms_connector_init( char *hostname, int port );
 int            hms_connector_recv_msg( hms_connector *connector, hms_msg **msg );
 int            hms_connector_send_msg( hms_connector *connector, hms_msg *msg );
+int            hms_connector_set_hdr_size( hms_connector *connector, int rbuf_size, int max_hdr_size );
 int            hms_connector_destroy( hms_connector *connector );
 
+/* Reply templates */
+/* ----------------------------------------------------- */
+hms_reply_template* hms_reply_template_create( hms_msg *msg );
+int            hms_reply_template_destroy( hms_reply_template *tmpl );
+
+/* Push parser */
+/* ----------------------------------------------------- */
+hms_parser*    hms_parser_create( int max_hdr_len );
+int            hms_parser_set_max_body( hms_parser *parser, int max_body_len );
+int            hms_parser_feed( hms_parser *parser, char *data, int len, int *consumed, hms_msg **msg );
+int            hms_parser_reset( hms_parser *parser );
+int            hms_parser_destroy( hms_parser *parser );
+
 /* Message */
 /* ----------------------------------------------------- */
 hms_msg *      hms_msg_create();
@@ -173,21 +573,33 @@ int            hms_msg_print_header( hms_msg *msg, char *buffer, int len);
 
 int            hms_msg_set_verb(hms_msg *msg, char *verb );
 int            hms_msg_get_verb(hms_msg *msg, char **verb );
+int            hms_msg_peek_verb( hms_msg *msg, const char **verb, int *len );
 
 int            hms_msg_add_header(hms_msg *msg, char *header );
 int            hms_msg_get_header(hms_msg *msg, int index, char **value );
+int            hms_msg_peek_header( hms_msg *msg, int index, const char **value, int *len );
 int            hms_msg_del_header(hms_msg *msg, int index );
 int            hms_msg_num_headers( hms_msg *msg );
 
 int            hms_msg_add_named_header( hms_msg *msg, char *key, char *value );
 int            hms_msg_get_named_header( hms_msg *msg, char *key, char **value );
+int            hms_msg_peek_named_header( hms_msg *msg, const char *key, const char **value, int *len );
 int            hms_msg_del_named_header( hms_msg *msg, char *key );
 int            hms_msg_num_named_headers( hms_msg *msg );
 
 int            hms_msg_get_body_size( hms_msg *msg );
 int            hms_msg_get_body( hms_msg *msg, char **data, int *len );
+int            hms_msg_peek_body( hms_msg *msg, const char **data, int *len );
 int            hms_msg_set_body( hms_msg *msg, char *data, int len );
 int            hms_msg_del_body( hms_msg *msg );
+int            hms_msg_take_body( hms_msg *msg, char *data, int len,
+				  hms_body_free free_fn, void *arg );
+int            hms_msg_release_body( hms_msg *msg, char **data, int *len,
+				     hms_body_free *free_fn, void **arg );
+
+void           hms_msg_pool_set_limit( int max_bytes );
+int            hms_msg_pool_get_limit( void );
+void           hms_msg_pool_get_stats( hms_msg_pool_stats *stats );
 
 
 /* Util */
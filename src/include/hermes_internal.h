@@ -13,6 +13,7 @@
 #include <err.h>
 
 struct hms_msg;
+struct hms_rbuf;
 
 /* Assertions */
 /* ---------------------------------------------------- */
@@ -20,8 +21,105 @@ struct hms_msg;
 void hms_assert_equals( char * name, unsigned id, int expected , int condition );
 void hms_assert_not_equals( char *name, unsigned id, int expected, int condition );
 
+/* Header scanner */
+/* ---------------------------------------------------- */
+
+enum hms_scan_impl { HMS_SCAN_SCALAR=0, HMS_SCAN_SSE2=1, HMS_SCAN_AVX2=2 };
+
+/* offsets are relative to the start of the header */
+typedef struct hms_scan_line {
+  int start;
+  int end;    /* '\n' or the terminating "." */
+  int colon;  /* first ':' or -1 */
+} hms_scan_line;
+
+typedef struct hms_scan_index {
+  /* scanner state, kept between calls */
+  int scanned;
+  int line_start;
+  int colon;
+  /* set once the terminator is found */
+  int dot;
+  int hdr_len;
+  /* non-empty lines */
+  hms_scan_line *lines;
+  int num_lines;
+  int max_lines;
+} hms_scan_index;
+
+void hms_scan_init( hms_scan_index *idx );
+void hms_scan_reset( hms_scan_index *idx );
+void hms_scan_deinit( hms_scan_index *idx );
+int  hms_scan_best_impl();
+int  hms_scan_header( char *buf, int len, hms_scan_index *idx );
+int  hms_scan_header_impl( int impl, char *buf, int len, hms_scan_index *idx );
+
+/* Message arena and zero-copy views */
+/* ---------------------------------------------------- */
+struct hms_msg *hms_msg_create_arena( int arena_size );
+int             hms_msg_arena_size( int nodes, int allocs, int bytes );
+void           *hms_msg_arena_alloc( struct hms_msg *msg, int size );
+int             hms_msg_index_reserve( struct hms_msg *msg, int nodes );
+int             hms_msg_own_buffer( struct hms_msg *msg, char *buffer );
+int             hms_msg_view_verb( struct hms_msg *msg, char *verb, int len );
+int             hms_msg_view_header( struct hms_msg *msg, char *value, int len );
+int             hms_msg_view_named_header( struct hms_msg *msg, char *key, int key_len,
+					   char *value, int val_len );
+int             hms_msg_view_body( struct hms_msg *msg, char *data, int len, int borrowed );
+int             hms_msg_pend_body( struct hms_msg *msg, int len );
+
 /* Parser - by Daniel */
 /* ---------------------------------------------------- */
 struct hms_msg *hms_msg_parse( int fd , int max_hdr_len );
+struct hms_msg *hms_msg_parse_rbuf( int fd, struct hms_rbuf *rb, int max_hdr_len );
+
+/* Bodies read after the header */
+typedef int (*hms_body_sink)( void *arg, char *data, int len, int offset );
+struct hms_msg *hms_msg_parse_header_rbuf( int fd, struct hms_rbuf *rb, int max_hdr_len );
+int             hms_msg_parse_body_rbuf( int fd, struct hms_rbuf *rb, struct hms_msg *msg );
+int             hms_msg_stream_body_rbuf( int fd, struct hms_rbuf *rb, struct hms_msg *msg,
+					  hms_body_sink sink, void *arg );
+int             hms_msg_sink_body_rbuf( int fd, struct hms_rbuf *rb, struct hms_msg *msg,
+					int out_fd, off_t offset );
+
+/* Fixed messages answered before full parsing */
+enum hms_fast_verb { HMS_FAST_NONE=0, HMS_FAST_PING=1, HMS_FAST_INFO=2, HMS_FAST_BYE=3 };
+int             hms_msg_parse_fast_rbuf( int fd, struct hms_rbuf *rb );
+
+void            hms_rbuf_init( struct hms_rbuf *rb );
+int             hms_rbuf_append( struct hms_rbuf *rb, char *data, int len );
+void            hms_rbuf_trim( struct hms_rbuf *rb );
+void            hms_rbuf_skip( struct hms_rbuf *rb, int len );
+int             hms_rbuf_read( int fd, struct hms_rbuf *rb );
+void            hms_rbuf_deinit( struct hms_rbuf *rb );
+
+/* Push parser over a non-blocking fd */
+struct hms_parser;
+int             hms_parser_pump_rbuf( int fd, struct hms_rbuf *rb, struct hms_parser *parser,
+				      struct hms_msg **msg );
+int             hms_parser_drain_rbuf( struct hms_rbuf *rb, struct hms_parser *parser,
+				       struct hms_msg **msg );
+int             hms_parser_fast_rbuf( struct hms_rbuf *rb, struct hms_parser *parser, int *used );
+
+/* io_uring: one ring per event loop, driven by the loop's thread only */
+/* ---------------------------------------------------- */
+struct hms_uring;
+
+/* a completion; buf is the provided buffer a receive filled, or NULL */
+typedef struct hms_uring_event {
+  void *data;
+  int res;
+  char *buf;
+  int bid;
+} hms_uring_event;
+
+struct hms_uring *hms_uring_create( unsigned entries, int nbufs, int buf_size );
+void              hms_uring_destroy( struct hms_uring *ring );
+int               hms_uring_accept( struct hms_uring *ring, int fd, void *data );
+int               hms_uring_recv( struct hms_uring *ring, int fd, void *data );
+int               hms_uring_read( struct hms_uring *ring, int fd, void *buf, int len, void *data );
+int               hms_uring_poll( struct hms_uring *ring, int fd, int events, void *data );
+int               hms_uring_put_buffer( struct hms_uring *ring, int bid );
+int               hms_uring_wait( struct hms_uring *ring, hms_uring_event *events, int max );
 
 #endif
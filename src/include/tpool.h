@@ -47,6 +47,13 @@ int tpool_add_work(
            void             (*routine)(),
 	   void             *arg);
 
+int tpool_pin(
+           tpool_t          tpool,
+           int              cpu);
+
+int tpool_queue_size(
+           tpool_t          tpool);
+
 int tpool_destroy(
            tpool_t          tpool,
            int              finish);
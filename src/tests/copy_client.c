@@ -117,12 +117,13 @@ static int __send_chunk( hms_connector *connector, char *src, char *dst, int off
     erred = HMS_TRUE; goto done_send_chunk; 
   }
 
-  /* Add to message */
-  ret = hms_msg_set_body( request, data, len );
+  /* Hand the chunk to the message; it is freed with the message */
+  ret = hms_msg_take_body( request, data, len, NULL, NULL );
   if(ret)  { 
     fprintf(stderr, "cannot add body\n"); fflush(stderr);
     erred = HMS_TRUE; goto done_send_chunk; 
   }
+  data = NULL;
 
   /* Send request */
   hms_connector_send_msg( connector, request );
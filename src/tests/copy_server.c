@@ -16,23 +16,80 @@
 
 /* function headers */
 static int __copy_validate( hms_endpoint *endpoint, hms_msg *msg );
-static int __copy_accepts( hms_endpoint *endpoint, hms_msg *msg );
 static int __copy_handle( hms_endpoint *endpoint, hms_msg *msg );
+static int __copy_sink( hms_endpoint *endpoint, hms_msg *msg, int *fd, off_t *offset );
+
+/* the file __copy_sink opened, until __copy_handle closes it; sink, body
+   and handle of a message run on one thread, and with -d several COPYs
+   of one connection run at once, so this is per thread, not in
+   endpoint->data */
+static __thread int __copy_fd = -1;
 
 int main(int argc, char **argv) {
 
   /* Initialize hermes with 10 threads */
   fprintf(stdout, "Copy server 1.0\n"); fflush(stdout);
-  hms_ops ops;
-  ops.hms_handle = __copy_handle;
-  ops.hms_validate = __copy_validate;
-  ops.hms_accepts = __copy_accepts;
-  hms* manager = hermes_init(1, 61182, ops);
+  hms_ops ops, copy_ops;
+  memset( &ops, 0, sizeof(ops) );
+  memset( &copy_ops, 0, sizeof(copy_ops) );
+  copy_ops.hms_handle = __copy_handle;
+  copy_ops.hms_sink = __copy_sink;
+  copy_ops.hms_validate = __copy_validate;
+  hms_config config;
+  hms_config_init( &config );
+  config.num_threads = 1;
+  config.server_port = 61182;
+  config.fast_replies = HMS_TRUE; /* only COPY is handled here */
+  /* -e loops: serve connections from event loops
+     -s shards: one listener, loop and worker set per shard
+     -u 1: drive the loops with io_uring when the kernel has it
+     -q n: messages waiting for a worker before BUSY replies
+     -t n: workers (per shard)
+     -p 1: staged pipeline, replies written by the loops
+     -d n: requests of one connection handled in parallel */
+  int i;
+  for( i=1; i+1 < argc; i += 2 ) {
+    if( strcmp( argv[i], "-e" ) == 0 ) { config.event_loops = atoi( argv[i+1] ); }
+    else if( strcmp( argv[i], "-s" ) == 0 ) { config.shards = atoi( argv[i+1] ); }
+    else if( strcmp( argv[i], "-u" ) == 0 ) { config.io_uring = atoi( argv[i+1] ); }
+    else if( strcmp( argv[i], "-q" ) == 0 ) { config.max_pending_msgs = atoi( argv[i+1] ); }
+    else if( strcmp( argv[i], "-t" ) == 0 ) { config.num_threads = atoi( argv[i+1] ); }
+    else if( strcmp( argv[i], "-p" ) == 0 ) { config.staged_replies = atoi( argv[i+1] ); }
+    else if( strcmp( argv[i], "-d" ) == 0 ) { config.pipeline_depth = atoi( argv[i+1] ); }
+  }
+  hms* manager = hermes_init_with_config( &config, ops );
+  if( !manager ) {
+    fprintf(stderr, "cannot start the server\n"); fflush(stderr);
+    return -1;
+  }
+
+  /* COPY goes straight to its handlers, everything else to the defaults */
+  if( hermes_register_verb( manager, "COPY", copy_ops ) != 0 ) {
+    fprintf(stderr, "cannot register COPY\n"); fflush(stderr);
+    return -1;
+  }
 
   /* Press key to shutdown */
   char end;
   fscanf(stdin, "%c", &end);
 
+  hms_listen_stats stats;
+  hermes_get_listen_stats( manager, &stats );
+  fprintf(stdout, "accepted %ld in %ld wakeups, queue peak %d, full %ld, overflows %ld\n",
+	  stats.accepted, stats.wakeups, stats.queue_peak, stats.queue_full, stats.overflows );
+  hms_shed_stats shed;
+  hermes_get_shed_stats( manager, &shed );
+  fprintf(stdout, "shed %ld connections, %ld requests, %ld slow\n", shed.connections, shed.requests, shed.slow );
+  hms_stage_stats stages;
+  hermes_get_stage_stats( manager, &stages );
+  fprintf(stdout, "stages: %d io, %d handlers, %ld queued, %ld sending (%ld bytes)\n",
+	  stages.io_threads, stages.handler_threads, stages.handler_queued,
+	  stages.send_queued, stages.send_bytes );
+  hms_conn_stats conns;
+  hermes_get_conn_stats( manager, &conns );
+  fprintf(stdout, "connections: %d of %d in use, peak %d, refused %ld\n",
+	  conns.used, conns.capacity, conns.peak, conns.refused );
+
   fprintf(stdout, "Requesting shutdown\n"); fflush(stdout);
   hermes_shutdown(manager, HMS_TRUE);
   fprintf(stdout, "Done\n"); fflush(stdout);
@@ -44,28 +101,19 @@ int main(int argc, char **argv) {
 
 static int __copy_validate( hms_endpoint *endpoint, hms_msg *msg ) {
 
-  /* a valid copy message must have
-     - 0 un-named headers
+  /* only COPY messages get here; a valid one has
+     - Filename and Offset headers
      - content-length > 0
   */
 
   int is_valid = HMS_TRUE;
+  const char *value;
 
-  char *verb; int is_copy = HMS_FALSE;
-  if( hms_msg_get_verb( msg, &verb) == 0) { 
-    if(strcasecmp(verb, "COPY") != 0) {
-      is_copy = HMS_FALSE;
-    }
-    free(verb); verb = NULL;
-  }
-
-  if( is_copy == HMS_TRUE && hms_msg_num_headers( msg ) <= 0 ) { 
-    is_valid = HMS_FALSE; 
-  }
-  else if( is_copy == HMS_TRUE && hms_msg_num_named_headers( msg ) != 3 ) { 
-    is_valid = HMS_FALSE; 
+  if( hms_msg_peek_named_header( msg, "Filename", &value, NULL ) != 0 ||
+      hms_msg_peek_named_header( msg, "Offset", &value, NULL ) != 0 ) {
+    is_valid = HMS_FALSE;
   }
-  else if( is_copy == HMS_TRUE && hms_msg_get_body_size( msg ) <= 0 ) {
+  else if( hms_msg_get_body_size( msg ) <= 0 ) {
     is_valid = HMS_FALSE;
   }
 
@@ -73,65 +121,47 @@ static int __copy_validate( hms_endpoint *endpoint, hms_msg *msg ) {
 
 }
 
-static int __copy_accepts( hms_endpoint *endpoint, hms_msg *msg ) {
+static int __copy_handle( hms_endpoint *endpoint, hms_msg *msg ) {
 
-  char *verb;
-  int will_accept = HMS_FALSE;
+  /* hermes has written the body into the file opened by __copy_sink */
+  int fd = __copy_fd;
+  if( fd < 0 ) { return -1; }
 
-  hms_msg_get_verb( msg, &verb );
-  if(!verb) { return -1; }
-  else if( strcasecmp(verb, "COPY") == 0) {will_accept = HMS_TRUE;}
-  else { will_accept = HMS_FALSE; }
+  close(fd);
+  __copy_fd = -1;
 
-  free(verb);
-		      
-  return (will_accept == HMS_TRUE) ? 0 : -1;
+  return 0;
 
 }
 
-static int __copy_handle( hms_endpoint *endpoint, hms_msg *msg ) {
+static int __copy_sink( hms_endpoint *endpoint, hms_msg *msg, int *fd, off_t *offset ) {
 
-  int fd = -1;
-  int erred = HMS_FALSE;
+  int file_fd = -1;
+  const char *filename = NULL, *offset_str = NULL;
+
+  /* body cut short */
+  if( !fd ) {
+    __copy_handle( endpoint, msg );
+    return 0;
+  }
 
   /* Extract arguments */
   /* Assuming msg is valid since it went through the validate phase */
-  char *filename, *offset_str;
-  hms_msg_get_named_header( msg, "Filename", &filename );
-  hms_msg_get_named_header( msg, "Offset", &offset_str );
-  if(!filename) { erred = HMS_TRUE; goto copy_handle_done; }
-  if(!offset_str) { erred = HMS_TRUE; goto copy_handle_done; }
+  hms_msg_peek_named_header( msg, "Filename", &filename, NULL );
+  hms_msg_peek_named_header( msg, "Offset", &offset_str, NULL );
+  if(!filename || !offset_str) { return -1; }
+
+  //fprintf(stdout, "writing to file: off:|%s| len:|%d| \n", offset_str, hms_msg_get_body_size( msg ) );
 
   /* open file */
-  fd = open( filename, O_WRONLY | O_CREAT , S_IRUSR | S_IWUSR );
-  if(fd == -1) { erred = HMS_TRUE; goto copy_handle_done; }
-
-  /* find off and len */
-  int offset = atoi( offset_str );
-  int length = hms_msg_get_body_size( msg );
-  
-  /* extract the data */
-  char *data = NULL; int data_len;
-  hms_msg_get_body( msg, &data, &data_len );
-  if(!data) { erred = HMS_TRUE; goto copy_handle_done; }
-  if( data_len != length) { erred = HMS_TRUE; goto copy_handle_done; }
-
-  //fprintf(stdout, "writing to file: |%s| off:|%d| len:|%d| \n",
-  //filename, offset, length );
-  
-  /* write to file */
-  if( pwrite( fd, data, length, offset ) != length ) {
-    erred = HMS_TRUE;
-    goto copy_handle_done;
-  }
+  file_fd = open( filename, O_WRONLY | O_CREAT , S_IRUSR | S_IWUSR );
+  if(file_fd == -1) { return -1; }
+  __copy_fd = file_fd;
 
-  /* clean up */
- copy_handle_done:
-  if(fd >= 0) close(fd);
-  if(filename) free(filename);
-  if(offset_str) free(offset_str);
-  if(data) free(data);
+  /* hermes writes the body */
+  *fd = file_fd;
+  *offset = atoll( offset_str );
 
-  return (erred == HMS_FALSE) ? 0 : -1 ;
+  return 0;
 
 }
@@ -21,6 +21,7 @@ int main(int argc, char **argv) {
   /* Initialize hermes with 10 threads */
   fprintf(stdout, "Starting hermes\n"); fflush(stdout);
   hms_ops ops;
+  memset( &ops, 0, sizeof(ops) );
   ops.hms_handle = __my_handle;
   ops.hms_validate = __my_validate;
   ops.hms_accepts = __my_accepts;
@@ -45,15 +46,13 @@ static int __my_validate( hms_endpoint *endpoint, hms_msg *msg ) {
 
 static int __my_accepts( hms_endpoint *endpoint, hms_msg *msg ) {
 
-  char *verb;
+  const char *verb;
   int will_accept = HMS_FALSE;
 
-  hms_msg_get_verb( msg, &verb );
+  hms_msg_peek_verb( msg, &verb, NULL );
   if(!verb) { return -1; }
   else if( strcasecmp(verb, "TEST") == 0) {will_accept = HMS_TRUE;}
   else { will_accept = HMS_FALSE; }
-
-  free(verb);
 		      
   return (will_accept == HMS_TRUE) ? 0 : -1;
 
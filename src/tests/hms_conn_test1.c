@@ -0,0 +1,292 @@
+/**
+ * HERMES - Test
+ * -------------
+ * by Gokul Soundararajan
+ *
+ * Replies sent from other threads through connection handles
+ *
+ **/
+
+#include <hermes.h>
+#include <assert.h>
+
+#define PORT 61192
+#define THREAD_PORT 61193
+#define DIRECT_PORT 61195
+#define BIG_BODY (16*1024*1024)
+#define FLOOD_BODY 1024
+
+static hms *manager = NULL;
+static hms_conn last_conn = 0;
+
+/* finishes a LATER request on a thread of its own */
+static void *__later_thread( void *arg ) {
+
+  hms_conn conn = (hms_conn) (uintptr_t) arg;
+  hms_msg *reply = hms_msg_create();
+
+  usleep( 20000 );
+  assert( !hms_msg_set_verb( reply, "DONE" ) );
+  assert( !hermes_send_msg( manager, conn, reply ) );
+  hms_msg_destroy( reply );
+
+  return NULL;
+
+}
+
+/* LATER: answered by another thread; the handler returns right away */
+static int __later_handle( hms_endpoint *endpoint, hms_msg *msg ) {
+
+  pthread_t thread;
+  last_conn = hms_endpoint_conn( endpoint );
+  assert( last_conn != 0 );
+  assert( !pthread_create( &thread, NULL, __later_thread, (void *) (uintptr_t) last_conn ) );
+  pthread_detach( thread );
+
+  return 0;
+
+}
+
+/* HOLD: on a thread-per-connection server, where the connection has a
+   slot but takes no sends from other threads */
+static hms_conn held_slot = 0;
+static int __hold_handle( hms_endpoint *endpoint, hms_msg *msg ) {
+
+  hms_msg *reply = hms_msg_create();
+  assert( hms_endpoint_conn( endpoint ) == 0 );
+  held_slot = endpoint->conn;
+  assert( held_slot != 0 );
+  assert( !hms_msg_set_verb( reply, "HELD" ) );
+  assert( !hms_endpoint_send_msg( endpoint, reply ) );
+  hms_msg_destroy( reply );
+
+  return 0;
+
+}
+
+/* BIG: a reply far larger than the socket buffers, written by the
+   worker itself (event loops, replies not staged) */
+static int big_status = 0;
+static int __big_handle( hms_endpoint *endpoint, hms_msg *msg ) {
+
+  hms_msg *reply = hms_msg_create();
+  char *body = calloc( 1, BIG_BODY );
+  assert( body && !hms_msg_set_verb( reply, "BIG" ) );
+  assert( !hms_msg_set_body( reply, body, BIG_BODY ) );
+  big_status = hms_endpoint_send_msg( endpoint, reply );
+  hms_msg_destroy( reply );
+  free( body );
+
+  return big_status;
+
+}
+
+static hms_msg* __recv( hms_connector *connector, const char *verb ) {
+
+  hms_msg *msg = NULL;
+  const char *got = NULL;
+  assert( !hms_connector_recv_msg( connector, &msg ) );
+  assert( !hms_msg_peek_verb( msg, &got, NULL ) );
+  assert( !strcmp( got, verb ) );
+  return msg;
+
+}
+
+static void __send( hms_connector *connector, const char *verb ) {
+
+  hms_msg *msg = hms_msg_create();
+  assert( !hms_msg_set_verb( msg, (char *) verb ) );
+  assert( !hms_connector_send_msg( connector, msg ) );
+  hms_msg_destroy( msg );
+
+}
+
+int main(int argc, char **argv) {
+
+  hms_ops ops, later_ops;
+  hms_config config;
+  hms_connector *connector = NULL;
+  int i;
+
+  memset( &ops, 0, sizeof(ops) );
+  memset( &later_ops, 0, sizeof(later_ops) );
+  later_ops.hms_handle = __later_handle;
+  hms_config_init( &config );
+  config.server_port = PORT;
+  config.num_threads = 2;
+  config.event_loops = 1;
+  config.staged_replies = HMS_TRUE;
+  config.max_outbound = 64 * FLOOD_BODY;
+  config.slow_consumer = HMS_SLOW_DROP;
+  config.max_conns = 2;
+  manager = hermes_init_with_config( &config, ops );
+  assert( !hermes_register_verb( manager, "LATER", later_ops ) );
+
+  for( i=0; i < 50 && !connector; i++ ) {
+    connector = hms_connector_init( "127.0.0.1", PORT );
+    if( !connector ) { usleep( 10000 ); }
+  }
+  assert( connector );
+
+  /* the PING sent after LATER is answered first */
+  {
+    __send( connector, "LATER" );
+    __send( connector, "PING" );
+    hms_msg_destroy( __recv( connector, "PONG" ) );
+    hms_msg_destroy( __recv( connector, "DONE" ) );
+    fprintf(stdout, "done async reply tests\n");
+  }
+
+  /* a reader that stops reading: past max_outbound sends are refused,
+     what was taken still arrives whole */
+  {
+    hms_msg *push = hms_msg_create();
+    char body[FLOOD_BODY];
+    hms_shed_stats shed;
+    int queued = 0;
+    memset( body, 'x', sizeof(body) );
+    assert( !hms_msg_set_verb( push, "PUSH" ) );
+    assert( !hms_msg_set_body( push, body, sizeof(body) ) );
+    while( hermes_send_msg( manager, last_conn, push ) == 0 ) { queued++; }
+    hms_msg_destroy( push );
+    hermes_get_shed_stats( manager, &shed );
+    assert( queued > 0 && shed.slow == 1 );
+
+    for( i=0; i < queued; i++ ) {
+      hms_msg *msg = __recv( connector, "PUSH" );
+      assert( hms_msg_get_body_size( msg ) == FLOOD_BODY );
+      hms_msg_destroy( msg );
+    }
+    __send( connector, "PING" );
+    hms_msg_destroy( __recv( connector, "PONG" ) );
+    fprintf(stdout, "done slow consumer tests: %d queued\n", queued);
+  }
+
+  /* a handle outlives its connection without finding another */
+  {
+    hms_msg *msg = hms_msg_create();
+    assert( !hms_msg_set_verb( msg, "DONE" ) );
+    hms_connector_destroy( connector );
+    for( i=0; i < 100 && hermes_send_msg( manager, last_conn, msg ) == 0; i++ ) { usleep( 10000 ); }
+    assert( hermes_send_msg( manager, last_conn, msg ) == -1 );
+    assert( hermes_send_msg( manager, 0, msg ) == -1 );
+    hms_msg_destroy( msg );
+    fprintf(stdout, "done stale handle tests\n");
+  }
+
+  /* connections fill the slab, the one past it is turned away, and a
+     freed slot takes the next under a new handle */
+  {
+    hms_connector *conns[2], *extra;
+    hms_conn_stats stats;
+    hms_conn old_conn = last_conn;
+    hermes_get_conn_stats( manager, &stats );
+    assert( stats.capacity == 2 && stats.used == 0 && stats.peak == 1 );
+
+    for( i=0; i < 2; i++ ) {
+      conns[i] = hms_connector_init( "127.0.0.1", PORT );
+      assert( conns[i] );
+      __send( conns[i], "PING" );
+      hms_msg_destroy( __recv( conns[i], "PONG" ) );
+    }
+    extra = hms_connector_init( "127.0.0.1", PORT );
+    assert( extra );
+    hms_msg_destroy( __recv( extra, "BUSY" ) );
+    hms_connector_destroy( extra );
+    hermes_get_conn_stats( manager, &stats );
+    assert( stats.used == 2 && stats.peak == 2 && stats.refused == 1 );
+
+    hms_connector_destroy( conns[0] );
+    for( i=0; i < 100 && stats.used != 1; i++ ) {
+      usleep( 10000 );
+      hermes_get_conn_stats( manager, &stats );
+    }
+    assert( stats.used == 1 );
+    conns[0] = hms_connector_init( "127.0.0.1", PORT );
+    assert( conns[0] );
+    __send( conns[0], "LATER" );
+    hms_msg_destroy( __recv( conns[0], "DONE" ) );
+    assert( last_conn != old_conn );
+    for( i=0; i < 2; i++ ) { hms_connector_destroy( conns[i] ); }
+    fprintf(stdout, "done slab tests\n");
+  }
+
+  hermes_shutdown( manager, HMS_TRUE );
+
+  /* thread per connection: no handle, and a send to the slot's is
+     refused right away while its handler holds the connection */
+  {
+    hms_ops hold_ops;
+    hms_msg *msg = hms_msg_create();
+    struct timeval start, end;
+    memset( &hold_ops, 0, sizeof(hold_ops) );
+    hold_ops.hms_handle = __hold_handle;
+    hms_config_init( &config );
+    config.server_port = THREAD_PORT;
+    config.num_threads = 2;
+    manager = hermes_init_with_config( &config, ops );
+    assert( !hermes_register_verb( manager, "HOLD", hold_ops ) );
+    connector = NULL;
+    for( i=0; i < 50 && !connector; i++ ) {
+      connector = hms_connector_init( "127.0.0.1", THREAD_PORT );
+      if( !connector ) { usleep( 10000 ); }
+    }
+    assert( connector );
+    __send( connector, "HOLD" );
+    hms_msg_destroy( __recv( connector, "HELD" ) );
+
+    assert( !hms_msg_set_verb( msg, "DONE" ) );
+    gettimeofday( &start, NULL );
+    assert( hermes_send_msg( manager, held_slot, msg ) == -1 );
+    gettimeofday( &end, NULL );
+    assert( ( end.tv_sec - start.tv_sec ) * 1000000 + ( end.tv_usec - start.tv_usec ) < 100000 );
+    hms_msg_destroy( msg );
+
+    __send( connector, "PING" );
+    hms_msg_destroy( __recv( connector, "PONG" ) );
+    hms_connector_destroy( connector );
+    hermes_shutdown( manager, HMS_TRUE );
+    fprintf(stdout, "done thread-per-connection tests\n");
+  }
+
+  /* a reader that stops reading holds the only worker for send_timeout,
+     not forever; its connection is shut down after */
+  {
+    hms_ops big_ops;
+    hms_connector *reader = NULL;
+    hms_shed_stats shed;
+    hms_msg *msg = NULL;
+    memset( &big_ops, 0, sizeof(big_ops) );
+    big_ops.hms_handle = __big_handle;
+    hms_config_init( &config );
+    config.server_port = DIRECT_PORT;
+    config.num_threads = 1;
+    config.event_loops = 1;
+    config.sndbuf = 64 * 1024;
+    config.send_timeout = 200;
+    manager = hermes_init_with_config( &config, ops );
+    assert( !hermes_register_verb( manager, "BIG", big_ops ) );
+    for( i=0; i < 50 && !reader; i++ ) {
+      reader = hms_connector_init( "127.0.0.1", DIRECT_PORT );
+      if( !reader ) { usleep( 10000 ); }
+    }
+    assert( reader );
+    __send( reader, "BIG" );
+
+    connector = hms_connector_init( "127.0.0.1", DIRECT_PORT );
+    assert( connector );
+    __send( connector, "PING" );
+    hms_msg_destroy( __recv( connector, "PONG" ) );
+    hermes_get_shed_stats( manager, &shed );
+    assert( big_status == -1 && shed.slow == 1 );
+    assert( hms_connector_recv_msg( reader, &msg ) < 0 );
+
+    hms_connector_destroy( reader );
+    hms_connector_destroy( connector );
+    hermes_shutdown( manager, HMS_TRUE );
+    fprintf(stdout, "done send timeout tests\n");
+  }
+
+  return 0;
+
+} /* end main() */
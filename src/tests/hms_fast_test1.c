@@ -0,0 +1,116 @@
+/**
+ * HERMES - Test
+ * -------------
+ * by Gokul Soundararajan
+ *
+ * Bare PING, INFO and BYE answered by the event loops before parsing
+ *
+ **/
+
+#include <hermes.h>
+#include <assert.h>
+
+/* messages that reached a handler */
+static int handled = 0;
+
+/* PING, if it ever gets this far, and ECHO */
+static int __count_handle( hms_endpoint *endpoint, hms_msg *msg ) {
+
+  const char *verb = NULL;
+  hms_msg *reply = hms_msg_create();
+  __atomic_add_fetch( &handled, 1, __ATOMIC_RELAXED );
+  assert( !hms_msg_peek_verb( msg, &verb, NULL ) );
+  assert( !hms_msg_set_verb( reply, ( strcmp( verb, "PING" ) == 0 ) ? "PONG" : "ECHO" ) );
+  int ret = hms_endpoint_send_msg( endpoint, reply );
+  hms_msg_destroy( reply );
+
+  return ret;
+
+}
+
+static void __recv( hms_connector *connector, const char *verb ) {
+
+  hms_msg *msg = NULL;
+  const char *got = NULL;
+  assert( !hms_connector_recv_msg( connector, &msg ) );
+  assert( !hms_msg_peek_verb( msg, &got, NULL ) );
+  assert( !strcmp( got, verb ) );
+  hms_msg_destroy( msg );
+
+}
+
+static void __run( int port, int staged, int io_uring ) {
+
+  hms_ops ops, count_ops;
+  hms_config config;
+  hms_connector *connector = NULL;
+  hms_msg *msg = NULL;
+  int i;
+
+  memset( &ops, 0, sizeof(ops) );
+  memset( &count_ops, 0, sizeof(count_ops) );
+  count_ops.hms_handle = __count_handle;
+  hms_config_init( &config );
+  config.server_port = port;
+  config.num_threads = 2;
+  config.event_loops = 1;
+  config.io_uring = io_uring;
+  config.staged_replies = staged;
+  config.fast_replies = HMS_TRUE;
+  hms *manager = hermes_init_with_config( &config, ops );
+  assert( manager );
+  assert( !hermes_register_verb( manager, "PING", count_ops ) );
+  assert( !hermes_register_verb( manager, "ECHO", count_ops ) );
+  handled = 0;
+
+  for( i=0; i < 50 && !connector; i++ ) {
+    connector = hms_connector_init( "127.0.0.1", port );
+    if( !connector ) { usleep( 10000 ); }
+  }
+  assert( connector );
+
+  /* one write: bare messages around one that is parsed, then a PING
+     with a header, which is not bare */
+  {
+    const char *burst = "PING\n.\nINFO\n.\nECHO\n.\nping\r\n.\r\nPING\nKey:value\n.\n";
+    assert( write( connector->socket, burst, strlen( burst ) ) == (ssize_t) strlen( burst ) );
+    __recv( connector, "PONG" );
+    __recv( connector, "INFO" );
+    __recv( connector, "ECHO" );
+    __recv( connector, "PONG" );
+    __recv( connector, "PONG" );
+    assert( handled == 2 );
+  }
+
+  /* a bare PING split over two writes is left to the parser */
+  {
+    assert( write( connector->socket, "PI", 2 ) == 2 );
+    usleep( 20000 );
+    assert( write( connector->socket, "NG\n.\n", 5 ) == 5 );
+    __recv( connector, "PONG" );
+  }
+
+  /* BYE closes the connection */
+  {
+    assert( write( connector->socket, "BYE\n.\n", 6 ) == 6 );
+    assert( hms_connector_recv_msg( connector, &msg ) < 0 );
+  }
+
+  hms_connector_destroy( connector );
+  hermes_shutdown( manager, HMS_TRUE );
+
+  fprintf( stdout, "done fast reply tests: %s%s, %d handled\n",
+	   ( staged ) ? "staged" : "direct", ( io_uring ) ? " with io_uring" : "", handled );
+
+}
+
+int main(int argc, char **argv) {
+
+  __run( 61196, HMS_FALSE, HMS_FALSE );
+  __run( 61197, HMS_TRUE, HMS_FALSE );
+  __run( 61198, HMS_TRUE, HMS_TRUE );
+  __run( 61199, HMS_FALSE, HMS_TRUE );
+
+  return 0;
+
+} /* end main() */
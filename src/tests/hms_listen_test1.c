@@ -0,0 +1,146 @@
+/**
+ * HERMES - Test
+ * -------------
+ * by Gokul Soundararajan
+ *
+ * Bursts of connections, seen through the listen stats
+ *
+ **/
+
+#include <hermes.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+
+#define BURST 64
+
+/* BURST connects without waiting for any of them, then a PING on each */
+static void __burst( int port ) {
+
+  struct sockaddr_in addr;
+  struct pollfd pfds[BURST];
+  int fds[BURST], i, left = BURST;
+  char buf[64];
+
+  memset( &addr, 0, sizeof(addr) );
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons( port );
+  addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+  for( i=0; i < BURST; i++ ) {
+    fds[i] = socket( AF_INET, SOCK_STREAM, 0 );
+    assert( fds[i] >= 0 );
+    fcntl( fds[i], F_SETFL, fcntl( fds[i], F_GETFL ) | O_NONBLOCK );
+    assert( connect( fds[i], (struct sockaddr *) &addr, sizeof(addr) ) == 0 || errno == EINPROGRESS );
+  }
+
+  /* a worker per connection serves the next one only when its own
+     closes: each is closed as soon as it answers */
+  for( i=0; i < BURST; i++ ) {
+    fcntl( fds[i], F_SETFL, fcntl( fds[i], F_GETFL ) & ~O_NONBLOCK );
+    assert( write( fds[i], "PING\n.\n", 7 ) == 7 );
+    pfds[i].fd = fds[i];
+    pfds[i].events = POLLIN;
+  }
+  while( left > 0 ) {
+    assert( poll( pfds, BURST, 10000 ) > 0 );
+    for( i=0; i < BURST; i++ ) {
+      if( pfds[i].fd < 0 || !pfds[i].revents ) { continue; }
+      assert( read( fds[i], buf, sizeof(buf) ) > 0 && !strncmp( buf, "PONG", 4 ) );
+      close( fds[i] );
+      pfds[i].fd = -1;
+      left--;
+    }
+  }
+
+}
+
+/* one connection at a time, each served and closed before the next */
+static void __one_by_one( int port ) {
+
+  hms_connector *connector = NULL;
+  hms_msg *msg = NULL;
+  int i;
+
+  for( i=0; i < BURST; i++ ) {
+    connector = hms_connector_init( "127.0.0.1", port );
+    assert( connector );
+    msg = hms_msg_create();
+    assert( !hms_msg_set_verb( msg, "PING" ) );
+    assert( !hms_connector_send_msg( connector, msg ) );
+    hms_msg_destroy( msg ); msg = NULL;
+    assert( !hms_connector_recv_msg( connector, &msg ) );
+    hms_msg_destroy( msg ); msg = NULL;
+    hms_connector_destroy( connector );
+  }
+
+}
+
+/* A burst on the default backlog, which it never fills, then a backlog
+   of 1, which any connection waiting fills. Connections are not sent
+   faster than a backlog of 1 takes them: SYNs dropped from a full queue
+   are only sent again after a second or more */
+static void __run( int port, int loops, int backlog ) {
+
+  hms_ops ops;
+  hms_config config;
+  hms_listen_stats stats;
+  hms_connector *connector = NULL;
+  int i;
+
+  memset( &ops, 0, sizeof(ops) );
+  hms_config_init( &config );
+  config.server_port = port;
+  config.num_threads = 4;
+  config.event_loops = loops;
+  config.max_pending_conns = 2 * BURST;
+  if( backlog > 0 ) { config.backlog = backlog; }
+  hms *manager = hermes_init_with_config( &config, ops );
+  assert( manager );
+
+  for( i=0; i < 50 && !connector; i++ ) {
+    connector = hms_connector_init( "127.0.0.1", port );
+    if( !connector ) { usleep( 10000 ); }
+  }
+  assert( connector );
+  hms_connector_destroy( connector );
+  hermes_get_listen_stats( manager, &stats );
+  for( i=0; i < 100 && stats.accepted == 0; i++ ) {
+    usleep( 10000 );
+    hermes_get_listen_stats( manager, &stats );
+  }
+
+  if( backlog > 0 ) { __one_by_one( port ); }
+  else { __burst( port ); }
+
+  /* every connection taken once, and at least one per wakeup */
+  hermes_get_listen_stats( manager, &stats );
+  assert( stats.accepted == BURST + 1 );
+  assert( stats.wakeups >= 1 && stats.wakeups <= stats.accepted );
+  assert( stats.queue_peak >= 1 );
+  if( backlog == 1 ) {
+    assert( stats.queue_full == stats.wakeups && stats.queue_peak == 1 );
+  } else {
+    assert( stats.queue_full == 0 );
+  }
+  /* host-wide, so only bounded */
+  assert( stats.overflows >= 0 && stats.drops >= stats.overflows );
+
+  hermes_shutdown( manager, HMS_TRUE );
+
+  fprintf( stdout, "done listen tests: %s, backlog %d: %ld accepted in %ld wakeups, %ld full, peak %d\n",
+	   ( loops ) ? "event loops" : "thread per connection", config.backlog,
+	   stats.accepted, stats.wakeups, stats.queue_full, stats.queue_peak );
+
+}
+
+int main(int argc, char **argv) {
+
+  __run( 61207, 0, 0 );
+  __run( 61208, 1, 0 );
+  __run( 61209, 0, 1 );
+  __run( 61210, 1, 1 );
+
+  return 0;
+
+} /* end main() */
@@ -0,0 +1,101 @@
+/**
+ * HERMES - Test
+ * -------------
+ * by Gokul Soundararajan
+ *
+ * PING served by each kind of event loop
+ *
+ **/
+
+#include <hermes.h>
+#include <assert.h>
+
+#define NUM_CONNS 8
+#define NUM_PINGS 100
+
+static void __ping( hms_connector *connector ) {
+
+  hms_msg *msg = hms_msg_create();
+  const char *got = NULL;
+  assert( !hms_msg_set_verb( msg, "PING" ) );
+  assert( !hms_connector_send_msg( connector, msg ) );
+  hms_msg_destroy( msg ); msg = NULL;
+  assert( !hms_connector_recv_msg( connector, &msg ) );
+  assert( !hms_msg_peek_verb( msg, &got, NULL ) );
+  assert( !strcmp( got, "PONG" ) );
+  hms_msg_destroy( msg );
+
+}
+
+/* several connections, each answered in turn, on the loops config asks for */
+static void __run( const char *mode, hms_config *config ) {
+
+  hms_ops ops;
+  hms_connector *conns[NUM_CONNS];
+  hms_stage_stats stages;
+  int i, j;
+
+  memset( &ops, 0, sizeof(ops) );
+  hms *manager = hermes_init_with_config( config, ops );
+  assert( manager );
+
+  conns[0] = NULL;
+  for( i=0; i < 50 && !conns[0]; i++ ) {
+    conns[0] = hms_connector_init( "127.0.0.1", config->server_port );
+    if( !conns[0] ) { usleep( 10000 ); }
+  }
+  assert( conns[0] );
+  for( i=1; i < NUM_CONNS; i++ ) {
+    conns[i] = hms_connector_init( "127.0.0.1", config->server_port );
+    assert( conns[i] );
+  }
+
+  for( j=0; j < NUM_PINGS; j++ ) {
+    for( i=0; i < NUM_CONNS; i++ ) { __ping( conns[i] ); }
+  }
+
+  hermes_get_stage_stats( manager, &stages );
+  assert( stages.io_threads == config->event_loops + config->shards );
+
+  for( i=0; i < NUM_CONNS; i++ ) { hms_connector_destroy( conns[i] ); }
+  hermes_shutdown( manager, HMS_TRUE );
+
+  fprintf( stdout, "done loop tests: %s\n", mode );
+
+}
+
+int main(int argc, char **argv) {
+
+  hms_config config;
+
+  hms_config_init( &config );
+  config.server_port = 61211;
+  config.num_threads = 2;
+  config.event_loops = 2;
+  __run( "event loops", &config );
+
+  /* a loop per CPU, each with its own listener and pool */
+  hms_config_init( &config );
+  config.server_port = 61212;
+  config.num_threads = 2;
+  config.shards = 2;
+  __run( "shards", &config );
+
+  /* both again on io_uring */
+  hms_config_init( &config );
+  config.server_port = 61213;
+  config.num_threads = 2;
+  config.event_loops = 2;
+  config.io_uring = HMS_TRUE;
+  __run( "event loops with io_uring", &config );
+
+  hms_config_init( &config );
+  config.server_port = 61214;
+  config.num_threads = 2;
+  config.shards = 2;
+  config.io_uring = HMS_TRUE;
+  __run( "shards with io_uring", &config );
+
+  return 0;
+
+} /* end main() */
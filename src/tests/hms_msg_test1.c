@@ -10,6 +10,13 @@
 #include <hermes.h>
 #include <assert.h>
 
+static int bodies_freed = 0;
+static void __free_body( void *arg, char *data, int len ) {
+  assert( arg == (void *) &bodies_freed );
+  bodies_freed++;
+  free( data );
+}
+
 int main(int argc, char **argv) {
 
   int loop_count = 0;
@@ -43,6 +50,10 @@ loop:
     assert( strcmp( verb, "PING" ) == 0 );
     free( verb );
 
+    const char *peek; int peek_len;
+    assert( !hms_msg_peek_verb( msg, &peek, &peek_len ) );
+    assert( peek_len == 4 && strcmp( peek, "PING" ) == 0 );
+
     fprintf(stdout, "done verb tests\n" );
   }
 
@@ -57,6 +68,11 @@ loop:
     assert( strcmp( value, "zero" ) == 0 );
     free(value);
 
+    const char *peek; int peek_len;
+    assert( !hms_msg_peek_header( msg, 0, &peek, &peek_len ) );
+    assert( peek_len == 4 && strcmp( peek, "zero" ) == 0 );
+    assert( hms_msg_peek_header( msg, 1, &peek, NULL ) < 0 && peek == NULL );
+
     {
       int i = 0;
       char *names[6] = { "zero", "one", "two", "three", "four", "five" };
@@ -101,6 +117,9 @@ loop:
       assert( !hms_msg_get_named_header( msg, keys[i], &value ) );
       assert( !strcmp( value, vals[i] ) );
       free(value);
+      const char *peek; int peek_len;
+      assert( !hms_msg_peek_named_header( msg, keys[i], &peek, &peek_len ) );
+      assert( peek_len == 4 && !strcmp( peek, vals[i] ) );
       assert( hms_msg_num_named_headers( msg ) == (i+1));
     }
 
@@ -109,7 +128,32 @@ loop:
       assert( !hms_msg_del_named_header( msg, keys[i] ) );
     }
 
-    /* TODO: Need better tests */
+    /* enough headers for the key index; lookups ignore case */
+    char key[32], val[32], *value;
+    for(i=0; i < 300; i++) {
+      sprintf( key, "Key-%d", i ); sprintf( val, "%d", i );
+      assert( !hms_msg_add_named_header( msg, key, val ) );
+    }
+    assert( !hms_msg_add_named_header( msg, "KEY-7", "seven" ) );
+    assert( hms_msg_num_named_headers( msg ) == 300 );
+    for(i=0; i < 300; i += 2) {
+      sprintf( key, "kEy-%d", i );
+      assert( !hms_msg_del_named_header( msg, key ) );
+    }
+    assert( hms_msg_num_named_headers( msg ) == 150 );
+    for(i=0; i < 300; i++) {
+      sprintf( key, "key-%d", i ); sprintf( val, "%d", i );
+      if( i % 2 == 0 ) { assert( hms_msg_get_named_header( msg, key, &value ) < 0 ); continue; }
+      assert( !hms_msg_get_named_header( msg, key, &value ) );
+      assert( !strcmp( value, (i == 7) ? "seven" : val ) );
+      free(value);
+    }
+    for(i=1; i < 300; i += 2) {
+      sprintf( key, "Key-%d", i );
+      assert( !hms_msg_del_named_header( msg, key ) );
+    }
+    assert( hms_msg_num_named_headers( msg ) == 0 );
+
 
     fprintf(stdout, "done named header tests\n" );
 
@@ -129,6 +173,9 @@ loop:
       assert( !hms_msg_get_body( msg, &value, &value_len ) );
       assert( !memcmp( value, body, sz ) );
       free(value);
+      const char *peek; int peek_len;
+      assert( !hms_msg_peek_body( msg, &peek, &peek_len ) );
+      assert( peek_len == sz && !memcmp( peek, body, sz ) );
       assert( hms_msg_get_body_size( msg) == sz);
       assert( !hms_msg_del_body( msg ) );
       assert( !hms_msg_get_body_size( msg) );
@@ -147,6 +194,110 @@ loop:
   loop_count++;
   if(loop_count < 1000) goto loop;
 
+  /* Destroyed messages are reused by the next create */
+  {
+    hms_msg_pool_stats stats;
+    hms_msg_pool_get_stats( &stats );
+    assert( stats.recycled == loop_count );
+    assert( stats.hits == loop_count - 1 );
+    assert( stats.bytes > 0 );
+
+    assert( hms_msg_pool_get_limit() == HERMES_MSG_POOL_BYTES );
+    hms_msg_pool_set_limit( 0 );
+    assert( hms_msg_pool_get_limit() == 0 );
+    assert( !hms_msg_destroy( hms_msg_create() ) );
+    hms_msg_pool_get_stats( &stats );
+    assert( stats.hits == loop_count );
+    assert( stats.dropped == 1 );
+    assert( stats.bytes == 0 );
+    fprintf(stdout, "done pool tests\n");
+  }
+
+  /* Bodies moved in and out of a message without a copy */
+  {
+    char *data, *out; int out_len;
+    hms_body_free out_free; void *out_arg;
+    const char *peek;
+    msg = hms_msg_create();
+
+    /* taken body is the message's content, freed with the message */
+    data = strdup( "moved body" );
+    assert( !hms_msg_take_body( msg, data, 10, __free_body, &bodies_freed ) );
+    assert( !hms_msg_peek_body( msg, &peek, NULL ) && peek == data );
+    assert( hms_msg_get_body_size( msg ) == 10 );
+    assert( !hms_msg_destroy( msg ) );
+    assert( bodies_freed == 1 );
+
+    /* released with its callback: the same pointer */
+    msg = hms_msg_create();
+    data = strdup( "moved body" );
+    assert( !hms_msg_take_body( msg, data, 10, __free_body, &bodies_freed ) );
+    assert( !hms_msg_release_body( msg, &out, &out_len, &out_free, &out_arg ) );
+    assert( out == data && out_len == 10 && out_free == __free_body && out_arg == &bodies_freed );
+    assert( !hms_msg_get_body_size( msg ) && !hms_msg_num_named_headers( msg ) );
+    out_free( out_arg, out, out_len );
+    assert( bodies_freed == 2 );
+
+    /* released without one: a malloc'd copy, the original freed */
+    data = strdup( "moved body" );
+    assert( !hms_msg_take_body( msg, data, 10, __free_body, &bodies_freed ) );
+    assert( !hms_msg_release_body( msg, &out, &out_len, NULL, NULL ) );
+    assert( bodies_freed == 3 );
+    assert( out_len == 10 && !memcmp( out, "moved body", 10 ) );
+    free( out );
+
+    /* a body in the arena is copied out */
+    assert( !hms_msg_set_body( msg, "small", 5 ) );
+    assert( !hms_msg_peek_body( msg, &peek, NULL ) );
+    assert( !hms_msg_release_body( msg, &out, &out_len, &out_free, NULL ) );
+    assert( out != peek && out_len == 5 && out_free == NULL );
+    free( out );
+
+    /* no body */
+    assert( !hms_msg_release_body( msg, &out, &out_len, NULL, NULL ) );
+    assert( out == NULL && out_len == 0 );
+    assert( !hms_msg_destroy( msg ) );
+    assert( bodies_freed == 3 );
+    fprintf(stdout, "done body move tests\n");
+  }
+
+  /* Header size is kept up to date as the header changes */
+  {
+    const char *expect = "GET a\nKey:value\nContent-Length:3\n.\n";
+    char buf[64];
+    msg = hms_msg_create();
+    assert( !hms_msg_set_verb( msg, "VERB" ) );
+    assert( !hms_msg_set_verb( msg, "GET" ) );
+    assert( !hms_msg_add_header( msg, "a" ) );
+    assert( !hms_msg_add_header( msg, "bc" ) );
+    assert( !hms_msg_del_header( msg, 1 ) );
+    assert( !hms_msg_add_named_header( msg, "Key", "value" ) );
+    assert( !hms_msg_add_named_header( msg, "Gone", "x" ) );
+    assert( !hms_msg_del_named_header( msg, "Gone" ) );
+    assert( !hms_msg_set_body( msg, "abc", 3 ) );
+    assert( hms_msg_get_header_size( msg ) == (int) strlen( expect ) );
+    assert( hms_msg_print_header( msg, buf, strlen( expect ) - 1 ) == -1 );
+    assert( !hms_msg_print_header( msg, buf, sizeof(buf) ) );
+    assert( !memcmp( buf, expect, strlen( expect ) ) );
+    assert( !hms_msg_destroy( msg ) );
+    fprintf(stdout, "done header size tests\n");
+  }
+
+  /* Reply templates hold the serialized header and body */
+  {
+    const char *expect = "OK\nContent-Length:4\n.\nbody";
+    hms_reply_template *tmpl;
+    msg = hms_msg_create();
+    assert( !hms_msg_set_verb( msg, "OK" ) );
+    assert( !hms_msg_set_body( msg, "body", 4 ) );
+    tmpl = hms_reply_template_create( msg );
+    assert( !hms_msg_destroy( msg ) );
+    assert( tmpl && tmpl->len == (int) strlen( expect ) );
+    assert( !memcmp( tmpl->data, expect, tmpl->len ) );
+    assert( !hms_reply_template_destroy( tmpl ) );
+    fprintf(stdout, "done reply template tests\n");
+  }
+
   return 0;
 
 } /* end main() */
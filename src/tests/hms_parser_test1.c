@@ -16,10 +16,20 @@ int main(int argc, char **argv) {
   int fd = 0; /* 0 is stdin */
   int msgs_recvd = 0;
   int max_hdr_size = 1024;
+  hms_rbuf rb;
+  hms_rbuf_init( &rb );
+
+  /* -z: headers and bodies are views into the receive buffer
+     -b size: start the receive buffer at "size" bytes */
+  int i;
+  for( i=1; i < argc; i++ ) {
+    if( strcmp( argv[i], "-z" ) == 0 ) { rb.zero_copy = HMS_TRUE; }
+    else if( strcmp( argv[i], "-b" ) == 0 && i+1 < argc ) { rb.init_cap = atoi( argv[++i] ); }
+  }
 
   while( msgs_recvd < 1000000 ) {
 
-    hms_msg *msg = hms_msg_parse( fd, max_hdr_size );
+    hms_msg *msg = hms_msg_parse_rbuf( fd, &rb, max_hdr_size );
     if(!msg) break;
 
     char *buffer = malloc( max_hdr_size );
@@ -34,7 +44,7 @@ int main(int argc, char **argv) {
 
     char *body = NULL; int body_sz;
     hms_msg_get_body( msg, &body, &body_sz );
-    printf("%s", body);
+    if(body) fwrite( body, 1, body_sz, stdout );
 
 
     if(buffer) { free(buffer); buffer = NULL;}
@@ -45,7 +55,24 @@ int main(int argc, char **argv) {
 
   } /* end while(1) */
 
+  hms_rbuf_deinit( &rb );
 
+  /* a body past max_body fails the message, copied or zero-copy */
+  for( i=0; i < 2; i++ ) {
+    char big[128];
+    int p[2], len;
+    len = sprintf( big, "PUT\nContent-Length:65\n.\n" );
+    memset( big + len, 'x', 65 ); len += 65;
+    hms_rbuf_init( &rb );
+    rb.zero_copy = i;
+    rb.max_body = 64;
+    assert( !pipe( p ) );
+    assert( write( p[1], big, len ) == len );
+    close( p[1] );
+    assert( hms_msg_parse_rbuf( p[0], &rb, max_hdr_size ) == NULL );
+    close( p[0] );
+    hms_rbuf_deinit( &rb );
+  }
 
   return 0;
 
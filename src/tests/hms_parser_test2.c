@@ -0,0 +1,91 @@
+/**
+ * HERMES - Test
+ * -------------
+ * by Gokul Soundararajan
+ *
+ * Push parser tests for Hermes C edition
+ * - input is fed in random sized pieces, output must match it
+ * - usage: ./parser_test2.exe < messages
+ *
+ **/
+
+#include <hermes.h>
+#include <assert.h>
+
+int main(int argc, char **argv) {
+
+  int fd = 0; /* 0 is stdin */
+  int msgs_recvd = 0;
+  int max_hdr_size = 1024;
+  char data[4096];
+  int n;
+
+  hms_parser *parser = hms_parser_create( max_hdr_size );
+  assert( parser );
+
+  srandom( 1 );
+  while( (n = read( fd, data, 1 + random() % sizeof(data) )) > 0 ) {
+
+    int off = 0;
+    while( off < n ) {
+
+      hms_msg *msg = NULL; int consumed = 0;
+      int ret = hms_parser_feed( parser, data + off, n - off, &consumed, &msg );
+      assert( ret != HMS_PARSE_ERROR );
+      assert( consumed > 0 || ret == HMS_PARSE_DONE );
+      off += consumed;
+      if( ret == HMS_PARSE_MORE ) { assert( off == n ); break; }
+
+      /* print it back */
+      int hdr_sz = hms_msg_get_header_size( msg );
+      char *buffer = malloc( hdr_sz );
+      hms_msg_print_header( msg, buffer, hdr_sz );
+      fwrite( buffer, 1, hdr_sz, stdout );
+      free( buffer );
+
+      char *body = NULL; int body_sz;
+      hms_msg_get_body( msg, &body, &body_sz );
+      if(body) { fwrite( body, 1, body_sz, stdout ); free( body ); }
+
+      hms_msg_destroy( msg );
+      msgs_recvd++;
+
+    }
+
+  } /* end while() */
+
+  /* a broken header is an error, not a hang */
+  {
+    hms_msg *msg = NULL; int consumed = 0;
+    char bad[] = "PING\nno colon here\n.\n";
+    assert( hms_parser_feed( parser, bad, strlen(bad), &consumed, &msg ) == HMS_PARSE_ERROR );
+    assert( msg == NULL );
+    hms_parser_reset( parser );
+  }
+
+  /* a Content-Length past what an int holds, or past the body limit,
+     is an error before anything is allocated for it */
+  {
+    hms_msg *msg = NULL; int consumed = 0;
+    char huge[] = "PUT\nContent-Length:4294967297\n.\n";
+    char edge[] = "PUT\nContent-Length:2147483646\n.\n";
+    char big[] = "PUT\nContent-Length:65\n.\n";
+    char fits[] = "PUT\nContent-Length:4\n.\nbody";
+    assert( hms_parser_feed( parser, huge, strlen(huge), &consumed, &msg ) == HMS_PARSE_ERROR );
+    hms_parser_reset( parser );
+    assert( hms_parser_feed( parser, edge, strlen(edge), &consumed, &msg ) == HMS_PARSE_ERROR );
+    hms_parser_reset( parser );
+    assert( !hms_parser_set_max_body( parser, 64 ) );
+    assert( hms_parser_feed( parser, big, strlen(big), &consumed, &msg ) == HMS_PARSE_ERROR );
+    assert( msg == NULL );
+    hms_parser_reset( parser );
+    assert( hms_parser_feed( parser, fits, strlen(fits), &consumed, &msg ) == HMS_PARSE_DONE );
+    assert( msg && consumed == (int) strlen(fits) && hms_msg_get_body_size( msg ) == 4 );
+    hms_msg_destroy( msg );
+  }
+
+  hms_parser_destroy( parser );
+
+  return 0;
+
+} /* end main() */
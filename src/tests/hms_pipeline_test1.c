@@ -0,0 +1,325 @@
+/**
+ * HERMES - Test
+ * -------------
+ * by Gokul Soundararajan
+ *
+ * Pipelined requests of one connection handled in parallel,
+ * answered in order
+ *
+ **/
+
+#include <hermes.h>
+#include <assert.h>
+
+#define NUM_REQUESTS 200
+#define BIG_BODY (2*1024*1024)
+#define FLOOD_BODY 1024
+#define FLOOD_LIMIT 64
+
+/* handlers running right now, and the most seen at once */
+static int running = 0;
+static int running_peak = 0;
+
+/* WORK Seq:n: takes a little while, then answers DONE Seq:n */
+static int __work_handle( hms_endpoint *endpoint, hms_msg *msg ) {
+
+  const char *seq = NULL;
+  int now = __atomic_add_fetch( &running, 1, __ATOMIC_RELAXED );
+  int peak = __atomic_load_n( &running_peak, __ATOMIC_RELAXED );
+  while( now > peak && !__atomic_compare_exchange_n( &running_peak, &peak, now, HMS_FALSE,
+						     __ATOMIC_RELAXED, __ATOMIC_RELAXED ) ) { }
+
+  assert( !hms_msg_peek_named_header( msg, "Seq", &seq, NULL ) );
+  usleep( ( atoi( seq ) % 7 ) * 300 );
+
+  hms_msg *reply = hms_msg_create();
+  assert( !hms_msg_set_verb( reply, "DONE" ) );
+  assert( !hms_msg_add_named_header( reply, "Seq", (char *) seq ) );
+  __atomic_sub_fetch( &running, 1, __ATOMIC_RELAXED );
+  int ret = hms_endpoint_send_msg( endpoint, reply );
+  hms_msg_destroy( reply );
+
+  return ret;
+
+}
+
+/* HOLD: waits for the gate to open, then answers HELD */
+static int gate = 0;
+static int __hold_handle( hms_endpoint *endpoint, hms_msg *msg ) {
+
+  __atomic_add_fetch( &running, 1, __ATOMIC_RELAXED );
+  while( !__atomic_load_n( &gate, __ATOMIC_ACQUIRE ) ) { usleep( 1000 ); }
+  __atomic_sub_fetch( &running, 1, __ATOMIC_RELAXED );
+
+  hms_msg *reply = hms_msg_create();
+  assert( !hms_msg_set_verb( reply, "HELD" ) );
+  int ret = hms_endpoint_send_msg( endpoint, reply );
+  hms_msg_destroy( reply );
+
+  return ret;
+
+}
+
+/* BIG: a reply larger than the socket buffers on both ends, within
+   max_outbound */
+static int __big_handle( hms_endpoint *endpoint, hms_msg *msg ) {
+
+  hms_msg *reply = hms_msg_create();
+  char *body = calloc( 1, BIG_BODY );
+  assert( body && !hms_msg_set_verb( reply, "BIG" ) );
+  assert( !hms_msg_set_body( reply, body, BIG_BODY ) );
+  int ret = hms_endpoint_send_msg( endpoint, reply );
+  hms_msg_destroy( reply );
+  free( body );
+
+  return ret;
+
+}
+
+/* the stage stats once they settle on the wanted depths */
+static void __stages( hms *manager, long queued, long send_queued, hms_stage_stats *stats ) {
+
+  int i;
+  hermes_get_stage_stats( manager, stats );
+  for( i=0; i < 200 && ( stats->handler_queued != queued || stats->send_queued != send_queued ); i++ ) {
+    usleep( 10000 );
+    hermes_get_stage_stats( manager, stats );
+  }
+  assert( stats->io_threads == 1 && stats->handler_threads == 4 );
+  assert( stats->handler_queued == queued && stats->send_queued == send_queued );
+
+}
+
+/* FLOOD: replies until a send is refused; how many were taken */
+static int flooded = 0;
+static int __flood_handle( hms_endpoint *endpoint, hms_msg *msg ) {
+
+  hms_msg *reply = hms_msg_create();
+  char body[FLOOD_BODY];
+  memset( body, 'x', sizeof(body) );
+  assert( !hms_msg_set_verb( reply, "PUSH" ) );
+  assert( !hms_msg_set_body( reply, body, sizeof(body) ) );
+  for( flooded=0; flooded <= FLOOD_LIMIT && hms_endpoint_send_msg( endpoint, reply ) == 0; flooded++ ) { }
+  hms_msg_destroy( reply );
+
+  return 0;
+
+}
+
+static void __run( int port, int shards, int io_uring ) {
+
+  hms_ops ops, work_ops, hold_ops, big_ops;
+  hms_config config;
+  hms_connector *connector = NULL;
+  hms_stage_stats stages;
+  char seq[16];
+  int i, tries;
+
+  memset( &ops, 0, sizeof(ops) );
+  memset( &work_ops, 0, sizeof(work_ops) );
+  memset( &hold_ops, 0, sizeof(hold_ops) );
+  memset( &big_ops, 0, sizeof(big_ops) );
+  work_ops.hms_handle = __work_handle;
+  hold_ops.hms_handle = __hold_handle;
+  big_ops.hms_handle = __big_handle;
+  hms_config_init( &config );
+  config.server_port = port;
+  config.num_threads = 4;
+  config.event_loops = 1;
+  config.shards = shards;
+  config.io_uring = io_uring;
+  config.pipeline_depth = 8;
+  config.sndbuf = 64 * 1024;
+  hms *manager = hermes_init_with_config( &config, ops );
+  assert( manager );
+  assert( !hermes_register_verb( manager, "WORK", work_ops ) );
+  assert( !hermes_register_verb( manager, "HOLD", hold_ops ) );
+  assert( !hermes_register_verb( manager, "BIG", big_ops ) );
+
+  for( tries=0; tries < 50 && !connector; tries++ ) {
+    connector = hms_connector_init( "127.0.0.1", port );
+    if( !connector ) { usleep( 10000 ); }
+  }
+  assert( connector );
+
+  /* all requests first, then all replies */
+  running_peak = 0;
+  for( i=0; i < NUM_REQUESTS; i++ ) {
+    hms_msg *msg = hms_msg_create();
+    sprintf( seq, "%d", i );
+    assert( !hms_msg_set_verb( msg, "WORK" ) );
+    assert( !hms_msg_add_named_header( msg, "Seq", seq ) );
+    assert( !hms_connector_send_msg( connector, msg ) );
+    hms_msg_destroy( msg );
+  }
+  for( i=0; i < NUM_REQUESTS; i++ ) {
+    hms_msg *msg = NULL;
+    const char *got = NULL;
+    assert( !hms_connector_recv_msg( connector, &msg ) );
+    assert( !hms_msg_peek_named_header( msg, "Seq", &got, NULL ) );
+    assert( atoi( got ) == i );
+    hms_msg_destroy( msg );
+  }
+  assert( running_peak > 1 );
+  __stages( manager, 0, 0, &stages );
+  assert( stages.send_bytes == 0 );
+
+  /* a full ring on a closed gate: as many requests wait for a worker as
+     there are workers running them */
+  {
+    gate = 0;
+    for( i=0; i < config.pipeline_depth; i++ ) {
+      hms_msg *msg = hms_msg_create();
+      assert( !hms_msg_set_verb( msg, "HOLD" ) );
+      assert( !hms_connector_send_msg( connector, msg ) );
+      hms_msg_destroy( msg );
+    }
+    __stages( manager, config.pipeline_depth - config.num_threads, 0, &stages );
+    for( i=0; i < 200 && running != config.num_threads; i++ ) { usleep( 10000 ); }
+    assert( running == config.num_threads );
+    __atomic_store_n( &gate, 1, __ATOMIC_RELEASE );
+    for( i=0; i < config.pipeline_depth; i++ ) {
+      hms_msg *msg = NULL;
+      assert( !hms_connector_recv_msg( connector, &msg ) );
+      hms_msg_destroy( msg );
+    }
+    __stages( manager, 0, 0, &stages );
+  }
+
+  /* a reply the reader does not take yet waits in the send stage */
+  {
+    hms_msg *msg = hms_msg_create();
+    assert( !hms_msg_set_verb( msg, "BIG" ) );
+    assert( !hms_connector_send_msg( connector, msg ) );
+    hms_msg_destroy( msg ); msg = NULL;
+    __stages( manager, 0, 1, &stages );
+    assert( stages.send_bytes > 0 && stages.send_bytes < BIG_BODY + 64 );
+    assert( !hms_connector_recv_msg( connector, &msg ) );
+    assert( hms_msg_get_body_size( msg ) == BIG_BODY );
+    hms_msg_destroy( msg );
+    __stages( manager, 0, 0, &stages );
+    assert( stages.send_bytes == 0 );
+  }
+
+  /* a handler that fails closes the connection after earlier replies */
+  {
+    hms_msg *msg = hms_msg_create(), *reply = NULL;
+    assert( !hms_msg_set_verb( msg, "PING" ) );
+    assert( !hms_connector_send_msg( connector, msg ) );
+    assert( !hms_msg_set_verb( msg, "BYE" ) );
+    assert( !hms_connector_send_msg( connector, msg ) );
+    hms_msg_destroy( msg );
+    assert( !hms_connector_recv_msg( connector, &reply ) );
+    hms_msg_destroy( reply );
+    assert( hms_connector_recv_msg( connector, &reply ) < 0 );
+  }
+
+  hms_connector_destroy( connector );
+  hermes_shutdown( manager, HMS_TRUE );
+
+  fprintf( stdout, "done pipeline tests: %s%s, %d handlers at once\n",
+	   ( shards ) ? "shards" : "event loops", ( io_uring ) ? " with io_uring" : "", running_peak );
+
+}
+
+/* a pipelined handler past max_outbound under HMS_SLOW_DROP: its sends
+   are refused, what was taken arrives whole and in order */
+static void __slow_consumer( int port ) {
+
+  hms_ops ops, flood_ops;
+  hms_config config;
+  hms_connector *connector = NULL;
+  hms_shed_stats shed;
+  hms_msg *msg = hms_msg_create();
+  const char *got = NULL;
+  int i;
+
+  memset( &ops, 0, sizeof(ops) );
+  memset( &flood_ops, 0, sizeof(flood_ops) );
+  flood_ops.hms_handle = __flood_handle;
+  hms_config_init( &config );
+  config.server_port = port;
+  config.num_threads = 2;
+  config.event_loops = 1;
+  config.pipeline_depth = 4;
+  config.max_outbound = FLOOD_LIMIT * FLOOD_BODY;
+  config.slow_consumer = HMS_SLOW_DROP;
+  hms *manager = hermes_init_with_config( &config, ops );
+  assert( manager );
+  assert( !hermes_register_verb( manager, "FLOOD", flood_ops ) );
+
+  for( i=0; i < 50 && !connector; i++ ) {
+    connector = hms_connector_init( "127.0.0.1", port );
+    if( !connector ) { usleep( 10000 ); }
+  }
+  assert( connector );
+
+  assert( !hms_msg_set_verb( msg, "FLOOD" ) );
+  assert( !hms_connector_send_msg( connector, msg ) );
+  hermes_get_shed_stats( manager, &shed );
+  for( i=0; i < 100 && shed.slow == 0; i++ ) {
+    usleep( 10000 );
+    hermes_get_shed_stats( manager, &shed );
+  }
+  assert( shed.slow == 1 );
+  assert( flooded > 0 && flooded < FLOOD_LIMIT );
+
+  for( i=0; i < flooded; i++ ) {
+    hms_msg *reply = NULL;
+    assert( !hms_connector_recv_msg( connector, &reply ) );
+    assert( !hms_msg_peek_verb( reply, &got, NULL ) && !strcmp( got, "PUSH" ) );
+    assert( hms_msg_get_body_size( reply ) == FLOOD_BODY );
+    hms_msg_destroy( reply );
+  }
+  assert( !hms_msg_set_verb( msg, "PING" ) );
+  assert( !hms_connector_send_msg( connector, msg ) );
+  hms_msg_destroy( msg ); msg = NULL;
+  assert( !hms_connector_recv_msg( connector, &msg ) );
+  assert( !hms_msg_peek_verb( msg, &got, NULL ) && !strcmp( got, "PONG" ) );
+  hms_msg_destroy( msg );
+
+  hms_connector_destroy( connector );
+  hermes_shutdown( manager, HMS_TRUE );
+
+  fprintf( stdout, "done pipelined slow consumer tests: %d queued\n", flooded );
+
+}
+
+/* shards on a port another socket holds: no manager, no exit */
+static void __taken_port( int port ) {
+
+  hms_ops ops;
+  hms_config config;
+  struct sockaddr_in addr;
+  int fd = socket( AF_INET, SOCK_STREAM, 0 );
+
+  memset( &addr, 0, sizeof(addr) );
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons( port );
+  addr.sin_addr.s_addr = INADDR_ANY;
+  assert( fd >= 0 && !bind( fd, (struct sockaddr *) &addr, sizeof(addr) ) && !listen( fd, 8 ) );
+
+  memset( &ops, 0, sizeof(ops) );
+  hms_config_init( &config );
+  config.server_port = port;
+  config.num_threads = 2;
+  config.shards = 2;
+  assert( hermes_init_with_config( &config, ops ) == NULL );
+  config.io_uring = HMS_TRUE;
+  assert( hermes_init_with_config( &config, ops ) == NULL );
+  close( fd );
+
+  fprintf( stdout, "done taken port tests\n" );
+
+}
+
+int main(int argc, char **argv) {
+
+  __run( 61190, 0, HMS_FALSE );
+  __run( 61191, 1, HMS_TRUE );
+  __taken_port( 61194 );
+  __slow_consumer( 61200 );
+
+  return 0;
+
+} /* end main() */
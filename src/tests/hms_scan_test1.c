@@ -0,0 +1,122 @@
+/**
+ * HERMES - Test
+ * -------------
+ * by Gokul Soundararajan
+ *
+ * Header scanner tests for Hermes C edition
+ * - every scanner must build the same index as the scalar one
+ * - usage: ./bench1.exe | ./scan_test1.exe
+ *
+ **/
+
+#include <hermes.h>
+#include <hermes_internal.h>
+#include <assert.h>
+
+#define SCAN_TEST_BUF_SIZE (1024*1024)
+#define SCAN_TEST_WINDOW    4096
+
+static int __same_index( hms_scan_index *a, hms_scan_index *b ) {
+
+  int i;
+  if( a->hdr_len != b->hdr_len ) return 0;
+  if( a->dot != b->dot ) return 0;
+  if( a->num_lines != b->num_lines ) return 0;
+  for( i=0; i < a->num_lines; i++ ) {
+    if( a->lines[i].start != b->lines[i].start ) return 0;
+    if( a->lines[i].end != b->lines[i].end ) return 0;
+    if( a->lines[i].colon != b->lines[i].colon ) return 0;
+  }
+  return 1;
+
+}
+
+/* scan a header twice: in one call and fed a few bytes at a time */
+static void __check_impl( int impl, char *buf, int len, hms_scan_index *ref ) {
+
+  hms_scan_index idx, split_idx;
+  hms_scan_init( &idx );
+  hms_scan_init( &split_idx );
+
+  char *copy = malloc( len );
+  memcpy( copy, buf, len );
+  assert( hms_scan_header_impl( impl, copy, len, &idx ) == ref->hdr_len );
+  assert( __same_index( &idx, ref ) );
+
+  int fed = 0, ret = 0;
+  memcpy( copy, buf, len );
+  while( ret == 0 && fed < len ) {
+    fed += 1 + random() % 40; if( fed > len ) fed = len;
+    ret = hms_scan_header_impl( impl, copy, fed, &split_idx );
+  }
+  assert( ret == ref->hdr_len );
+  assert( __same_index( &split_idx, ref ) );
+
+  free( copy );
+  hms_scan_deinit( &idx );
+  hms_scan_deinit( &split_idx );
+
+}
+
+int main(int argc, char **argv) {
+
+  int fd = 0; /* 0 is stdin */
+  int msgs_recvd = 0;
+  char *buffer = malloc( SCAN_TEST_BUF_SIZE );
+  int start = 0, end = 0, n = 0;
+  hms_scan_index ref;
+  hms_scan_init( &ref );
+
+  fprintf(stdout, "best scanner: %d\n", hms_scan_best_impl() );
+
+  while( HMS_TRUE ) {
+
+    /* refill */
+    if( end - start < (SCAN_TEST_BUF_SIZE / 2) ) {
+      memmove( buffer, buffer + start, end - start );
+      end -= start; start = 0;
+      do {
+	n = read( fd, buffer + end, SCAN_TEST_BUF_SIZE - end );
+	if( n > 0 ) { end += n; }
+      } while( n > 0 && end < SCAN_TEST_BUF_SIZE / 2 );
+    }
+    if( start == end ) break;
+
+    /* scalar is the reference */
+    int len = ( end - start < SCAN_TEST_WINDOW ) ? end - start : SCAN_TEST_WINDOW;
+    char *hdr = malloc( len );
+    memcpy( hdr, buffer + start, len );
+    hms_scan_reset( &ref );
+    int hdr_len = hms_scan_header_impl( HMS_SCAN_SCALAR, hdr, len, &ref );
+    assert( hdr_len > 0 );
+
+    __check_impl( HMS_SCAN_SSE2, buffer + start, len, &ref );
+    if( hms_scan_best_impl() == HMS_SCAN_AVX2 ) {
+      __check_impl( HMS_SCAN_AVX2, buffer + start, len, &ref );
+    }
+
+    /* skip the body */
+    int i, body_len = 0;
+    for( i=0; i < ref.num_lines; i++ ) {
+      hms_scan_line *line = &ref.lines[i];
+      if( line->colon > 0 && strncasecmp( hdr + line->start, HMS_CONTENT_LENGTH,
+					  line->colon - line->start ) == 0 ) {
+	body_len = atoi( hdr + line->colon + 1 );
+      }
+    }
+    free( hdr );
+    assert( end - start >= hdr_len + body_len );
+    start += hdr_len + body_len;
+
+    msgs_recvd++;
+
+  } /* end while() */
+
+  hms_scan_deinit( &ref );
+  free( buffer );
+
+  fprintf(stdout, "scanned %d messages\n", msgs_recvd );
+
+  return 0;
+
+} /* end main() */
@@ -0,0 +1,151 @@
+/**
+ * HERMES - Test
+ * -------------
+ * by Gokul Soundararajan
+ *
+ * Connections and messages turned away while the workers are busy
+ *
+ **/
+
+#include <hermes.h>
+#include <assert.h>
+#include <poll.h>
+
+#define MAX_CONNS 16
+
+/* HOLD: waits for the gate to open, then answers HELD */
+static int gate = 0;
+static int __hold_handle( hms_endpoint *endpoint, hms_msg *msg ) {
+
+  while( !__atomic_load_n( &gate, __ATOMIC_ACQUIRE ) ) { usleep( 1000 ); }
+
+  hms_msg *reply = hms_msg_create();
+  assert( !hms_msg_set_verb( reply, "HELD" ) );
+  int ret = hms_endpoint_send_msg( endpoint, reply );
+  hms_msg_destroy( reply );
+
+  return ret;
+
+}
+
+static void __send( hms_connector *connector, const char *verb ) {
+
+  hms_msg *msg = hms_msg_create();
+  assert( !hms_msg_set_verb( msg, (char *) verb ) );
+  assert( !hms_connector_send_msg( connector, msg ) );
+  hms_msg_destroy( msg );
+
+}
+
+static void __recv( hms_connector *connector, const char *verb ) {
+
+  hms_msg *msg = NULL;
+  const char *got = NULL;
+  assert( !hms_connector_recv_msg( connector, &msg ) );
+  assert( !hms_msg_peek_verb( msg, &got, NULL ) );
+  assert( !strcmp( got, verb ) );
+  hms_msg_destroy( msg );
+
+}
+
+/* something to read within ms: a reply, or the connection closed */
+static int __answered( hms_connector *connector, int ms ) {
+
+  struct pollfd pfd;
+  pfd.fd = connector->socket;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  return poll( &pfd, 1, ms ) == 1;
+
+}
+
+/* Connections (a worker each, or HOLD requests with event loops) until
+   one is turned away: a BUSY reply if busy_reply is set, then the
+   connection closed either way */
+static void __run( int port, int loops, int staged, int busy ) {
+
+  hms_ops ops, hold_ops;
+  hms_config config;
+  hms_connector *conns[MAX_CONNS];
+  hms_shed_stats shed;
+  hms_msg *msg = NULL;
+  int i, n, held, tries;
+
+  memset( &ops, 0, sizeof(ops) );
+  memset( &hold_ops, 0, sizeof(hold_ops) );
+  hold_ops.hms_handle = __hold_handle;
+  hms_config_init( &config );
+  config.server_port = port;
+  config.num_threads = 1;
+  config.event_loops = loops;
+  config.staged_replies = staged;
+  config.max_pending_conns = 1;
+  config.max_pending_msgs = 1;
+  config.busy_reply = busy;
+  hms *manager = hermes_init_with_config( &config, ops );
+  assert( manager );
+  assert( !hermes_register_verb( manager, "HOLD", hold_ops ) );
+  gate = 0;
+
+  conns[0] = NULL;
+  for( tries=0; tries < 50 && !conns[0]; tries++ ) {
+    conns[0] = hms_connector_init( "127.0.0.1", port );
+    if( !conns[0] ) { usleep( 10000 ); }
+  }
+  assert( conns[0] );
+
+  for( n=1; n <= MAX_CONNS; n++ ) {
+    if( loops ) { __send( conns[n-1], "HOLD" ); }
+    if( __answered( conns[n-1], 200 ) ) { break; }
+    assert( n < MAX_CONNS );
+    conns[n] = hms_connector_init( "127.0.0.1", port );
+    assert( conns[n] );
+  }
+  assert( n > 1 && n <= MAX_CONNS );
+
+  /* the last one was turned away: a dropped message leaves its
+     connection open only if BUSY went out */
+  held = n-1;
+  if( busy ) { __recv( conns[held], "BUSY" ); }
+  if( !busy || !loops ) {
+    assert( hms_connector_recv_msg( conns[held], &msg ) < 0 );
+    hms_connector_destroy( conns[held] );
+    n--;
+  }
+  hermes_get_shed_stats( manager, &shed );
+  assert( shed.connections == ( loops ? 0 : 1 ) );
+  assert( shed.requests == ( loops ? 1 : 0 ) );
+
+  /* the others are served once the workers are free; a worker per
+     connection takes the next one when its connection closes */
+  __atomic_store_n( &gate, 1, __ATOMIC_RELEASE );
+  for( i=0; i < held; i++ ) {
+    if( loops ) { __recv( conns[i], "HELD" ); }
+  }
+  for( i=0; i < n; i++ ) {
+    __send( conns[i], "PING" );
+    __recv( conns[i], "PONG" );
+    hms_connector_destroy( conns[i] );
+  }
+
+  hermes_shutdown( manager, HMS_TRUE );
+
+  fprintf( stdout, "done shed tests: %s%s%s, turned away after %d\n",
+	   ( loops ) ? "event loops" : "thread per connection", ( staged ) ? ", staged" : "",
+	   ( busy ) ? ", BUSY" : "", held );
+
+}
+
+int main(int argc, char **argv) {
+
+  __run( 61201, 0, HMS_FALSE, HMS_TRUE );
+  __run( 61202, 0, HMS_FALSE, HMS_FALSE );
+  __run( 61203, 1, HMS_FALSE, HMS_TRUE );
+  __run( 61204, 1, HMS_FALSE, HMS_FALSE );
+  __run( 61205, 1, HMS_TRUE, HMS_TRUE );
+  __run( 61206, 1, HMS_TRUE, HMS_FALSE );
+
+  return 0;
+
+} /* end main() */
@@ -11,6 +11,10 @@
  * Example thread pooling library
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -133,6 +137,37 @@ int tpool_add_work(
   return 1;
 }
 
+/* pins every worker of the pool to one cpu */
+int tpool_pin(tpool_t          tpool,
+	      int              cpu)
+{
+#ifdef __linux__
+  int i;
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  for (i = 0; i != tpool->num_threads; i++) {
+    if (pthread_setaffinity_np(tpool->threads[i], sizeof(set), &set) != 0)
+      return -1;
+  }
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/* work queued and not yet taken by a worker */
+int tpool_queue_size(tpool_t          tpool)
+{
+  int size;
+
+  pthread_mutex_lock(&(tpool->queue_lock));
+  size = tpool->cur_queue_size;
+  pthread_mutex_unlock(&(tpool->queue_lock));
+  return size;
+}
+
 int tpool_destroy(tpool_t          tpool,
 		  int              finish)
 {
@@ -184,7 +219,7 @@ int tpool_destroy(tpool_t          tpool,
   /* Now free pool structures */
   free(tpool->threads);
   while(tpool->queue_head != NULL) {
-    cur_nodep = tpool->queue_head->next; 
+    cur_nodep = tpool->queue_head; 
     tpool->queue_head = tpool->queue_head->next;
     free(cur_nodep);
   }